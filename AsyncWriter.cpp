@@ -0,0 +1,641 @@
+/*****************************************************************
+  ASYNC WRITER
+
+  See AsyncWriter.h.
+
+*****************************************************************/
+
+#include "AsyncWriter.h"
+#include "CameraUtils.h"
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <thread>
+
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/io_uring.h> )
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+using namespace FlyCapture2;
+
+namespace
+{
+    const unsigned int sk_alignment = 4096;
+
+    class ThreadWriter : public AsyncWriter
+    {
+    public:
+        ThreadWriter( int fd, bool direct, unsigned int numBuffers, size_t bufferSize )
+            : AsyncWriter( fd, direct, numBuffers, bufferSize ),
+              m_stopping( false )
+        {
+        }
+
+        virtual ~ThreadWriter()
+        {
+            WaitAll();
+            {
+                std::lock_guard<std::mutex> lock( m_queueMutex );
+                m_stopping = true;
+            }
+            m_work.notify_all();
+            for ( unsigned int i = 0; i < m_threads.size(); i++ )
+            {
+                m_threads[i].join();
+            }
+        }
+
+        bool Init()
+        {
+            if ( !AllocateBuffers() )
+            {
+                return false;
+            }
+            // every buffer can be in flight at once
+            for ( unsigned int i = 0; i < NumBuffers(); i++ )
+            {
+                m_threads.push_back( std::thread( &ThreadWriter::WorkLoop, this ) );
+            }
+            return true;
+        }
+
+        virtual const char* Name() const { return "pwrite threads"; }
+
+    private:
+        virtual bool Start( unsigned int buffer )
+        {
+            {
+                std::lock_guard<std::mutex> lock( m_queueMutex );
+                m_queue.push_back( buffer );
+            }
+            m_work.notify_one();
+            return true;
+        }
+
+        virtual void WaitForCompletion( std::unique_lock<std::mutex>& lock )
+        {
+            m_completed.wait( lock );
+        }
+
+        void WorkLoop()
+        {
+            for ( ;; )
+            {
+                unsigned int buffer;
+                {
+                    std::unique_lock<std::mutex> lock( m_queueMutex );
+                    while ( m_queue.empty() && !m_stopping )
+                    {
+                        m_work.wait( lock );
+                    }
+                    if ( m_queue.empty() )
+                    {
+                        return;
+                    }
+                    buffer = m_queue.front();
+                    m_queue.pop_front();
+                }
+
+                Complete( buffer, WriteFully( m_buffers[buffer], m_jobs[buffer].size, m_jobs[buffer].offset ) );
+            }
+        }
+
+        bool WriteFully( const unsigned char* pData, size_t size, unsigned long long offset )
+        {
+            size_t done = 0;
+            while ( done < size )
+            {
+                ssize_t n = pwrite( m_fd, pData + done, size - done, offset + done );
+                if ( n < 0 && errno == EINTR )
+                {
+                    continue;
+                }
+                if ( n < 0 && errno == EINVAL && IsDirect() )
+                {
+                    DropDirect();
+                    continue;
+                }
+                if ( n <= 0 )
+                {
+                    return false;
+                }
+                done += n;
+            }
+            return true;
+        }
+
+        std::mutex m_queueMutex;
+        std::condition_variable m_work;
+        std::deque<unsigned int> m_queue;
+        bool m_stopping;
+        std::vector<std::thread> m_threads;
+    };
+
+#ifdef HAVE_IO_URING
+    int UringSetup( unsigned int entries, io_uring_params* pParams )
+    {
+        return (int)syscall( __NR_io_uring_setup, entries, pParams );
+    }
+
+    int UringEnter( int ring, unsigned int toSubmit, unsigned int minComplete, unsigned int flags )
+    {
+        return (int)syscall( __NR_io_uring_enter, ring, toSubmit, minComplete, flags, NULL, 0 );
+    }
+
+    int UringRegister( int ring, unsigned int opcode, const void* pArg, unsigned int numArgs )
+    {
+        return (int)syscall( __NR_io_uring_register, ring, opcode, pArg, numArgs );
+    }
+
+    class UringWriter : public AsyncWriter
+    {
+    public:
+        UringWriter( int fd, bool direct, unsigned int numBuffers, size_t bufferSize )
+            : AsyncWriter( fd, direct, numBuffers, bufferSize ),
+              m_ring( -1 ),
+              m_pSq( MAP_FAILED ),
+              m_sqSize( 0 ),
+              m_pCq( MAP_FAILED ),
+              m_cqSize( 0 ),
+              m_pSqes( (io_uring_sqe*)MAP_FAILED ),
+              m_sqesSize( 0 ),
+              m_fixedBuffers( false ),
+              m_written( numBuffers > 0 ? numBuffers : 1, 0 )
+        {
+        }
+
+        virtual ~UringWriter()
+        {
+            if ( m_ring >= 0 )
+            {
+                WaitAll();
+            }
+            if ( m_pSqes != MAP_FAILED )
+            {
+                munmap( m_pSqes, m_sqesSize );
+            }
+            if ( m_pCq != MAP_FAILED )
+            {
+                munmap( m_pCq, m_cqSize );
+            }
+            if ( m_pSq != MAP_FAILED )
+            {
+                munmap( m_pSq, m_sqSize );
+            }
+            if ( m_ring >= 0 )
+            {
+                close( m_ring );
+            }
+        }
+
+        bool Init()
+        {
+            if ( !AllocateBuffers() )
+            {
+                return false;
+            }
+
+            io_uring_params params;
+            memset( &params, 0, sizeof( params ) );
+            m_ring = UringSetup( NumBuffers(), &params );
+            if ( m_ring < 0 )
+            {
+                // ENOSYS on old kernels, EPERM where seccomp or
+                // io_uring_disabled forbids it
+                return false;
+            }
+
+            m_sqSize = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+            m_cqSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+            m_sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+            m_pSq = mmap( NULL, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING );
+            m_pCq = mmap( NULL, m_cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING );
+            m_pSqes = (io_uring_sqe*)mmap( NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES );
+            if ( m_pSq == MAP_FAILED || m_pCq == MAP_FAILED || m_pSqes == MAP_FAILED )
+            {
+                return false;
+            }
+            unsigned char* pSq = (unsigned char*)m_pSq;
+            unsigned char* pCq = (unsigned char*)m_pCq;
+            m_pSqTail = (unsigned int*)( pSq + params.sq_off.tail );
+            m_sqMask = *(unsigned int*)( pSq + params.sq_off.ring_mask );
+            m_pSqArray = (unsigned int*)( pSq + params.sq_off.array );
+            m_pCqHead = (unsigned int*)( pCq + params.cq_off.head );
+            m_pCqTail = (unsigned int*)( pCq + params.cq_off.tail );
+            m_cqMask = *(unsigned int*)( pCq + params.cq_off.ring_mask );
+            m_pCqes = (io_uring_cqe*)( pCq + params.cq_off.cqes );
+
+            // the file is SQE file index 0 from now on
+            if ( UringRegister( m_ring, IORING_REGISTER_FILES, &m_fd, 1 ) < 0 )
+            {
+                return false;
+            }
+
+            // pinned memory counts against RLIMIT_MEMLOCK; without the
+            // registration writes still go through the ring, just as
+            // plain IORING_OP_WRITE
+            std::vector<iovec> iovecs( NumBuffers() );
+            for ( unsigned int i = 0; i < iovecs.size(); i++ )
+            {
+                iovecs[i].iov_base = m_buffers[i];
+                iovecs[i].iov_len = m_bufferSize;
+            }
+            m_fixedBuffers = UringRegister( m_ring, IORING_REGISTER_BUFFERS, &iovecs[0], (unsigned int)iovecs.size() ) == 0;
+            return true;
+        }
+
+        virtual const char* Name() const
+        {
+            return m_fixedBuffers ? "io_uring" : "io_uring (buffers not registered)";
+        }
+
+    private:
+        virtual bool Start( unsigned int buffer )
+        {
+            m_written[buffer] = 0;
+            return Push( buffer );
+        }
+
+        // queues a write of what is left of buffer
+        bool Push( unsigned int buffer )
+        {
+            const Job& job = m_jobs[buffer];
+            size_t written = m_written[buffer];
+
+            unsigned int tail = *m_pSqTail;
+            unsigned int index = tail & m_sqMask;
+            io_uring_sqe* pSqe = &m_pSqes[index];
+            memset( pSqe, 0, sizeof( *pSqe ) );
+            pSqe->opcode = m_fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            pSqe->flags = IOSQE_FIXED_FILE;
+            pSqe->fd = 0;
+            pSqe->addr = (unsigned long long)(uintptr_t)( m_buffers[buffer] + written );
+            pSqe->len = (unsigned int)( job.size - written );
+            pSqe->off = job.offset + written;
+            pSqe->buf_index = (unsigned short)buffer;
+            pSqe->user_data = buffer;
+            m_pSqArray[index] = index;
+            __atomic_store_n( m_pSqTail, tail + 1, __ATOMIC_RELEASE );
+
+            for ( ;; )
+            {
+                int submitted = UringEnter( m_ring, 1, 0, 0 );
+                if ( submitted >= 0 )
+                {
+                    return true;
+                }
+                if ( errno != EINTR && errno != EAGAIN )
+                {
+                    return false;
+                }
+            }
+        }
+
+        virtual void WaitForCompletion( std::unique_lock<std::mutex>& lock )
+        {
+            lock.unlock();
+            if ( UringEnter( m_ring, 0, 1, IORING_ENTER_GETEVENTS ) >= 0 || errno == EINTR )
+            {
+                Reap();
+            }
+            lock.lock();
+        }
+
+        virtual void Poll()
+        {
+            // the completion ring is in our memory, no syscall needed
+            Reap();
+        }
+
+        void Reap()
+        {
+            unsigned int head = *m_pCqHead;
+            unsigned int tail = __atomic_load_n( m_pCqTail, __ATOMIC_ACQUIRE );
+            for ( ; head != tail; head++ )
+            {
+                const io_uring_cqe& cqe = m_pCqes[head & m_cqMask];
+                unsigned int buffer = (unsigned int)cqe.user_data;
+                int result = cqe.res;
+                __atomic_store_n( m_pCqHead, head + 1, __ATOMIC_RELEASE );
+
+                bool ok = true;
+                bool retry = false;
+                if ( result == -EINVAL && IsDirect() )
+                {
+                    DropDirect();
+                    retry = true;
+                }
+                else if ( result == -EINTR || result == -EAGAIN )
+                {
+                    retry = true;
+                }
+                else if ( result > 0 )
+                {
+                    // a short write continues where it stopped
+                    m_written[buffer] += result;
+                    retry = m_written[buffer] < m_jobs[buffer].size;
+                }
+                else
+                {
+                    ok = false;
+                }
+
+                if ( retry && !Push( buffer ) )
+                {
+                    ok = false;
+                    retry = false;
+                }
+                if ( !retry )
+                {
+                    Complete( buffer, ok );
+                }
+            }
+        }
+
+        int m_ring;
+        void* m_pSq;
+        size_t m_sqSize;
+        void* m_pCq;
+        size_t m_cqSize;
+        io_uring_sqe* m_pSqes;
+        size_t m_sqesSize;
+
+        unsigned int* m_pSqTail;
+        unsigned int m_sqMask;
+        unsigned int* m_pSqArray;
+        unsigned int* m_pCqHead;
+        unsigned int* m_pCqTail;
+        unsigned int m_cqMask;
+        io_uring_cqe* m_pCqes;
+
+        bool m_fixedBuffers;
+        std::vector<size_t> m_written;      // bytes of each job already written
+    };
+#endif
+}
+
+AsyncWriter* AsyncWriter::Create( int fd, bool direct, unsigned int numBuffers, size_t bufferSize, AsyncWriterBackend backend )
+{
+#ifdef HAVE_IO_URING
+    if ( backend != ASYNC_WRITER_THREADS )
+    {
+        UringWriter* pWriter = new UringWriter( fd, direct, numBuffers, bufferSize );
+        if ( pWriter->Init() )
+        {
+            return pWriter;
+        }
+        delete pWriter;
+    }
+#endif
+    if ( backend == ASYNC_WRITER_URING )
+    {
+        return NULL;
+    }
+    ThreadWriter* pWriter = new ThreadWriter( fd, direct, numBuffers, bufferSize );
+    if ( pWriter->Init() )
+    {
+        return pWriter;
+    }
+    delete pWriter;
+    return NULL;
+}
+
+AsyncWriter::AsyncWriter( int fd, bool direct, unsigned int numBuffers, size_t bufferSize )
+    : m_fd( fd ),
+      m_direct( direct ),
+      m_bufferSize( bufferSize ),
+      m_buffers( numBuffers > 0 ? numBuffers : 1, (unsigned char*)NULL ),
+      m_jobs( m_buffers.size() ),
+      m_inFlight( 0 ),
+      m_failed( false )
+{
+    for ( unsigned int i = 0; i < m_jobs.size(); i++ )
+    {
+        m_jobs[i].state = JOB_FREE;
+        m_jobs[i].size = 0;
+        m_jobs[i].offset = 0;
+        m_jobs[i].submitUs = 0;
+    }
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    for ( unsigned int i = 0; i < m_buffers.size(); i++ )
+    {
+        free( m_buffers[i] );
+    }
+}
+
+bool AsyncWriter::AllocateBuffers()
+{
+    for ( unsigned int i = 0; i < m_buffers.size(); i++ )
+    {
+        void* p = NULL;
+        if ( posix_memalign( &p, sk_alignment, m_bufferSize ) != 0 )
+        {
+            return false;
+        }
+        memset( p, 0, m_bufferSize );
+        m_buffers[i] = (unsigned char*)p;
+    }
+    return true;
+}
+
+unsigned char* AsyncWriter::Acquire()
+{
+    unsigned long long startUs = HostTimeUs();
+    Poll();
+    std::unique_lock<std::mutex> lock( m_mutex );
+    for ( ;; )
+    {
+        for ( unsigned int i = 0; i < m_jobs.size(); i++ )
+        {
+            if ( m_jobs[i].state == JOB_FREE )
+            {
+                m_jobs[i].state = JOB_FILLING;
+                unsigned long long waitUs = HostTimeUs() - startUs;
+                m_stats.waitUs += waitUs;
+                if ( waitUs > m_stats.maxWaitUs )
+                {
+                    m_stats.maxWaitUs = waitUs;
+                }
+                return m_buffers[i];
+            }
+        }
+        if ( m_inFlight == 0 )
+        {
+            // every buffer was acquired and none submitted
+            return NULL;
+        }
+        WaitForCompletion( lock );
+    }
+}
+
+Error AsyncWriter::Submit( unsigned char* pBuffer, size_t size, unsigned long long offset )
+{
+    Poll();
+    unsigned int buffer = 0;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        while ( buffer < m_buffers.size() && m_buffers[buffer] != pBuffer )
+        {
+            buffer++;
+        }
+        if ( buffer == m_buffers.size() || m_jobs[buffer].state != JOB_FILLING || size > m_bufferSize )
+        {
+            return FailureError();
+        }
+        Job& job = m_jobs[buffer];
+        job.state = JOB_WRITING;
+        job.size = size;
+        job.offset = offset;
+        job.submitUs = HostTimeUs();
+        m_inFlight++;
+        m_stats.inFlightSum += m_inFlight;
+        if ( m_inFlight > m_stats.maxInFlight )
+        {
+            m_stats.maxInFlight = m_inFlight;
+        }
+    }
+
+    if ( !Start( buffer ) )
+    {
+        Complete( buffer, false );
+        return FailureError();
+    }
+    return Error();
+}
+
+Error AsyncWriter::Wait()
+{
+    unsigned long long startUs = HostTimeUs();
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( m_inFlight > 0 )
+    {
+        WaitForCompletion( lock );
+    }
+    unsigned long long waitUs = HostTimeUs() - startUs;
+    m_stats.waitUs += waitUs;
+    if ( waitUs > m_stats.maxWaitUs )
+    {
+        m_stats.maxWaitUs = waitUs;
+    }
+
+    bool failed = m_failed;
+    m_failed = false;
+    return failed ? FailureError() : Error();
+}
+
+void AsyncWriter::WaitAll()
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( m_inFlight > 0 )
+    {
+        WaitForCompletion( lock );
+    }
+}
+
+void AsyncWriter::Complete( unsigned int buffer, bool ok )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        Job& job = m_jobs[buffer];
+        unsigned long long completionUs = HostTimeUs() - job.submitUs;
+        job.state = JOB_FREE;
+        m_inFlight--;
+        m_stats.writes++;
+        if ( ok )
+        {
+            m_stats.bytes += job.size;
+        }
+        else
+        {
+            m_stats.errors++;
+            m_failed = true;
+        }
+        m_stats.completionUs += completionUs;
+        m_stats.completionSqUs += (double)completionUs * completionUs;
+        if ( completionUs > m_stats.maxCompletionUs )
+        {
+            m_stats.maxCompletionUs = completionUs;
+        }
+    }
+    m_completed.notify_all();
+}
+
+void AsyncWriter::DropDirect()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_direct )
+    {
+        // the filesystem accepted O_DIRECT at open but not this write
+        fcntl( m_fd, F_SETFL, fcntl( m_fd, F_GETFL ) & ~O_DIRECT );
+        m_direct = false;
+    }
+}
+
+bool AsyncWriter::IsDirect() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_direct;
+}
+
+AsyncWriterStats AsyncWriter::Stats() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats;
+}
+
+void AsyncWriter::PrintStats( const char* pLabel, const std::string& name, const AsyncWriterStats& stats )
+{
+    printf( "%s: %s, %llu writes, %.1f MB, %llu failed, caller waited %.1f ms (longest %.1f)\n", pLabel, name.c_str(),
+            stats.writes, stats.bytes / 1e6, stats.errors, stats.waitUs / 1000.0, stats.maxWaitUs / 1000.0 );
+    double meanUs = stats.writes > 0 ? (double)stats.completionUs / stats.writes : 0.0;
+    double varianceUs = stats.writes > 0 ? stats.completionSqUs / stats.writes - meanUs * meanUs : 0.0;
+    printf( "%s: queue depth %.1f mean, %u max, write %.1f ms mean (sd %.1f, max %.1f)\n", pLabel,
+            stats.writes > 0 ? (double)stats.inFlightSum / stats.writes : 0.0, stats.maxInFlight,
+            meanUs / 1000.0, varianceUs > 0.0 ? sqrt( varianceUs ) / 1000.0 : 0.0, stats.maxCompletionUs / 1000.0 );
+}
+
+const char* AsyncWriterBackendName( AsyncWriterBackend backend )
+{
+    switch ( backend )
+    {
+    case ASYNC_WRITER_URING: return "uring";
+    case ASYNC_WRITER_THREADS: return "threads";
+    default: return "auto";
+    }
+}
+
+bool ParseAsyncWriterBackend( const char* pName, AsyncWriterBackend* pBackend )
+{
+    if ( !strcmp( pName, "auto" ) )
+    {
+        *pBackend = ASYNC_WRITER_AUTO;
+    }
+    else if ( !strcmp( pName, "uring" ) )
+    {
+        *pBackend = ASYNC_WRITER_URING;
+    }
+    else if ( !strcmp( pName, "threads" ) )
+    {
+        *pBackend = ASYNC_WRITER_THREADS;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
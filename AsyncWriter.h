@@ -0,0 +1,154 @@
+/*****************************************************************
+  ASYNC WRITER
+
+  Positioned writes to one file that return before the data is on disk,
+  so the thread producing the data does not block in the kernel. The
+  writer owns a small set of aligned buffers: the caller fills one from
+  Acquire(), hands it to Submit() and carries on with the next. Acquire()
+  only waits when every buffer is still being written.
+
+  Two backends:
+
+  - io_uring: the buffers are registered with the kernel (fixed buffers)
+    and the file is registered as a fixed file, so a write is one SQE and
+    no per-write setup. The ring is driven with the raw syscalls.
+  - threads: one thread per buffer doing plain pwrite, for kernels or
+    sandboxes without io_uring.
+
+  Both handle short writes and fall back to buffered writes if the file
+  was opened with O_DIRECT and the filesystem refuses a write.
+
+  Acquire(), Submit() and Wait() are meant to be called from one thread.
+
+*****************************************************************/
+
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include "FlyCapture2.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+enum AsyncWriterBackend
+{
+    ASYNC_WRITER_AUTO,          // io_uring if the kernel allows it, else threads
+    ASYNC_WRITER_URING,
+    ASYNC_WRITER_THREADS
+};
+
+struct AsyncWriterStats
+{
+    unsigned long long writes;              // buffers written
+    unsigned long long bytes;
+    unsigned long long errors;
+    unsigned int maxInFlight;               // deepest the queue got
+    unsigned long long inFlightSum;         // queue depth summed over submissions
+    unsigned long long completionUs;        // Submit() until the write was seen complete, summed
+    unsigned long long maxCompletionUs;
+    double completionSqUs;                  // squares of the completion times, summed, for the jitter
+    unsigned long long waitUs;              // caller blocked for a free buffer or in Wait()
+    unsigned long long maxWaitUs;
+
+    AsyncWriterStats()
+        : writes( 0 ), bytes( 0 ), errors( 0 ), maxInFlight( 0 ), inFlightSum( 0 ),
+          completionUs( 0 ), maxCompletionUs( 0 ), completionSqUs( 0.0 ), waitUs( 0 ), maxWaitUs( 0 ) {}
+};
+
+class AsyncWriter
+{
+public:
+    // Writes to fd, which stays open and owned by the caller. direct says
+    // whether fd has O_DIRECT. Returns NULL if the backend cannot be set up
+    // (for AUTO, only if neither can).
+    static AsyncWriter* Create(
+        int fd,
+        bool direct,
+        unsigned int numBuffers,
+        size_t bufferSize,
+        AsyncWriterBackend backend = ASYNC_WRITER_AUTO );
+
+    // Waits for the writes still in flight.
+    virtual ~AsyncWriter();
+
+    // A bufferSize buffer no write is using, aligned for O_DIRECT.
+    unsigned char* Acquire();
+
+    // Starts writing the first size bytes of pBuffer, which came from
+    // Acquire(), at offset. pBuffer must not be touched until Acquire()
+    // returns it again.
+    FlyCapture2::Error Submit( unsigned char* pBuffer, size_t size, unsigned long long offset );
+
+    // Waits for every submitted write. Returns the last failure since the
+    // previous Wait(), if any.
+    FlyCapture2::Error Wait();
+
+    virtual const char* Name() const = 0;
+    bool IsDirect() const;
+    unsigned int NumBuffers() const { return (unsigned int)m_buffers.size(); }
+    size_t BufferSize() const { return m_bufferSize; }
+    AsyncWriterStats Stats() const;
+
+    // Two lines starting with pLabel; name is the backend's Name().
+    static void PrintStats( const char* pLabel, const std::string& name, const AsyncWriterStats& stats );
+
+protected:
+    AsyncWriter( int fd, bool direct, unsigned int numBuffers, size_t bufferSize );
+
+    enum JobState { JOB_FREE, JOB_FILLING, JOB_WRITING };
+
+    struct Job
+    {
+        JobState state;
+        size_t size;
+        unsigned long long offset;
+        unsigned long long submitUs;
+    };
+
+    bool AllocateBuffers();
+
+    // Backend: start writing job buffer. Must eventually lead to
+    // Complete( buffer, ... ), possibly from another thread.
+    virtual bool Start( unsigned int buffer ) = 0;
+
+    // Backend: block until at least one write may have completed. Called
+    // with lock held; may drop and retake it.
+    virtual void WaitForCompletion( std::unique_lock<std::mutex>& lock ) = 0;
+
+    // Backend: pick up finished writes without blocking, if completions
+    // are not delivered on their own.
+    virtual void Poll() {}
+
+    void Complete( unsigned int buffer, bool ok );
+
+    // The filesystem refused an O_DIRECT write; continue buffered.
+    void DropDirect();
+
+    // Waits for every write in flight. Backends call it from their
+    // destructors, before tearing down what Start() uses.
+    void WaitAll();
+
+    int m_fd;
+    bool m_direct;
+    size_t m_bufferSize;
+    std::vector<unsigned char*> m_buffers;
+    std::vector<Job> m_jobs;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_completed;
+    unsigned int m_inFlight;
+    bool m_failed;
+    AsyncWriterStats m_stats;
+
+private:
+    AsyncWriter( const AsyncWriter& );
+    AsyncWriter& operator=( const AsyncWriter& );
+};
+
+const char* AsyncWriterBackendName( AsyncWriterBackend backend );
+
+// "auto", "uring" or "threads".
+bool ParseAsyncWriterBackend( const char* pName, AsyncWriterBackend* pBackend );
+
+#endif // ASYNC_WRITER_H
@@ -0,0 +1,216 @@
+/*****************************************************************
+  CAMERA UTILITIES
+
+  See CameraUtils.h.
+
+*****************************************************************/
+
+#include "CameraUtils.h"
+#include "SyntheticCamera.h"
+#include <chrono>
+#include <vector>
+#include <thread>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    const unsigned int sk_softwareTriggerRegister = 0x62C;
+    const unsigned int sk_softwareTriggerSource = 7;
+    const unsigned int sk_linkBytesPerUs = 380;
+}
+
+Error FailureError()
+{
+    // borrow one from the SDK: converting an empty image always fails
+    Image empty, converted;
+    return empty.Convert( PIXEL_FORMAT_RGB, &converted );
+}
+
+Error GetImageSettings( CameraBase* pCamera, Format7ImageSettings* pSettings )
+{
+    unsigned int packetSize;
+    float percentage;
+
+    Camera* pRealCamera = dynamic_cast<Camera*>( pCamera );
+    if ( pRealCamera != NULL )
+    {
+        return pRealCamera->GetFormat7Configuration( pSettings, &packetSize, &percentage );
+    }
+    SyntheticCamera* pSyntheticCamera = dynamic_cast<SyntheticCamera*>( pCamera );
+    if ( pSyntheticCamera != NULL )
+    {
+        return pSyntheticCamera->GetFormat7Configuration( pSettings, &packetSize, &percentage );
+    }
+    return FailureError();
+}
+
+Error GetFrameSize( CameraBase* pCamera, unsigned int* pBytes )
+{
+    Format7ImageSettings settings;
+    Error error = GetImageSettings( pCamera, &settings );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+    unsigned int stride = (unsigned int)( ( (unsigned long long)settings.width * Image::DetermineBitsPerPixel( settings.pixelFormat ) + 7 ) / 8 );
+    *pBytes = stride * settings.height;
+    return Error();
+}
+
+Error StartSyncCapture(
+    unsigned int numCameras,
+    CameraBase** ppCameras,
+    const ImageEventCallback* pCallbackFns,
+    const void** pCallbackDataArray )
+{
+    std::vector<const Camera*> realCameras;
+    std::vector<SyntheticCamera*> syntheticCameras;
+    for ( unsigned int i = 0; i < numCameras; i++ )
+    {
+        Camera* pRealCamera = dynamic_cast<Camera*>( ppCameras[i] );
+        SyntheticCamera* pSyntheticCamera = dynamic_cast<SyntheticCamera*>( ppCameras[i] );
+        if ( pRealCamera != NULL )
+        {
+            realCameras.push_back( pRealCamera );
+        }
+        else if ( pSyntheticCamera != NULL )
+        {
+            syntheticCameras.push_back( pSyntheticCamera );
+        }
+    }
+
+    if ( numCameras > 0 && realCameras.size() == numCameras )
+    {
+        return Camera::StartSyncCapture( numCameras, &realCameras[0], pCallbackFns, pCallbackDataArray );
+    }
+    if ( numCameras > 0 && syntheticCameras.size() == numCameras )
+    {
+        return SyntheticCamera::StartSyncCapture( numCameras, &syntheticCameras[0], pCallbackFns, pCallbackDataArray );
+    }
+    return FailureError();
+}
+
+Error SetSoftwareTrigger( CameraBase* pCamera, bool on )
+{
+    TriggerMode triggerMode;
+    Error error = pCamera->GetTriggerMode( &triggerMode );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+    triggerMode.onOff = on;
+    triggerMode.mode = 0;
+    triggerMode.parameter = 0;
+    triggerMode.source = sk_softwareTriggerSource;
+    return pCamera->SetTriggerMode( &triggerMode );
+}
+
+Error WaitForTriggerReady( CameraBase* pCamera, int timeoutMs )
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( timeoutMs );
+    for (;;)
+    {
+        unsigned int value = 0;
+        Error error = pCamera->ReadRegister( sk_softwareTriggerRegister, &value );
+        if ( error != PGRERROR_OK )
+        {
+            return error;
+        }
+        if ( ( value >> 31 ) == 0 )
+        {
+            return Error();
+        }
+        if ( std::chrono::steady_clock::now() >= deadline )
+        {
+            return FailureError();
+        }
+        std::this_thread::yield();
+    }
+}
+
+Error FireSoftwareTrigger( unsigned int numCameras, CameraBase** ppCameras )
+{
+    if ( numCameras == 0 )
+    {
+        return Error();
+    }
+    if ( numCameras == 1 || ppCameras[0]->FireSoftwareTrigger( true ) != PGRERROR_OK )
+    {
+        for ( unsigned int i = 0; i < numCameras; i++ )
+        {
+            Error error = ppCameras[i]->FireSoftwareTrigger( false );
+            if ( error != PGRERROR_OK )
+            {
+                return error;
+            }
+        }
+    }
+    return Error();
+}
+
+unsigned int TransferTimeUs( unsigned int numBytes )
+{
+    return ( numBytes + sk_linkBytesPerUs - 1 ) / sk_linkBytesPerUs;
+}
+
+unsigned int ExposureAndTransferUs( CameraBase* pCamera )
+{
+    unsigned int totalUs = 0;
+    Property shutter( SHUTTER );
+    if ( pCamera->GetProperty( &shutter ) == PGRERROR_OK )
+    {
+        totalUs += (unsigned int)( shutter.absValue * 1000.0f );
+    }
+    Format7ImageSettings settings;
+    if ( GetImageSettings( pCamera, &settings ) == PGRERROR_OK )
+    {
+        unsigned long long bits = (unsigned long long)settings.width * settings.height * Image::DetermineBitsPerPixel( settings.pixelFormat );
+        totalUs += TransferTimeUs( (unsigned int)( ( bits + 7 ) / 8 ) );
+    }
+    return totalUs;
+}
+
+unsigned long long HostTimeUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+Error EnableEmbeddedInfo( CameraBase* pCamera )
+{
+    EmbeddedImageInfo info;
+    Error error = pCamera->GetEmbeddedImageInfo( &info );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+    info.timestamp.onOff = info.timestamp.available;
+    info.frameCounter.onOff = info.frameCounter.available;
+    return pCamera->SetEmbeddedImageInfo( &info );
+}
+
+void ParseEmbeddedInfo( const unsigned char* pData, const EmbeddedImageInfo& info, ImageMetadata* pMetadata )
+{
+    const EmbeddedImageInfoProperty* pEmbedded = &info.timestamp;
+    unsigned int* pValues = &pMetadata->embeddedTimeStamp;
+    for ( unsigned int i = 0; i < sizeof( info ) / sizeof( EmbeddedImageInfoProperty ); i++ )
+    {
+        if ( pEmbedded[i].onOff )
+        {
+            pValues[i] = ( (unsigned int)pData[0] << 24 ) | ( (unsigned int)pData[1] << 16 ) |
+                         ( (unsigned int)pData[2] << 8 ) | pData[3];
+            pData += 4;
+        }
+    }
+}
+
+unsigned long long CycleTimeUs( unsigned int seconds, unsigned int cycleCount, unsigned int cycleOffset )
+{
+    return (unsigned long long)seconds * 1000000 + (unsigned long long)cycleCount * 125 + cycleOffset * 125 / 3072;
+}
+
+unsigned long long EmbeddedTimeStampUs( unsigned int embeddedTimeStamp )
+{
+    return CycleTimeUs( embeddedTimeStamp >> 25, ( embeddedTimeStamp >> 12 ) & 0x1FFF, embeddedTimeStamp & 0xFFF );
+}
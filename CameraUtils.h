@@ -0,0 +1,70 @@
+/*****************************************************************
+  CAMERA UTILITIES
+
+  Small helpers shared by the capture code that work the same for a real
+  Camera and for the SyntheticCamera backend.
+
+*****************************************************************/
+
+#ifndef CAMERA_UTILS_H
+#define CAMERA_UTILS_H
+
+#include "FlyCapture2.h"
+
+// FlyCapture2::Error has no public way to construct a failure, so code
+// outside the SDK that needs to report one uses this.
+FlyCapture2::Error FailureError();
+
+// Current Format7 settings of either backend.
+FlyCapture2::Error GetImageSettings( FlyCapture2::CameraBase* pCamera, FlyCapture2::Format7ImageSettings* pSettings );
+
+// Bytes of one raw frame at the current Format7 settings, rows times the
+// packed stride.
+FlyCapture2::Error GetFrameSize( FlyCapture2::CameraBase* pCamera, unsigned int* pBytes );
+
+// Starts capture on all cameras at once with phase aligned exposures, via
+// Camera::StartSyncCapture() or SyntheticCamera::StartSyncCapture(). All
+// cameras must use the same backend. pCallbackFns and pCallbackDataArray
+// are optional, one entry per camera.
+FlyCapture2::Error StartSyncCapture(
+    unsigned int numCameras,
+    FlyCapture2::CameraBase** ppCameras,
+    const FlyCapture2::ImageEventCallback* pCallbackFns = NULL,
+    const void** pCallbackDataArray = NULL );
+
+// Switches trigger mode 0 with the software source on or off.
+FlyCapture2::Error SetSoftwareTrigger( FlyCapture2::CameraBase* pCamera, bool on );
+
+// Polls the software trigger register until the camera can take the next
+// trigger. Fails after timeoutMs.
+FlyCapture2::Error WaitForTriggerReady( FlyCapture2::CameraBase* pCamera, int timeoutMs );
+
+// Triggers all cameras: one broadcast trigger from the first camera, or
+// one trigger per camera where broadcasting is not supported.
+FlyCapture2::Error FireSoftwareTrigger( unsigned int numCameras, FlyCapture2::CameraBase** ppCameras );
+
+// Time numBytes take over a USB3 link (about 380 MB/s sustained).
+unsigned int TransferTimeUs( unsigned int numBytes );
+
+// How long after a trigger the frame can be expected: the shutter time
+// plus the transfer of one frame at the current Format7 settings.
+unsigned int ExposureAndTransferUs( FlyCapture2::CameraBase* pCamera );
+
+// Host monotonic clock in microseconds, used to stamp frame arrival.
+unsigned long long HostTimeUs();
+
+// Turns on the embedded timestamp and frame counter, so every frame carries
+// them in its first pixels.
+FlyCapture2::Error EnableEmbeddedInfo( FlyCapture2::CameraBase* pCamera );
+
+// Reads the embedded words at the start of a frame into pMetadata. Only the
+// items enabled in info are present, one big-endian word each, in the order
+// of EmbeddedImageInfo.
+void ParseEmbeddedInfo( const unsigned char* pData, const FlyCapture2::EmbeddedImageInfo& info, FlyCapture2::ImageMetadata* pMetadata );
+
+// 1394 cycle time (seconds modulo 128, 8 kHz cycles, 3072 ticks per cycle)
+// in microseconds. Wraps every 128 seconds.
+unsigned long long CycleTimeUs( unsigned int seconds, unsigned int cycleCount, unsigned int cycleOffset );
+unsigned long long EmbeddedTimeStampUs( unsigned int embeddedTimeStamp );
+
+#endif // CAMERA_UTILS_H
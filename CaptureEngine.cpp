@@ -0,0 +1,348 @@
+/*****************************************************************
+  CAPTURE ENGINE
+
+  See CaptureEngine.h.
+
+*****************************************************************/
+
+#include "CaptureEngine.h"
+#include "CameraUtils.h"
+#include "MetadataLog.h"
+#include <chrono>
+#include <cstdio>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // longest pause between grabs of a camera that keeps failing
+    const unsigned int sk_maxBackoffMs = 100;
+}
+
+CaptureEngine::CaptureEngine()
+    : m_numCameras( 0 ),
+      m_running( false ),
+      m_pLog( NULL ),
+      m_pairingToleranceUs( 0 ),
+      m_sleeping( false )
+{
+}
+
+CaptureEngine::~CaptureEngine()
+{
+    Stop();
+}
+
+void CaptureEngine::AddStreams( CameraBase** ppCameras, FrameArena* pArenas, unsigned int numCameras, size_t ringCapacity )
+{
+    Stop();
+
+    m_numCameras = numCameras;
+    m_running = true;
+    for ( unsigned int i = 0; i < numCameras; i++ )
+    {
+        Stream* pStream = new Stream;
+        pStream->pEngine = this;
+        pStream->camera = i;
+        pStream->pCamera = ppCameras[i];
+        pStream->pArena = &pArenas[i];
+        pStream->pRing = new SpscRing<FrameHandle>( ringCapacity );
+        pStream->pStats = new CaptureStreamStats;
+        CPU_ZERO( &pStream->cpus );
+        if ( i < m_placements.size() )
+        {
+            pStream->cpus = m_placements[i].cpus;
+        }
+        pStream->pinned = false;
+        m_streams.push_back( pStream );
+    }
+
+    unsigned int toleranceUs = m_pairingToleranceUs;
+    if ( toleranceUs == 0 )
+    {
+        Property frameRate( FRAME_RATE );
+        float fps = 30.0f;
+        if ( numCameras > 0 && ppCameras[0]->GetProperty( &frameRate ) == PGRERROR_OK && frameRate.absValue > 0.0f )
+        {
+            fps = frameRate.absValue;
+        }
+        toleranceUs = (unsigned int)( 500000.0f / fps );
+    }
+    m_pairing.Reset( numCameras, toleranceUs );
+}
+
+void CaptureEngine::Start( CameraBase** ppCameras, FrameArena* pArenas, unsigned int numCameras, size_t ringCapacity )
+{
+    AddStreams( ppCameras, pArenas, numCameras, ringCapacity );
+    for ( unsigned int i = 0; i < numCameras; i++ )
+    {
+        m_streams[i]->thread = std::thread( &CaptureEngine::GrabLoop, this, i );
+    }
+}
+
+Error CaptureEngine::StartCallbacks( CameraBase** ppCameras, FrameArena* pArenas, unsigned int numCameras, bool syncStart, size_t ringCapacity )
+{
+    AddStreams( ppCameras, pArenas, numCameras, ringCapacity );
+    if ( syncStart )
+    {
+        std::vector<ImageEventCallback> callbackFns( numCameras, &CaptureEngine::OnImage );
+        std::vector<const void*> callbackData( m_streams.begin(), m_streams.end() );
+        Error error = StartSyncCapture( numCameras, ppCameras, &callbackFns[0], &callbackData[0] );
+        if ( error != PGRERROR_OK )
+        {
+            Stop();
+        }
+        return error;
+    }
+    for ( unsigned int i = 0; i < numCameras; i++ )
+    {
+        Error error = ppCameras[i]->StartCapture( &CaptureEngine::OnImage, m_streams[i] );
+        if ( error != PGRERROR_OK )
+        {
+            // Stop() also stops the cameras that did start
+            Stop();
+            return error;
+        }
+    }
+    return Error();
+}
+
+void CaptureEngine::Stop()
+{
+    if ( m_streams.empty() )
+    {
+        return;
+    }
+
+    // stopping the cameras makes a RetrieveBuffer that is still waiting return
+    m_running = false;
+    for ( unsigned int i = 0; i < m_streams.size(); i++ )
+    {
+        m_streams[i]->pCamera->StopCapture();
+    }
+
+    for ( unsigned int i = 0; i < m_streams.size(); i++ )
+    {
+        if ( m_streams[i]->thread.joinable() )
+        {
+            m_streams[i]->thread.join();
+        }
+    }
+
+    m_pairing.Flush();
+    ReleasePaired();
+    std::vector<FrameHandle> group( m_streams.size() );
+    while ( m_pairing.PopGroup( &group[0] ) )
+    {
+        for ( unsigned int i = 0; i < m_streams.size(); i++ )
+        {
+            m_streams[i]->pArena->Release( &group[i] );
+        }
+    }
+
+    for ( unsigned int i = 0; i < m_streams.size(); i++ )
+    {
+        Stream* pStream = m_streams[i];
+
+        FrameHandle handle;
+        while ( pStream->pRing->TryPop( &handle ) )
+        {
+            pStream->pArena->Release( &handle );
+        }
+        delete pStream->pRing;
+        delete pStream->pStats;
+        delete pStream;
+    }
+    m_streams.clear();
+    m_numCameras = 0;
+}
+
+void CaptureEngine::GrabLoop( unsigned int camera )
+{
+    Stream* pStream = m_streams[camera];
+    Image rawImage;
+    PinThread( pStream->cpus );
+
+    unsigned int failures = 0;
+    while ( m_running )
+    {
+        Error error = pStream->pCamera->RetrieveBuffer( &rawImage );
+        if ( error != PGRERROR_OK )
+        {
+            if ( m_running )
+            {
+                pStream->pStats->errors++;
+                if ( m_pLog != NULL )
+                {
+                    m_pLog->Append( MakeGrabFailedRow( camera, error.GetType() ) );
+                }
+            }
+            // an error that returns at once again and again (an unplugged
+            // camera) would spin this core and flood the log; back off from
+            // 1 ms up to sk_maxBackoffMs. A timeout has already waited.
+            failures++;
+            if ( failures > 1 && error != PGRERROR_TIMEOUT && m_running )
+            {
+                unsigned int shift = failures - 2 < 7 ? failures - 2 : 7;
+                unsigned int backoffMs = 1u << shift;
+                std::this_thread::sleep_for( std::chrono::milliseconds(
+                    backoffMs < sk_maxBackoffMs ? backoffMs : sk_maxBackoffMs ) );
+            }
+            continue;
+        }
+        failures = 0;
+
+        Enqueue( pStream, rawImage );
+    }
+}
+
+void CaptureEngine::OnImage( Image* pImage, const void* pCallbackData )
+{
+    // runs on the SDK's delivery thread, which must not wait on us: the
+    // frame is claimed (taking a reference instead of copying) and queued,
+    // or dropped if the consumer is that far behind
+    Stream* pStream = const_cast<Stream*>( static_cast<const Stream*>( pCallbackData ) );
+    if ( !pStream->pinned )
+    {
+        PinThread( pStream->cpus );
+        pStream->pinned = true;
+    }
+    if ( pStream->pEngine->m_running )
+    {
+        pStream->pEngine->Enqueue( pStream, *pImage );
+    }
+}
+
+void CaptureEngine::Enqueue( Stream* pStream, const Image& image )
+{
+    // Claim() stamps the host arrival time
+    FrameHandle handle;
+    if ( !pStream->pArena->Claim( image, pStream->camera, &handle ) )
+    {
+        pStream->pStats->errors++;
+        if ( m_pLog != NULL )
+        {
+            m_pLog->Append( MakeGrabFailedRow( pStream->camera, PGRERROR_FAILED ) );
+        }
+        return;
+    }
+    pStream->pStats->grabbed++;
+    if ( m_pLog != NULL )
+    {
+        m_pLog->Append( MakeMetadataRow( META_FRAME_ARRIVED, handle, -1 ) );
+    }
+
+    if ( !pStream->pRing->TryPush( handle ) )
+    {
+        if ( m_pLog != NULL )
+        {
+            m_pLog->Append( MakeMetadataRow( META_FRAME_DROPPED, handle, -1, META_DROP_RING_FULL ) );
+        }
+        pStream->pArena->Release( &handle );
+        pStream->pStats->ringFull++;
+        return;
+    }
+
+    // orders the push before the flag load; NextGroup fences between
+    // setting the flag and checking the rings, so one of the two sides
+    // sees the other
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( m_sleeping.load() )
+    {
+        std::lock_guard<std::mutex> lock( m_wakeMutex );
+        m_wake.notify_one();
+    }
+}
+
+bool CaptureEngine::NextGroup( FrameHandle* pFrames, unsigned long long notBeforeUs, int timeoutMs )
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( timeoutMs );
+
+    for (;;)
+    {
+        for ( unsigned int i = 0; i < m_numCameras; i++ )
+        {
+            FrameHandle handle;
+            while ( m_streams[i]->pRing->TryPop( &handle ) )
+            {
+                m_pairing.Push( handle );
+            }
+        }
+        ReleasePaired();
+
+        while ( m_pairing.PopGroup( pFrames ) )
+        {
+            bool stale = false;
+            for ( unsigned int i = 0; i < m_numCameras; i++ )
+            {
+                stale = stale || pFrames[i].hostTimeUs < notBeforeUs;
+            }
+            if ( !stale )
+            {
+                return true;
+            }
+            for ( unsigned int i = 0; i < m_numCameras; i++ )
+            {
+                if ( m_pLog != NULL )
+                {
+                    m_pLog->Append( MakeMetadataRow( META_FRAME_DROPPED, pFrames[i], -1, META_DROP_STALE ) );
+                }
+                m_streams[i]->pArena->Release( &pFrames[i] );
+                m_streams[i]->pStats->stale++;
+            }
+        }
+
+        // sleep until a grab thread pushes something; the flag is set before
+        // the rings are checked again so a push cannot slip in unnoticed
+        std::unique_lock<std::mutex> lock( m_wakeMutex );
+        m_sleeping = true;
+        // the ring tails are released, not sequentially consistent; without
+        // the fence the checks below could see them before the flag is set
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        bool empty = true;
+        for ( unsigned int i = 0; i < m_numCameras && empty; i++ )
+        {
+            empty = m_streams[i]->pRing->Size() == 0;
+        }
+        bool timedOut = false;
+        if ( empty )
+        {
+            timedOut = m_wake.wait_until( lock, deadline ) == std::cv_status::timeout;
+        }
+        m_sleeping = false;
+        lock.unlock();
+
+        if ( timedOut || std::chrono::steady_clock::now() >= deadline )
+        {
+            return false;
+        }
+    }
+}
+
+void CaptureEngine::ReleasePaired()
+{
+    // frames the pairing stage gave up on go straight back to their arena
+    FrameHandle handle;
+    while ( m_pairing.PopOrphan( &handle ) )
+    {
+        if ( handle.camera < m_streams.size() )
+        {
+            if ( m_pLog != NULL )
+            {
+                m_pLog->Append( MakeMetadataRow( META_FRAME_DROPPED, handle, -1, META_DROP_UNPAIRED ) );
+            }
+            m_streams[handle.camera]->pArena->Release( &handle );
+        }
+    }
+}
+
+void CaptureEngine::PrintStats() const
+{
+    for ( unsigned int i = 0; i < m_numCameras; i++ )
+    {
+        const CaptureStreamStats& stats = *m_streams[i]->pStats;
+        printf( "camera %u: %llu grabbed, %llu grab errors, %llu stale, %llu ring full\n", i,
+                stats.grabbed.load(), stats.errors.load(), stats.stale.load(), stats.ringFull.load() );
+    }
+    m_pairing.PrintReport();
+}
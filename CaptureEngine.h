@@ -0,0 +1,137 @@
+/*****************************************************************
+  CAPTURE ENGINE
+
+  One grab thread per camera. Each thread calls RetrieveBuffer in a loop,
+  claims the frame in that camera's FrameArena and pushes the handle into
+  its own single-producer/single-consumer ring, so a slow or late camera
+  never holds up the others. The consumer side groups one frame from every
+  camera for the scan loop, matched by capture time in a PairingEngine.
+
+  Alternatively the engine can be fed by the SDK's image event callback
+  (StartCallbacks). The callback does the same claim and push from the
+  driver's delivery thread, so no polling thread is needed and the callback
+  returns right away.
+
+*****************************************************************/
+
+#ifndef CAPTURE_ENGINE_H
+#define CAPTURE_ENGINE_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include "SpscRing.h"
+#include "PairingEngine.h"
+#include "NumaPlacement.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+class MetadataLog;
+
+// Per camera counters, readable while the engine runs.
+struct CaptureStreamStats
+{
+    std::atomic<unsigned long long> grabbed;      // frames claimed from the driver
+    std::atomic<unsigned long long> errors;       // RetrieveBuffer failures
+    std::atomic<unsigned long long> ringFull;     // frames dropped because the consumer fell behind
+    std::atomic<unsigned long long> stale;        // frames skipped by the consumer as too old
+
+    CaptureStreamStats() : grabbed( 0 ), errors( 0 ), ringFull( 0 ), stale( 0 ) {}
+};
+
+class CaptureEngine
+{
+public:
+    static const unsigned int sk_defaultRingCapacity = 64;
+
+    CaptureEngine();
+    ~CaptureEngine();
+
+    // Frames of one camera the engine may hold at once: a full ring, those
+    // waiting for a partner and the one just pushed. Size arenas beyond it.
+    static unsigned int FramesHeld( size_t ringCapacity = sk_defaultRingCapacity )
+    {
+        return (unsigned int)ringCapacity + PairingEngine::sk_maxPending + 1;
+    }
+
+    // The cameras must be streaming into their arenas (FrameArena::Register
+    // before StartCapture). Starts one grab thread per camera.
+    void Start( FlyCapture2::CameraBase** ppCameras, FrameArena* pArenas, unsigned int numCameras, size_t ringCapacity = sk_defaultRingCapacity );
+
+    // Starts capture on every camera with an ImageEventCallback that queues
+    // the frames. The arenas must be registered but capture not started.
+    // syncStart starts the cameras through StartSyncCapture().
+    FlyCapture2::Error StartCallbacks( FlyCapture2::CameraBase** ppCameras, FrameArena* pArenas, unsigned int numCameras, bool syncStart = false, size_t ringCapacity = sk_defaultRingCapacity );
+
+    // Stops and joins the grab threads and releases whatever is still queued.
+    void Stop();
+
+    // Largest capture time difference between the frames of one group. 0,
+    // the default, uses half the frame period of the first camera. Takes
+    // effect at the next Start.
+    void SetPairingTolerance( unsigned int toleranceUs ) { m_pairingToleranceUs = toleranceUs; }
+
+    // Logs every frame claimed, dropped or failed. Set before Start; the
+    // log must stay open until Stop.
+    void SetMetadataLog( MetadataLog* pLog ) { m_pLog = pLog; }
+
+    // Runs camera i's grab thread (or, with callbacks, the SDK thread
+    // delivering its frames) on pPlacements[i].cpus. Set before Start.
+    void SetPlacement( const CameraPlacement* pPlacements, unsigned int numCameras )
+    {
+        m_placements.assign( pPlacements, pPlacements + numCameras );
+    }
+
+    // Consumer side: waits for a matched group, one frame per camera, whose
+    // frames all arrived at or after notBeforeUs (HostTimeUs clock) and
+    // stores it in pFrames[camera]. Older groups and frames without a
+    // partner are released. Returns false on timeout.
+    bool NextGroup( FrameHandle* pFrames, unsigned long long notBeforeUs, int timeoutMs );
+
+    unsigned int NumCameras() const { return m_numCameras; }
+    const CaptureStreamStats& Stats( unsigned int camera ) const { return *m_streams[camera]->pStats; }
+    const PairingStats& Pairing() const { return m_pairing.Stats(); }
+    void PrintStats() const;
+
+private:
+    CaptureEngine( const CaptureEngine& );
+    CaptureEngine& operator=( const CaptureEngine& );
+
+    struct Stream
+    {
+        CaptureEngine* pEngine;
+        unsigned int camera;
+        FlyCapture2::CameraBase* pCamera;
+        FrameArena* pArena;
+        SpscRing<FrameHandle>* pRing;
+        CaptureStreamStats* pStats;
+        cpu_set_t cpus;                 // empty: run anywhere
+        bool pinned;                    // callback thread already moved
+        std::thread thread;
+    };
+
+    void AddStreams( FlyCapture2::CameraBase** ppCameras, FrameArena* pArenas, unsigned int numCameras, size_t ringCapacity );
+    void GrabLoop( unsigned int camera );
+    void Enqueue( Stream* pStream, const FlyCapture2::Image& image );
+    static void OnImage( FlyCapture2::Image* pImage, const void* pCallbackData );
+    void ReleasePaired();
+
+    std::vector<Stream*> m_streams;
+    unsigned int m_numCameras;
+    std::atomic<bool> m_running;
+    MetadataLog* m_pLog;
+    std::vector<CameraPlacement> m_placements;
+
+    // only touched by the consumer
+    unsigned int m_pairingToleranceUs;
+    PairingEngine m_pairing;
+
+    // lets the consumer sleep instead of spinning on empty rings
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::atomic<bool> m_sleeping;
+};
+
+#endif // CAPTURE_ENGINE_H
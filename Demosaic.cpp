@@ -0,0 +1,280 @@
+/*****************************************************************
+  DEMOSAIC
+
+  See Demosaic.h.
+
+*****************************************************************/
+
+#include "Demosaic.h"
+#include "DemosaicKernels.h"
+#include "CameraUtils.h"
+#include <vector>
+#include <thread>
+#include <functional>
+#include <cstring>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define DEMOSAIC_X86 1
+#endif
+
+using namespace FlyCapture2;
+
+namespace
+{
+    enum { CH_R = 0, CH_G = 1, CH_B = 2, CH_NONE = 3 };
+
+    // the colour at ( row & 1, col & 1 ) for each tile layout
+    void BayerChannels( BayerTileFormat bayerFormat, int channels[2][2] )
+    {
+        int rggb[2][2] = { { CH_R, CH_G }, { CH_G, CH_B } };
+        int grbg[2][2] = { { CH_G, CH_R }, { CH_B, CH_G } };
+        int gbrg[2][2] = { { CH_G, CH_B }, { CH_R, CH_G } };
+        int bggr[2][2] = { { CH_B, CH_G }, { CH_G, CH_R } };
+        int mono[2][2] = { { CH_NONE, CH_NONE }, { CH_NONE, CH_NONE } };
+        const int (*pLayout)[2] = mono;
+        switch ( bayerFormat )
+        {
+        case RGGB: pLayout = rggb; break;
+        case GRBG: pLayout = grbg; break;
+        case GBRG: pLayout = gbrg; break;
+        case BGGR: pLayout = bggr; break;
+        default: break;
+        }
+        memcpy( channels, pLayout, sizeof( rggb ) );
+    }
+
+    void PlanRow( const int channels[2][2], unsigned int row, DemosaicMethod method, DemosaicRowPlan* pPlan )
+    {
+        bool mono = channels[0][0] == CH_NONE;
+        pPlan->nearest = !mono && method == DEMOSAIC_NEAREST;
+        pPlan->edgeAware = !mono && method == DEMOSAIC_EDGE_AWARE;
+        for ( int x = 0; x < 3; x++ )
+        {
+            for ( unsigned int parity = 0; parity < 2; parity++ )
+            {
+                int site = channels[row & 1][parity];
+                if ( site == CH_NONE )
+                {
+                    // monochrome: grey in every channel
+                    pPlan->source[x][parity] = SRC_CENTER;
+                }
+                else if ( pPlan->nearest )
+                {
+                    // first sample of colour x in the tile, in raster order
+                    unsigned int tileRow = 0, tileCol = 0;
+                    for ( unsigned int i = 4; i-- > 0; )
+                    {
+                        if ( channels[i / 2][i % 2] == x )
+                        {
+                            tileRow = i / 2;
+                            tileCol = i % 2;
+                        }
+                    }
+                    bool fromThisRow = tileRow == ( row & 1 );
+                    bool fromAbove = !fromThisRow && ( row & 1 ) == 1;
+                    int base = fromThisRow ? SRC_ROW_EVEN : fromAbove ? SRC_UP_EVEN : SRC_DOWN_EVEN;
+                    pPlan->source[x][parity] = (unsigned char)( base + tileCol );
+                }
+                else if ( site == x )
+                {
+                    pPlan->source[x][parity] = SRC_CENTER;
+                }
+                else
+                {
+                    bool horizontal = channels[row & 1][parity ^ 1] == x;
+                    bool vertical = channels[( row + 1 ) & 1][parity] == x;
+                    pPlan->source[x][parity] = (unsigned char)( horizontal && vertical ? SRC_CROSS4 :
+                                                                horizontal ? SRC_H2 :
+                                                                vertical ? SRC_V2 : SRC_DIAG4 );
+                }
+            }
+        }
+    }
+
+    struct Job
+    {
+        const unsigned char* pData;
+        unsigned int stride;
+        unsigned int rows;
+        unsigned int cols;
+        int channels[2][2];
+        DemosaicMethod method;
+        DemosaicIsa isa;
+        unsigned char* pOut;
+        unsigned int outStride;
+    };
+
+    void DemosaicBand( const Job& job, unsigned int firstRow, unsigned int endRow )
+    {
+        std::vector<unsigned char> planes( (size_t)job.cols * 3 );
+        unsigned char* const pPlanes[3] = { &planes[0], &planes[job.cols], &planes[2 * job.cols] };
+
+        for ( unsigned int row = firstRow; row < endRow; row++ )
+        {
+            // mirror at the borders, which keeps the Bayer phase
+            unsigned int up = row > 0 ? row - 1 : 1;
+            unsigned int down = row + 1 < job.rows ? row + 1 : job.rows - 2;
+            const unsigned char* pUp = job.pData + (size_t)up * job.stride;
+            const unsigned char* pRow = job.pData + (size_t)row * job.stride;
+            const unsigned char* pDown = job.pData + (size_t)down * job.stride;
+
+            DemosaicRowPlan plan;
+            PlanRow( job.channels, row, job.method, &plan );
+
+            unsigned int done = 2;
+#ifdef DEMOSAIC_X86
+            if ( job.isa == DEMOSAIC_AVX2 )
+            {
+                done = DemosaicRowAvx2( pUp, pRow, pDown, job.cols, plan, pPlanes );
+            }
+            else if ( job.isa == DEMOSAIC_SSE2 )
+            {
+                done = DemosaicRowSse2( pUp, pRow, pDown, job.cols, plan, pPlanes );
+            }
+#endif
+            DemosaicRowScalar( pUp, pRow, pDown, job.cols, plan, pPlanes, 0, 2 );
+            DemosaicRowScalar( pUp, pRow, pDown, job.cols, plan, pPlanes, done, job.cols );
+
+            unsigned char* pOut = job.pOut + (size_t)row * job.outStride;
+            for ( unsigned int col = 0; col < job.cols; col++ )
+            {
+                pOut[3 * col] = pPlanes[CH_R][col];
+                pOut[3 * col + 1] = pPlanes[CH_G][col];
+                pOut[3 * col + 2] = pPlanes[CH_B][col];
+            }
+        }
+    }
+}
+
+DemosaicIsa BestDemosaicIsa()
+{
+#ifdef DEMOSAIC_X86
+    static const DemosaicIsa s_best = __builtin_cpu_supports( "avx2" ) ? DEMOSAIC_AVX2 : DEMOSAIC_SSE2;
+    return s_best;
+#else
+    return DEMOSAIC_SCALAR;
+#endif
+}
+
+const char* DemosaicIsaName( DemosaicIsa isa )
+{
+    switch ( isa )
+    {
+    case DEMOSAIC_AVX2: return "avx2";
+    case DEMOSAIC_SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+const char* DemosaicMethodName( DemosaicMethod method )
+{
+    switch ( method )
+    {
+    case DEMOSAIC_NEAREST: return "nearest";
+    case DEMOSAIC_EDGE_AWARE: return "edge";
+    default: return "bilinear";
+    }
+}
+
+bool ParseDemosaicMethod( const char* pName, DemosaicMethod* pMethod )
+{
+    if ( !strcmp( pName, "nearest" ) )
+    {
+        *pMethod = DEMOSAIC_NEAREST;
+    }
+    else if ( !strcmp( pName, "bilinear" ) )
+    {
+        *pMethod = DEMOSAIC_BILINEAR;
+    }
+    else if ( !strcmp( pName, "edge" ) )
+    {
+        *pMethod = DEMOSAIC_EDGE_AWARE;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+Error Demosaic( const Image& raw, Image* pRGB, DemosaicMethod method, unsigned int numThreads, DemosaicIsa isa )
+{
+    unsigned int rows = raw.GetRows();
+    unsigned int cols = raw.GetCols();
+    PixelFormat format = raw.GetPixelFormat();
+    if ( raw.GetData() == NULL || rows < 2 || cols < 2 ||
+         ( format != PIXEL_FORMAT_RAW8 && format != PIXEL_FORMAT_RAW12 && format != PIXEL_FORMAT_MONO8 ) )
+    {
+        return FailureError();
+    }
+
+    Job job;
+    job.pData = raw.GetData();
+    job.stride = raw.GetStride();
+    job.rows = rows;
+    job.cols = cols;
+    BayerChannels( format == PIXEL_FORMAT_MONO8 ? NONE : raw.GetBayerTileFormat(), job.channels );
+    job.method = method;
+    job.isa = isa < BestDemosaicIsa() ? isa : BestDemosaicIsa();
+
+    // RAW12 packs two pixels into three bytes, the first and third hold
+    // their upper 8 bits
+    std::vector<unsigned char> unpacked;
+    if ( format == PIXEL_FORMAT_RAW12 )
+    {
+        unpacked.resize( (size_t)rows * cols );
+        for ( unsigned int row = 0; row < rows; row++ )
+        {
+            const unsigned char* pSrc = job.pData + (size_t)row * job.stride;
+            unsigned char* pDst = &unpacked[(size_t)row * cols];
+            for ( unsigned int col = 0; col < cols; col++ )
+            {
+                pDst[col] = pSrc[( col / 2 ) * 3 + ( col & 1 ) * 2];
+            }
+        }
+        job.pData = &unpacked[0];
+        job.stride = cols;
+    }
+
+    if ( pRGB->GetRows() != rows || pRGB->GetCols() != cols || pRGB->GetPixelFormat() != PIXEL_FORMAT_RGB || pRGB->GetData() == NULL )
+    {
+        *pRGB = Image( rows, cols, PIXEL_FORMAT_RGB );
+    }
+    job.pOut = pRGB->GetData();
+    job.outStride = pRGB->GetStride();
+    if ( job.pOut == NULL )
+    {
+        return FailureError();
+    }
+
+    if ( numThreads > rows )
+    {
+        numThreads = rows;
+    }
+    if ( numThreads <= 1 )
+    {
+        DemosaicBand( job, 0, rows );
+        return Error();
+    }
+
+    std::vector<std::thread> threads;
+    for ( unsigned int t = 1; t < numThreads; t++ )
+    {
+        threads.push_back( std::thread( DemosaicBand, std::cref( job ), rows * t / numThreads, rows * ( t + 1 ) / numThreads ) );
+    }
+    DemosaicBand( job, 0, rows / numThreads );
+    for ( unsigned int t = 0; t < threads.size(); t++ )
+    {
+        threads[t].join();
+    }
+    return Error();
+}
+
+Error ConvertToRGB( const Image& raw, Image* pRGB, const DemosaicSettings& settings )
+{
+    if ( !settings.sdk && Demosaic( raw, pRGB, settings.method, settings.numThreads, BestDemosaicIsa() ) == PGRERROR_OK )
+    {
+        return Error();
+    }
+    return raw.Convert( PIXEL_FORMAT_RGB, pRGB );
+}
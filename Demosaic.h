@@ -0,0 +1,72 @@
+/*****************************************************************
+  DEMOSAIC
+
+  Our own Bayer to RGB conversion, as a faster alternative to
+  Image::Convert on the save path. Three quality tiers:
+
+  - nearest:    every 2x2 Bayer tile becomes one colour
+  - bilinear:   missing colours are the mean of their nearest samples
+  - edge aware: like bilinear, but green at red and blue sites is taken
+                along the direction with the smaller gradient
+
+  All four BayerTileFormat layouts are handled, plus MONO8 (grey copied
+  to all three channels). RAW12 is reduced to its upper 8 bits first.
+  Rows are split into bands that run on separate threads. Each row is
+  done by an AVX2 or SSE2 kernel where the CPU has it, and by scalar code
+  otherwise and at the borders. Every kernel computes exactly the same
+  integer results, so output does not depend on the CPU.
+
+*****************************************************************/
+
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include "FlyCapture2.h"
+
+enum DemosaicMethod
+{
+    DEMOSAIC_NEAREST,
+    DEMOSAIC_BILINEAR,
+    DEMOSAIC_EDGE_AWARE
+};
+
+enum DemosaicIsa
+{
+    DEMOSAIC_SCALAR,
+    DEMOSAIC_SSE2,
+    DEMOSAIC_AVX2
+};
+
+// Converts a RAW8, RAW12 or MONO8 image to PIXEL_FORMAT_RGB in pRGB, which
+// is reallocated only if its size does not match. isa is capped at what
+// the CPU supports.
+FlyCapture2::Error Demosaic(
+    const FlyCapture2::Image& raw,
+    FlyCapture2::Image* pRGB,
+    DemosaicMethod method,
+    unsigned int numThreads = 1,
+    DemosaicIsa isa = DEMOSAIC_AVX2 );
+
+DemosaicIsa BestDemosaicIsa();
+const char* DemosaicIsaName( DemosaicIsa isa );
+const char* DemosaicMethodName( DemosaicMethod method );
+
+// "nearest", "bilinear" or "edge".
+bool ParseDemosaicMethod( const char* pName, DemosaicMethod* pMethod );
+
+// Who turns raw frames into RGB: the SDK's Image::Convert, or Demosaic().
+struct DemosaicSettings
+{
+    bool sdk;
+    DemosaicMethod method;
+    unsigned int numThreads;
+
+    DemosaicSettings()
+        : sdk( true ), method( DEMOSAIC_BILINEAR ), numThreads( 1 ) {}
+};
+
+// Converts raw to PIXEL_FORMAT_RGB as settings say. Formats Demosaic()
+// does not handle go to the SDK.
+FlyCapture2::Error ConvertToRGB( const FlyCapture2::Image& raw, FlyCapture2::Image* pRGB, const DemosaicSettings& settings );
+
+#endif // DEMOSAIC_H
@@ -0,0 +1,67 @@
+/*****************************************************************
+  DEMOSAIC AVX2 KERNEL
+
+  The AVX2 instantiation of DemosaicRowSimd. This file alone is built
+  with -mavx2; Demosaic() only calls into it when the CPU reports AVX2.
+
+*****************************************************************/
+
+#include "DemosaicKernels.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+
+namespace
+{
+    struct Avx2
+    {
+        typedef __m256i T;
+        static const unsigned int sk_width = 32;
+
+        static T Load( const unsigned char* p ) { return _mm256_loadu_si256( (const __m256i*)p ); }
+        static void Store( unsigned char* p, T v ) { _mm256_storeu_si256( (__m256i*)p, v ); }
+        static T Avg( T a, T b ) { return _mm256_avg_epu8( a, b ); }
+        static T Avg4( T a, T b, T c, T d )
+        {
+            // unpack and pack both work per 128 bit lane, so the order is kept
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i two = _mm256_set1_epi16( 2 );
+            __m256i lo = _mm256_add_epi16( _mm256_add_epi16( _mm256_unpacklo_epi8( a, zero ), _mm256_unpacklo_epi8( b, zero ) ),
+                                           _mm256_add_epi16( _mm256_unpacklo_epi8( c, zero ), _mm256_unpacklo_epi8( d, zero ) ) );
+            __m256i hi = _mm256_add_epi16( _mm256_add_epi16( _mm256_unpackhi_epi8( a, zero ), _mm256_unpackhi_epi8( b, zero ) ),
+                                           _mm256_add_epi16( _mm256_unpackhi_epi8( c, zero ), _mm256_unpackhi_epi8( d, zero ) ) );
+            lo = _mm256_srli_epi16( _mm256_add_epi16( lo, two ), 2 );
+            hi = _mm256_srli_epi16( _mm256_add_epi16( hi, two ), 2 );
+            return _mm256_packus_epi16( lo, hi );
+        }
+        static T AbsDiff( T a, T b ) { return _mm256_or_si256( _mm256_subs_epu8( a, b ), _mm256_subs_epu8( b, a ) ); }
+        static T Less( T a, T b )
+        {
+            return _mm256_andnot_si256( _mm256_cmpeq_epi8( _mm256_max_epu8( a, b ), a ), _mm256_cmpeq_epi8( a, a ) );
+        }
+        static T Select( T mask, T a, T b ) { return _mm256_blendv_epi8( b, a, mask ); }
+        static T EvenMask() { return _mm256_set1_epi16( 0x00FF ); }
+        static T DupEven( T v )
+        {
+            __m256i even = _mm256_and_si256( v, _mm256_set1_epi16( 0x00FF ) );
+            return _mm256_or_si256( even, _mm256_slli_epi16( even, 8 ) );
+        }
+        static T DupOdd( T v )
+        {
+            __m256i odd = _mm256_srli_epi16( v, 8 );
+            return _mm256_or_si256( odd, _mm256_slli_epi16( odd, 8 ) );
+        }
+    };
+}
+
+unsigned int DemosaicRowAvx2(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3] )
+{
+    return DemosaicRowSimd<Avx2>( pUp, pRow, pDown, cols, plan, pPlanes );
+}
+#endif
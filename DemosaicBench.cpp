@@ -0,0 +1,143 @@
+/*****************************************************************
+  DEMOSAIC BENCHMARK
+
+  See DemosaicBench.h.
+
+*****************************************************************/
+
+#include "DemosaicBench.h"
+#include "Demosaic.h"
+#include "CameraUtils.h"
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // smooth structure plus noise, so every kernel branch gets exercised
+    void FillTestFrame( unsigned char* pData, unsigned int rows, unsigned int cols )
+    {
+        unsigned int state = 12345;
+        for ( unsigned int row = 0; row < rows; row++ )
+        {
+            for ( unsigned int col = 0; col < cols; col++ )
+            {
+                state = state * 1103515245u + 12345u;
+                int value = (int)( ( row * 3 + col * 5 ) % 256 ) / 2 + (int)( ( state >> 16 ) % 128 );
+                if ( ( col / 37 + row / 29 ) % 2 == 0 )
+                {
+                    value = 255 - value;
+                }
+                pData[(size_t)row * cols + col] = (unsigned char)( value > 255 ? 255 : value );
+            }
+        }
+    }
+
+    bool SameImage( Image& a, Image& b )
+    {
+        return a.GetDataSize() == b.GetDataSize() && memcmp( a.GetData(), b.GetData(), a.GetDataSize() ) == 0;
+    }
+
+    double MsPerFrame( unsigned long long startUs, unsigned int iterations )
+    {
+        return ( HostTimeUs() - startUs ) / 1000.0 / iterations;
+    }
+}
+
+bool RunDemosaicBenchmark( unsigned int rows, unsigned int cols, unsigned int iterations, unsigned int numThreads )
+{
+    const BayerTileFormat layouts[] = { RGGB, GRBG, GBRG, BGGR };
+    const char* layoutNames[] = { "RGGB", "GRBG", "GBRG", "BGGR" };
+    const DemosaicMethod methods[] = { DEMOSAIC_NEAREST, DEMOSAIC_BILINEAR, DEMOSAIC_EDGE_AWARE };
+    const DemosaicIsa best = BestDemosaicIsa();
+    if ( iterations == 0 )
+    {
+        iterations = 1;
+    }
+
+    std::vector<unsigned char> pixels( (size_t)rows * cols );
+    FillTestFrame( &pixels[0], rows, cols );
+
+    // exactness: every ISA and the banded path against scalar, on odd
+    // sizes too so the border and tail columns are covered
+    bool exact = true;
+    const unsigned int sizes[2][2] = { { rows, cols }, { 37, 101 } };
+    for ( unsigned int s = 0; s < 2; s++ )
+    {
+        for ( unsigned int l = 0; l < 4; l++ )
+        {
+            Image raw( sizes[s][0], sizes[s][1], sizes[s][1], &pixels[0], sizes[s][0] * sizes[s][1], PIXEL_FORMAT_RAW8, layouts[l] );
+            for ( unsigned int m = 0; m < 3; m++ )
+            {
+                Image reference, other;
+                Demosaic( raw, &reference, methods[m], 1, DEMOSAIC_SCALAR );
+                for ( int isa = DEMOSAIC_SSE2; isa <= best; isa++ )
+                {
+                    Demosaic( raw, &other, methods[m], 1, (DemosaicIsa)isa );
+                    if ( !SameImage( reference, other ) )
+                    {
+                        printf( "MISMATCH: %s %s %ux%u %s differs from scalar\n", layoutNames[l], DemosaicMethodName( methods[m] ),
+                                sizes[s][1], sizes[s][0], DemosaicIsaName( (DemosaicIsa)isa ) );
+                        exact = false;
+                    }
+                }
+                Demosaic( raw, &other, methods[m], 3, best );
+                if ( !SameImage( reference, other ) )
+                {
+                    printf( "MISMATCH: %s %s %ux%u on 3 threads differs from scalar\n", layoutNames[l], DemosaicMethodName( methods[m] ),
+                            sizes[s][1], sizes[s][0] );
+                    exact = false;
+                }
+            }
+        }
+    }
+    printf( "demosaic kernels: %s (scalar up to %s, 4 layouts, 3 methods)\n",
+            exact ? "bit exact" : "NOT bit exact", DemosaicIsaName( best ) );
+
+    Image raw( rows, cols, cols, &pixels[0], rows * cols, PIXEL_FORMAT_RAW8, RGGB );
+    Image rgb;
+    printf( "%ux%u RGGB, ms per frame over %u frames:\n", cols, rows, iterations );
+    for ( unsigned int m = 0; m < 3; m++ )
+    {
+        printf( "  %-9s", DemosaicMethodName( methods[m] ) );
+        for ( int isa = DEMOSAIC_SCALAR; isa <= best; isa++ )
+        {
+            unsigned long long startUs = HostTimeUs();
+            for ( unsigned int i = 0; i < iterations; i++ )
+            {
+                Demosaic( raw, &rgb, methods[m], 1, (DemosaicIsa)isa );
+            }
+            printf( "  %s %6.2f", DemosaicIsaName( (DemosaicIsa)isa ), MsPerFrame( startUs, iterations ) );
+        }
+        unsigned long long startUs = HostTimeUs();
+        for ( unsigned int i = 0; i < iterations; i++ )
+        {
+            Demosaic( raw, &rgb, methods[m], numThreads, best );
+        }
+        printf( "  %s x%u %6.2f\n", DemosaicIsaName( best ), numThreads, MsPerFrame( startUs, iterations ) );
+    }
+
+    const ColorProcessingAlgorithm algorithms[] = { NEAREST_NEIGHBOR, EDGE_SENSING, HQ_LINEAR, RIGOROUS, IPP, DIRECTIONAL_FILTER };
+    const char* algorithmNames[] = { "NEAREST_NEIGHBOR", "EDGE_SENSING", "HQ_LINEAR", "RIGOROUS", "IPP", "DIRECTIONAL_FILTER" };
+    for ( unsigned int a = 0; a < sizeof( algorithms ) / sizeof( algorithms[0] ); a++ )
+    {
+        raw.SetColorProcessing( algorithms[a] );
+        unsigned long long startUs = HostTimeUs();
+        Error error;
+        for ( unsigned int i = 0; i < iterations && error == PGRERROR_OK; i++ )
+        {
+            error = raw.Convert( PIXEL_FORMAT_RGB, &rgb );
+        }
+        if ( error != PGRERROR_OK )
+        {
+            printf( "  sdk %-18s not available\n", algorithmNames[a] );
+        }
+        else
+        {
+            printf( "  sdk %-18s %6.2f\n", algorithmNames[a], MsPerFrame( startUs, iterations ) );
+        }
+    }
+    return exact;
+}
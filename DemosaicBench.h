@@ -0,0 +1,19 @@
+/*****************************************************************
+  DEMOSAIC BENCHMARK
+
+  Checks that the SIMD demosaic kernels and the banded multi-threaded
+  path produce exactly the bytes of the scalar kernel, for every Bayer
+  layout and quality tier, and times them against Image::Convert with
+  each ColorProcessingAlgorithm.
+
+*****************************************************************/
+
+#ifndef DEMOSAIC_BENCH_H
+#define DEMOSAIC_BENCH_H
+
+// Runs on a rows x cols RAW8 test frame, timing each variant over
+// iterations conversions. Returns false if any kernel disagrees with the
+// scalar one.
+bool RunDemosaicBenchmark( unsigned int rows, unsigned int cols, unsigned int iterations, unsigned int numThreads );
+
+#endif // DEMOSAIC_BENCH_H
@@ -0,0 +1,133 @@
+/*****************************************************************
+  DEMOSAIC KERNELS
+
+  The scalar row kernel and the SSE2 instantiation of DemosaicRowSimd.
+  Neither needs the SDK, so tests can build them on their own together
+  with DemosaicAvx2.cpp.
+
+*****************************************************************/
+
+#include "DemosaicKernels.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <emmintrin.h>
+
+namespace
+{
+    struct Sse2
+    {
+        typedef __m128i T;
+        static const unsigned int sk_width = 16;
+
+        static T Load( const unsigned char* p ) { return _mm_loadu_si128( (const __m128i*)p ); }
+        static void Store( unsigned char* p, T v ) { _mm_storeu_si128( (__m128i*)p, v ); }
+        static T Avg( T a, T b ) { return _mm_avg_epu8( a, b ); }
+        static T Avg4( T a, T b, T c, T d )
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i two = _mm_set1_epi16( 2 );
+            __m128i lo = _mm_add_epi16( _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) ),
+                                        _mm_add_epi16( _mm_unpacklo_epi8( c, zero ), _mm_unpacklo_epi8( d, zero ) ) );
+            __m128i hi = _mm_add_epi16( _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) ),
+                                        _mm_add_epi16( _mm_unpackhi_epi8( c, zero ), _mm_unpackhi_epi8( d, zero ) ) );
+            lo = _mm_srli_epi16( _mm_add_epi16( lo, two ), 2 );
+            hi = _mm_srli_epi16( _mm_add_epi16( hi, two ), 2 );
+            return _mm_packus_epi16( lo, hi );
+        }
+        static T AbsDiff( T a, T b ) { return _mm_or_si128( _mm_subs_epu8( a, b ), _mm_subs_epu8( b, a ) ); }
+        static T Less( T a, T b )
+        {
+            // a < b exactly where max( a, b ) != a
+            return _mm_andnot_si128( _mm_cmpeq_epi8( _mm_max_epu8( a, b ), a ), _mm_cmpeq_epi8( a, a ) );
+        }
+        static T Select( T mask, T a, T b ) { return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) ); }
+        static T EvenMask() { return _mm_set1_epi16( 0x00FF ); }
+        static T DupEven( T v )
+        {
+            __m128i even = _mm_and_si128( v, _mm_set1_epi16( 0x00FF ) );
+            return _mm_or_si128( even, _mm_slli_epi16( even, 8 ) );
+        }
+        static T DupOdd( T v )
+        {
+            __m128i odd = _mm_srli_epi16( v, 8 );
+            return _mm_or_si128( odd, _mm_slli_epi16( odd, 8 ) );
+        }
+    };
+}
+#endif
+
+void DemosaicRowScalar(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3],
+    unsigned int from,
+    unsigned int to )
+{
+    for ( unsigned int c = from; c < to; c++ )
+    {
+        unsigned int w = c > 0 ? c - 1 : 1;
+        unsigned int e = c + 1 < cols ? c + 1 : cols - 2;
+        unsigned int even = c & ~1u;
+        unsigned int odd = even + 1 < cols ? even + 1 : even - 1;
+
+        for ( unsigned int channel = 0; channel < 3; channel++ )
+        {
+            unsigned int value = 0;
+            switch ( plan.source[channel][c & 1] )
+            {
+            case SRC_CENTER:
+                value = pRow[c];
+                break;
+            case SRC_H2:
+                value = ( pRow[w] + pRow[e] + 1 ) >> 1;
+                break;
+            case SRC_V2:
+                value = ( pUp[c] + pDown[c] + 1 ) >> 1;
+                break;
+            case SRC_CROSS4:
+                {
+                    unsigned int h2 = ( pRow[w] + pRow[e] + 1 ) >> 1;
+                    unsigned int v2 = ( pUp[c] + pDown[c] + 1 ) >> 1;
+                    int dh = pRow[w] > pRow[e] ? pRow[w] - pRow[e] : pRow[e] - pRow[w];
+                    int dv = pUp[c] > pDown[c] ? pUp[c] - pDown[c] : pDown[c] - pUp[c];
+                    value = ( pRow[w] + pRow[e] + pUp[c] + pDown[c] + 2 ) >> 2;
+                    if ( plan.edgeAware && dh < dv )
+                    {
+                        value = h2;
+                    }
+                    else if ( plan.edgeAware && dv < dh )
+                    {
+                        value = v2;
+                    }
+                }
+                break;
+            case SRC_DIAG4:
+                value = ( pUp[w] + pUp[e] + pDown[w] + pDown[e] + 2 ) >> 2;
+                break;
+            case SRC_UP_EVEN: value = pUp[even]; break;
+            case SRC_UP_ODD: value = pUp[odd]; break;
+            case SRC_ROW_EVEN: value = pRow[even]; break;
+            case SRC_ROW_ODD: value = pRow[odd]; break;
+            case SRC_DOWN_EVEN: value = pDown[even]; break;
+            case SRC_DOWN_ODD: value = pDown[odd]; break;
+            }
+            pPlanes[channel][c] = (unsigned char)value;
+        }
+    }
+}
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+unsigned int DemosaicRowSse2(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3] )
+{
+    return DemosaicRowSimd<Sse2>( pUp, pRow, pDown, cols, plan, pPlanes );
+}
+#endif
@@ -0,0 +1,141 @@
+/*****************************************************************
+  DEMOSAIC KERNELS
+
+  Internal to Demosaic.cpp, which calls the kernels in DemosaicKernels.cpp
+  and DemosaicAvx2.cpp. One output row is
+  described by a DemosaicRowPlan: for each of R, G and B, where the value
+  comes from at the even and at the odd columns. The kernels fill three
+  planar rows from it; the caller interleaves them into RGB.
+
+  The SIMD kernel is a template over a small vector traits class, so the
+  SSE2 and AVX2 versions are the same code. Both start at column 2 and
+  stop before the last vector that would read past the row; the scalar
+  kernel does the columns they leave.
+
+*****************************************************************/
+
+#ifndef DEMOSAIC_KERNELS_H
+#define DEMOSAIC_KERNELS_H
+
+enum DemosaicSource
+{
+    // bilinear and edge aware
+    SRC_CENTER,
+    SRC_H2,             // mean of left and right
+    SRC_V2,             // mean of up and down
+    SRC_CROSS4,         // mean of left, right, up and down
+    SRC_DIAG4,          // mean of the four diagonal neighbours
+
+    // nearest: one sample of the 2x2 tile the pixel is in, taken from the
+    // row above, this row or the row below, at the tile's even or odd column
+    SRC_UP_EVEN,
+    SRC_UP_ODD,
+    SRC_ROW_EVEN,
+    SRC_ROW_ODD,
+    SRC_DOWN_EVEN,
+    SRC_DOWN_ODD,
+
+    SRC_COUNT
+};
+
+struct DemosaicRowPlan
+{
+    unsigned char source[3][2];     // [R, G, B][column parity]
+    bool edgeAware;                 // SRC_CROSS4 follows the smaller gradient
+    bool nearest;
+};
+
+// Fills columns [from, to) of the planar rows.
+void DemosaicRowScalar(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3],
+    unsigned int from,
+    unsigned int to );
+
+// Fill columns [2, returned value) of the planar rows.
+unsigned int DemosaicRowSse2(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3] );
+
+unsigned int DemosaicRowAvx2(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3] );
+
+// V provides T, sk_width, Load, Store, Avg, Avg4, AbsDiff, Less, Select,
+// EvenMask, DupEven and DupOdd. Avg and Avg4 must round like the scalar
+// kernel: ( a + b + 1 ) >> 1 and ( a + b + c + d + 2 ) >> 2.
+template <class V>
+unsigned int DemosaicRowSimd(
+    const unsigned char* pUp,
+    const unsigned char* pRow,
+    const unsigned char* pDown,
+    unsigned int cols,
+    const DemosaicRowPlan& plan,
+    unsigned char* const pPlanes[3] )
+{
+    typedef typename V::T T;
+    const T evenMask = V::EvenMask();
+
+    unsigned int x = 2;
+    for ( ; x + V::sk_width + 1 <= cols; x += V::sk_width )
+    {
+        T candidates[SRC_COUNT];
+        if ( plan.nearest )
+        {
+            T up = V::Load( pUp + x );
+            T row = V::Load( pRow + x );
+            T down = V::Load( pDown + x );
+            candidates[SRC_UP_EVEN] = V::DupEven( up );
+            candidates[SRC_UP_ODD] = V::DupOdd( up );
+            candidates[SRC_ROW_EVEN] = V::DupEven( row );
+            candidates[SRC_ROW_ODD] = V::DupOdd( row );
+            candidates[SRC_DOWN_EVEN] = V::DupEven( down );
+            candidates[SRC_DOWN_ODD] = V::DupOdd( down );
+        }
+        else
+        {
+            T center = V::Load( pRow + x );
+            T west = V::Load( pRow + x - 1 );
+            T east = V::Load( pRow + x + 1 );
+            T north = V::Load( pUp + x );
+            T south = V::Load( pDown + x );
+            T h2 = V::Avg( west, east );
+            T v2 = V::Avg( north, south );
+            T cross4 = V::Avg4( west, east, north, south );
+            if ( plan.edgeAware )
+            {
+                T dh = V::AbsDiff( west, east );
+                T dv = V::AbsDiff( north, south );
+                cross4 = V::Select( V::Less( dh, dv ), h2, V::Select( V::Less( dv, dh ), v2, cross4 ) );
+            }
+            candidates[SRC_CENTER] = center;
+            candidates[SRC_H2] = h2;
+            candidates[SRC_V2] = v2;
+            candidates[SRC_CROSS4] = cross4;
+            candidates[SRC_DIAG4] = V::Avg4( V::Load( pUp + x - 1 ), V::Load( pUp + x + 1 ),
+                                             V::Load( pDown + x - 1 ), V::Load( pDown + x + 1 ) );
+        }
+
+        for ( unsigned int channel = 0; channel < 3; channel++ )
+        {
+            T even = candidates[plan.source[channel][0]];
+            T odd = candidates[plan.source[channel][1]];
+            V::Store( pPlanes[channel] + x, V::Select( evenMask, even, odd ) );
+        }
+    }
+    return x;
+}
+
+#endif // DEMOSAIC_KERNELS_H
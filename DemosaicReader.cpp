@@ -0,0 +1,164 @@
+/*****************************************************************
+  DEMOSAIC READER
+
+  See DemosaicReader.h.
+
+*****************************************************************/
+
+#include "DemosaicReader.h"
+#include "CameraUtils.h"
+#include <atomic>
+#include <thread>
+#include <cstdio>
+
+using namespace FlyCapture2;
+
+DemosaicReader::DemosaicReader( const RawRecordingReader* pReader, unsigned int cacheFrames )
+    : m_pReader( pReader ),
+      m_cacheFrames( cacheFrames > 0 ? cacheFrames : 1 ),
+      m_useCounter( 0 ),
+      m_hits( 0 ),
+      m_misses( 0 ),
+      m_convertUs( 0 )
+{
+}
+
+Error DemosaicReader::Get( unsigned long long i, std::shared_ptr<const Image>* pImage )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        for ( unsigned int j = 0; j < m_cache.size(); j++ )
+        {
+            if ( m_cache[j].frame == i )
+            {
+                m_hits++;
+                m_cache[j].lastUse = ++m_useCounter;
+                *pImage = m_cache[j].rgb;
+                return Error();
+            }
+        }
+    }
+
+    // convert without holding the lock, so other frames can be served
+    std::shared_ptr<Image> rgb( new Image() );
+    Error error = Convert( i, rgb.get() );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    // another thread may have converted the same frame meanwhile; keep one
+    // entry and hand out the cached copy
+    for ( unsigned int j = 0; j < m_cache.size(); j++ )
+    {
+        if ( m_cache[j].frame == i )
+        {
+            m_cache[j].lastUse = ++m_useCounter;
+            *pImage = m_cache[j].rgb;
+            return Error();
+        }
+    }
+    *pImage = rgb;
+
+    // replace the least recently used frame; whoever still holds it keeps it
+    unsigned int victim = 0;
+    if ( m_cache.size() < m_cacheFrames )
+    {
+        victim = (unsigned int)m_cache.size();
+        m_cache.push_back( Entry() );
+    }
+    else
+    {
+        for ( unsigned int j = 1; j < m_cache.size(); j++ )
+        {
+            if ( m_cache[j].lastUse < m_cache[victim].lastUse )
+            {
+                victim = j;
+            }
+        }
+    }
+    m_cache[victim].frame = i;
+    m_cache[victim].lastUse = ++m_useCounter;
+    m_cache[victim].rgb = rgb;
+    return Error();
+}
+
+Error DemosaicReader::Get( unsigned long long i, Image* pImage )
+{
+    std::shared_ptr<const Image> rgb;
+    Error error = Get( i, &rgb );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+    return pImage->DeepCopy( rgb.get() );
+}
+
+Error DemosaicReader::Convert( unsigned long long i, Image* pImage )
+{
+    Image raw;
+    m_pReader->View( i, &raw );
+    if ( raw.GetData() == NULL )
+    {
+        return FailureError();
+    }
+    unsigned long long startUs = HostTimeUs();
+    Error error = ConvertToRGB( raw, pImage, m_demosaic );
+    unsigned long long convertUs = HostTimeUs() - startUs;
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_misses++;
+    m_convertUs += convertUs;
+    return Error();
+}
+
+void DemosaicReader::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    printf( "demosaic: %llu frames converted (%.1f ms each), %llu served from the cache\n",
+            m_misses, m_misses > 0 ? m_convertUs / 1000.0 / m_misses : 0.0, m_hits );
+}
+
+Error ExportFrames( DemosaicReader* pReader, const std::string& directory, unsigned int numThreads, const FrameEncoding& encoding )
+{
+    const RawRecordingReader& recording = pReader->Recording();
+    std::atomic<unsigned long long> next( 0 );
+    std::atomic<unsigned long long> failed( 0 );
+    std::mutex errorMutex;
+    Error lastError;
+
+    std::vector<std::thread> threads;
+    for ( unsigned int t = 0; t < ( numThreads > 0 ? numThreads : 1 ); t++ )
+    {
+        threads.push_back( std::thread( [&]
+        {
+            Image rgb;
+            for ( unsigned long long i = next++; i < recording.NumFrames(); i = next++ )
+            {
+                Error error = pReader->Convert( i, &rgb );
+                unsigned long long bytes;
+                if ( error == PGRERROR_OK )
+                {
+                    error = FrameWriter::SaveFrame( &rgb, directory, recording.Header().camera,
+                                                    (int)recording.Record( i ).index, encoding, &bytes );
+                }
+                if ( error != PGRERROR_OK )
+                {
+                    failed++;
+                    std::lock_guard<std::mutex> lock( errorMutex );
+                    lastError = error;
+                }
+            }
+        } ) );
+    }
+    for ( unsigned int t = 0; t < threads.size(); t++ )
+    {
+        threads[t].join();
+    }
+    return failed > 0 ? lastError : Error();
+}
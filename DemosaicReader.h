@@ -0,0 +1,85 @@
+/*****************************************************************
+  DEMOSAIC READER
+
+  RGB access to a RawRecording. Recordings keep the frames as the sensor
+  delivered them (RAW8 or RAW12 with their BayerTileFormat), a third of
+  the bytes of RGB and with no conversion during the scan. The conversion
+  to RGB happens here, the first time a consumer asks for a frame, and
+  the most recently converted frames are kept for the next request.
+
+  Get() may be called from several threads; conversions of different
+  frames run in parallel. Cached frames are handed out as shared, read
+  only references, so a hit costs no copy and the lock is only held to
+  look a frame up. Consumers that read every frame once, like
+  ExportFrames(), convert with Convert() and bypass the cache.
+
+*****************************************************************/
+
+#ifndef DEMOSAIC_READER_H
+#define DEMOSAIC_READER_H
+
+#include "FlyCapture2.h"
+#include "RawRecording.h"
+#include "FrameWriter.h"
+#include "Demosaic.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+class DemosaicReader
+{
+public:
+    // pReader must stay open while this is in use.
+    DemosaicReader( const RawRecordingReader* pReader, unsigned int cacheFrames = 8 );
+
+    // Frame i as PIXEL_FORMAT_RGB, shared with the cache. It stays valid
+    // as long as the caller holds it, even once the cache drops it.
+    FlyCapture2::Error Get( unsigned long long i, std::shared_ptr<const FlyCapture2::Image>* pImage );
+
+    // Copies frame i as PIXEL_FORMAT_RGB into pImage.
+    FlyCapture2::Error Get( unsigned long long i, FlyCapture2::Image* pImage );
+
+    // Converts frame i into pImage without looking at or filling the cache.
+    FlyCapture2::Error Convert( unsigned long long i, FlyCapture2::Image* pImage );
+
+    // Call before the first Get(). The default converts with the SDK.
+    void SetDemosaic( const DemosaicSettings& settings ) { m_demosaic = settings; }
+
+    const RawRecordingReader& Recording() const { return *m_pReader; }
+    void PrintStats() const;
+
+private:
+    DemosaicReader( const DemosaicReader& );
+    DemosaicReader& operator=( const DemosaicReader& );
+
+    struct Entry
+    {
+        unsigned long long frame;
+        unsigned long long lastUse;
+        std::shared_ptr<const FlyCapture2::Image> rgb;
+    };
+
+    const RawRecordingReader* m_pReader;
+    unsigned int m_cacheFrames;
+    DemosaicSettings m_demosaic;
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_cache;
+    unsigned long long m_useCounter;
+
+    unsigned long long m_hits;
+    unsigned long long m_misses;                // conversions, with or without the cache
+    unsigned long long m_convertUs;
+};
+
+// Saves every frame of the recording under the names FrameWriter uses,
+// directory/cam--<camera>-<index>.tiff or .png, on numThreads threads.
+// Every frame is read once, so they do not go through the cache.
+FlyCapture2::Error ExportFrames(
+    DemosaicReader* pReader,
+    const std::string& directory,
+    unsigned int numThreads,
+    const FrameEncoding& encoding = FrameEncoding() );
+
+#endif // DEMOSAIC_READER_H
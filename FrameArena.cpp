@@ -0,0 +1,204 @@
+/*****************************************************************
+  FRAME ARENA
+
+  See FrameArena.h.
+
+*****************************************************************/
+
+#include "FrameArena.h"
+#include "CameraUtils.h"
+#include "SyntheticCamera.h"
+#include "NumaPlacement.h"
+#include <cstring>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // USB3 transfers in 1024 byte packets, and every slot should start on
+    // its own page; a page is a multiple of the packet size.
+    const unsigned int sk_slotAlignment = 4096;
+}
+
+FrameArena::FrameArena()
+    : m_pBase( NULL ),
+      m_mappedSize( 0 ),
+      m_pageMode( PAGES_AUTO ),
+      m_pages( PAGES_NORMAL ),
+      m_node( -1 ),
+      m_slotSize( 0 ),
+      m_numSlots( 0 ),
+      m_rows( 0 ),
+      m_cols( 0 ),
+      m_stride( 0 ),
+      m_pixelFormat( UNSPECIFIED_PIXEL_FORMAT ),
+      m_bayerFormat( NONE ),
+      m_pClaimed( NULL ),
+      m_pHeld( NULL ),
+      m_sequence( 0 ),
+      m_inUse( 0 ),
+      m_highWater( 0 ),
+      m_overruns( 0 )
+{
+}
+
+FrameArena::~FrameArena()
+{
+    Free();
+}
+
+void FrameArena::Free()
+{
+    if ( m_pBase != NULL )
+    {
+        UnmapFrameMemory( m_pBase, m_mappedSize );
+        m_pBase = NULL;
+    }
+    delete [] m_pClaimed;
+    m_pClaimed = NULL;
+    delete [] m_pHeld;
+    m_pHeld = NULL;
+    m_mappedSize = 0;
+    m_numSlots = 0;
+}
+
+Error FrameArena::Allocate( CameraBase* pCamera, unsigned int numSlots )
+{
+    Format7ImageSettings settings;
+    Error error = GetImageSettings( pCamera, &settings );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    CameraInfo camInfo;
+    error = pCamera->GetCameraInfo( &camInfo );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    // which embedded words Claim() will find at the start of each frame
+    if ( pCamera->GetEmbeddedImageInfo( &m_embeddedInfo ) != PGRERROR_OK )
+    {
+        m_embeddedInfo = EmbeddedImageInfo();
+    }
+
+    Free();
+
+    m_rows = settings.height;
+    m_cols = settings.width;
+    m_stride = (unsigned int)( ( (unsigned long long)settings.width * Image::DetermineBitsPerPixel( settings.pixelFormat ) + 7 ) / 8 );
+    m_pixelFormat = settings.pixelFormat;
+    m_bayerFormat = camInfo.bayerTileFormat;
+
+    unsigned int frameSize = m_stride * m_rows;
+    m_slotSize = ( frameSize + sk_slotAlignment - 1 ) / sk_slotAlignment * sk_slotAlignment;
+    m_numSlots = numSlots;
+
+    m_pBase = MapFrameMemory( (size_t)m_slotSize * m_numSlots, m_pageMode, &m_pages, &m_mappedSize );
+    if ( m_pBase == NULL )
+    {
+        m_mappedSize = 0;
+        m_numSlots = 0;
+        return FailureError();
+    }
+
+    BindToNode( m_pBase, m_mappedSize, m_node );
+
+    // touch every page now so the first frames don't pay for page faults
+    memset( m_pBase, 0, m_mappedSize );
+
+    m_pClaimed = new std::atomic<bool>[m_numSlots];
+    for ( unsigned int i = 0; i < m_numSlots; i++ )
+    {
+        m_pClaimed[i].store( false );
+    }
+    m_pHeld = new Image[m_numSlots];
+    m_sequence = 0;
+    m_inUse = 0;
+    m_highWater = 0;
+    m_overruns = 0;
+    return Error();
+}
+
+Error FrameArena::Register( CameraBase* pCamera )
+{
+    if ( m_pBase == NULL )
+    {
+        return FailureError();
+    }
+    SyntheticCamera* pSyntheticCamera = dynamic_cast<SyntheticCamera*>( pCamera );
+    if ( pSyntheticCamera != NULL )
+    {
+        pSyntheticCamera->SetBufferBusyCallback( &FrameArena::SlotBusy, this );
+    }
+    return pCamera->SetUserBuffers( m_pBase, (int)m_slotSize, (int)m_numSlots );
+}
+
+bool FrameArena::SlotBusy( unsigned int slot, const void* pArena )
+{
+    const FrameArena* pThis = (const FrameArena*)pArena;
+    return slot < pThis->m_numSlots && pThis->IsClaimed( slot );
+}
+
+bool FrameArena::Claim( const Image& image, unsigned int camera, FrameHandle* pHandle )
+{
+    const unsigned char* pData = image.GetData();
+    if ( m_pBase == NULL || pData < m_pBase || pData >= m_pBase + (size_t)m_numSlots * m_slotSize ||
+         ( pData - m_pBase ) % m_slotSize != 0 )
+    {
+        return false;
+    }
+
+    unsigned int slot = (unsigned int)( ( pData - m_pBase ) / m_slotSize );
+    if ( m_pClaimed[slot].exchange( true, std::memory_order_acq_rel ) )
+    {
+        // the slot's handle is still out; a second one would be released
+        // twice and free the slot under its first consumer
+        m_overruns++;
+        return false;
+    }
+
+    unsigned int inUse = ++m_inUse;
+    unsigned int highWater = m_highWater.load();
+    while ( inUse > highWater && !m_highWater.compare_exchange_weak( highWater, inUse ) )
+    {
+    }
+    m_pHeld[slot] = image;
+
+    pHandle->camera = camera;
+    pHandle->slot = slot;
+    pHandle->sequence = m_sequence++;
+    pHandle->receivedSize = image.GetReceivedDataSize();
+    pHandle->hostTimeUs = HostTimeUs();
+    pHandle->timeStamp = image.GetTimeStamp();
+    pHandle->metadata = image.GetMetadata();
+    ParseEmbeddedInfo( SlotData( slot ), m_embeddedInfo, &pHandle->metadata );
+    return true;
+}
+
+void FrameArena::Release( FrameHandle* pHandle )
+{
+    if ( !pHandle->IsValid() || pHandle->slot >= m_numSlots )
+    {
+        return;
+    }
+    if ( m_pClaimed[pHandle->slot].load( std::memory_order_acquire ) )
+    {
+        m_pHeld[pHandle->slot] = Image();
+        m_inUse--;
+        m_pClaimed[pHandle->slot].store( false, std::memory_order_release );
+    }
+    pHandle->slot = FrameHandle::sk_invalidSlot;
+}
+
+void FrameArena::View( const FrameHandle& handle, Image* pImage ) const
+{
+    if ( !handle.IsValid() || handle.slot >= m_numSlots )
+    {
+        *pImage = Image();
+        return;
+    }
+    *pImage = Image( m_rows, m_cols, m_stride, SlotData( handle.slot ), m_stride * m_rows, m_pixelFormat, m_bayerFormat );
+}
@@ -0,0 +1,127 @@
+/*****************************************************************
+  FRAME ARENA
+
+  One preallocated, page-aligned block of frame buffers that is handed to
+  the driver with CameraBase::SetUserBuffers. The driver writes every frame
+  straight into one of its slots, so a captured frame can be passed
+  downstream as a small FrameHandle (slot index + metadata) instead of being
+  DeepCopy'd into another Image.
+
+  Claim() and Release() may be called from different threads, e.g. a grab
+  thread claiming and a writer releasing.
+
+  The slots sit on huge pages where the system has them (see HugePages.h).
+
+*****************************************************************/
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include "FlyCapture2.h"
+#include "HugePages.h"
+#include <atomic>
+
+// A captured frame living in a FrameArena slot. Handles are cheap to copy;
+// the slot stays reserved until FrameArena::Release() is called for it.
+struct FrameHandle
+{
+    static const unsigned int sk_invalidSlot = 0xFFFFFFFF;
+
+    unsigned int camera;
+    unsigned int slot;
+    unsigned long long sequence;        // delivery order on this camera
+    unsigned int receivedSize;
+    unsigned long long hostTimeUs;      // host monotonic time the frame was handed to us
+    FlyCapture2::TimeStamp timeStamp;
+    FlyCapture2::ImageMetadata metadata;
+
+    FrameHandle()
+    {
+        camera = 0;
+        slot = sk_invalidSlot;
+        sequence = 0;
+        receivedSize = 0;
+        hostTimeUs = 0;
+    }
+
+    bool IsValid() const { return slot != sk_invalidSlot; }
+};
+
+class FrameArena
+{
+public:
+    FrameArena();
+    ~FrameArena();
+
+    // Which pages the next Allocate() asks for; PAGES_AUTO by default.
+    void SetPageMode( PageMode mode ) { m_pageMode = mode; }
+
+    // NUMA node the next Allocate() takes its pages from, -1 (the default)
+    // for wherever the allocating thread runs.
+    void SetNumaNode( int node ) { m_node = node; }
+
+    // Sizes the arena from the camera's current Format7 settings and
+    // reserves numSlots frames. Must be called before StartCapture() and
+    // after the embedded image info has been set up.
+    FlyCapture2::Error Allocate( FlyCapture2::CameraBase* pCamera, unsigned int numSlots );
+
+    // Registers the slots as the camera's image buffers.
+    FlyCapture2::Error Register( FlyCapture2::CameraBase* pCamera );
+
+    // Turns an image returned by RetrieveBuffer (which points into the
+    // arena) into a handle. Returns false if the image is not ours, or if
+    // its slot is still claimed (an overrun); the frame is then dropped.
+    bool Claim( const FlyCapture2::Image& image, unsigned int camera, FrameHandle* pHandle );
+
+    // Gives a slot back once every consumer is done with it.
+    void Release( FrameHandle* pHandle );
+
+    // Wraps a slot in an Image without copying. The Image does not own the
+    // memory and must not outlive the arena or the handle.
+    void View( const FrameHandle& handle, FlyCapture2::Image* pImage ) const;
+
+    unsigned char* SlotData( unsigned int slot ) const { return m_pBase + (size_t)slot * m_slotSize; }
+    unsigned int SlotSize() const { return m_slotSize; }
+    PageMode Pages() const { return m_pages; }
+    unsigned int NumSlots() const { return m_numSlots; }
+    bool IsClaimed( unsigned int slot ) const { return m_pClaimed[slot].load( std::memory_order_acquire ); }
+    unsigned int InUse() const { return m_inUse.load(); }
+    unsigned int HighWater() const { return m_highWater.load(); }
+
+    // Frames dropped because they landed in a slot that had not been
+    // released yet, i.e. the driver lapped a consumer that was too slow.
+    unsigned int Overruns() const { return m_overruns.load(); }
+
+private:
+    FrameArena( const FrameArena& );
+    FrameArena& operator=( const FrameArena& );
+
+    void Free();
+    static bool SlotBusy( unsigned int slot, const void* pArena );
+
+    unsigned char* m_pBase;
+    size_t m_mappedSize;
+    PageMode m_pageMode;
+    PageMode m_pages;                   // what the mapping got
+    int m_node;
+    unsigned int m_slotSize;
+    unsigned int m_numSlots;
+
+    unsigned int m_rows;
+    unsigned int m_cols;
+    unsigned int m_stride;
+    FlyCapture2::PixelFormat m_pixelFormat;
+    FlyCapture2::BayerTileFormat m_bayerFormat;
+    FlyCapture2::EmbeddedImageInfo m_embeddedInfo;
+
+    // a claimed slot also keeps a reference to the SDK image, so the driver
+    // does not requeue the buffer before the slot is released
+    std::atomic<bool>* m_pClaimed;
+    FlyCapture2::Image* m_pHeld;
+    unsigned long long m_sequence;
+    std::atomic<unsigned int> m_inUse;
+    std::atomic<unsigned int> m_highWater;
+    std::atomic<unsigned int> m_overruns;
+};
+
+#endif // FRAME_ARENA_H
@@ -0,0 +1,205 @@
+/*****************************************************************
+  FRAME POOL
+
+  See FramePool.h.
+
+*****************************************************************/
+
+#include "FramePool.h"
+#include "CameraUtils.h"
+#include "NumaPlacement.h"
+#include <cstring>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // every frame starts on its own page
+    const unsigned int sk_frameAlignment = 4096;
+
+    const unsigned int sk_noFrame = 0xFFFFFFFF;
+
+    unsigned long long PackHead( unsigned int index, unsigned long long tag )
+    {
+        return ( tag << 32 ) | index;
+    }
+}
+
+FramePool::FramePool()
+    : m_pBase( NULL ),
+      m_mappedSize( 0 ),
+      m_pageMode( PAGES_AUTO ),
+      m_pages( PAGES_NORMAL ),
+      m_node( -1 ),
+      m_frameSize( 0 ),
+      m_frameStride( 0 ),
+      m_rows( 0 ),
+      m_stride( 0 ),
+      m_pixelFormat( UNSPECIFIED_PIXEL_FORMAT ),
+      m_pFrames( NULL ),
+      m_numFrames( 0 ),
+      m_freeHead( PackHead( sk_noFrame, 0 ) ),
+      m_inUse( 0 ),
+      m_highWater( 0 ),
+      m_exhausted( 0 )
+{
+}
+
+FramePool::~FramePool()
+{
+    Free();
+}
+
+void FramePool::Free()
+{
+    delete [] m_pFrames;
+    m_pFrames = NULL;
+    m_numFrames = 0;
+    if ( m_pBase != NULL )
+    {
+        UnmapFrameMemory( m_pBase, m_mappedSize );
+        m_pBase = NULL;
+    }
+    m_mappedSize = 0;
+    m_freeHead = PackHead( sk_noFrame, 0 );
+}
+
+Error FramePool::Allocate( CameraBase* pCamera, unsigned int numFrames )
+{
+    Format7ImageSettings settings;
+    Error error = GetImageSettings( pCamera, &settings );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    CameraInfo camInfo;
+    error = pCamera->GetCameraInfo( &camInfo );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    Free();
+
+    m_rows = settings.height;
+    m_stride = (unsigned int)( ( (unsigned long long)settings.width * Image::DetermineBitsPerPixel( settings.pixelFormat ) + 7 ) / 8 );
+    m_pixelFormat = settings.pixelFormat;
+    m_frameSize = m_stride * m_rows;
+    m_frameStride = ( m_frameSize + sk_frameAlignment - 1 ) / sk_frameAlignment * sk_frameAlignment;
+
+    m_pBase = MapFrameMemory( (size_t)m_frameStride * numFrames, m_pageMode, &m_pages, &m_mappedSize );
+    if ( m_pBase == NULL )
+    {
+        m_mappedSize = 0;
+        return FailureError();
+    }
+
+    BindToNode( m_pBase, m_mappedSize, m_node );
+
+    // touch every page now so the first frames don't pay for page faults
+    memset( m_pBase, 0, m_mappedSize );
+
+    // every frame is free, the first one on top
+    m_numFrames = numFrames;
+    m_pFrames = new PooledFrame[m_numFrames];
+    for ( unsigned int i = 0; i < m_numFrames; i++ )
+    {
+        PooledFrame& frame = m_pFrames[i];
+        frame.index = i;
+        frame.pData = m_pBase + (size_t)i * m_frameStride;
+        frame.image = Image( m_rows, settings.width, m_stride, frame.pData, m_frameSize, m_pixelFormat, camInfo.bayerTileFormat );
+        frame.nextFree.store( i + 1 < m_numFrames ? i + 1 : sk_noFrame );
+    }
+    m_freeHead = PackHead( m_numFrames > 0 ? 0 : sk_noFrame, 0 );
+    m_inUse = 0;
+    m_highWater = 0;
+    m_exhausted = 0;
+    return Error();
+}
+
+PooledFrame* FramePool::Acquire()
+{
+    unsigned long long head = m_freeHead.load( std::memory_order_acquire );
+    for (;;)
+    {
+        unsigned int index = (unsigned int)head;
+        if ( index == sk_noFrame )
+        {
+            m_exhausted++;
+            return NULL;
+        }
+        // if another thread took this frame meanwhile, the tag has moved on
+        // and the exchange fails, whatever next we read
+        unsigned int next = m_pFrames[index].nextFree.load( std::memory_order_relaxed );
+        if ( m_freeHead.compare_exchange_weak( head, PackHead( next, ( head >> 32 ) + 1 ),
+                                               std::memory_order_acq_rel, std::memory_order_acquire ) )
+        {
+            break;
+        }
+    }
+
+    PooledFrame* pFrame = &m_pFrames[(unsigned int)head];
+    pFrame->refs.store( 1, std::memory_order_relaxed );
+    unsigned int inUse = ++m_inUse;
+    unsigned int highWater = m_highWater.load();
+    while ( inUse > highWater && !m_highWater.compare_exchange_weak( highWater, inUse ) )
+    {
+    }
+    return pFrame;
+}
+
+PooledFrame* FramePool::Copy( const Image& image, unsigned int camera, int index )
+{
+    if ( image.GetData() == NULL || image.GetRows() != m_rows || image.GetStride() != m_stride ||
+         image.GetPixelFormat() != m_pixelFormat )
+    {
+        return NULL;
+    }
+    PooledFrame* pFrame = Acquire();
+    if ( pFrame == NULL )
+    {
+        return NULL;
+    }
+
+    memcpy( pFrame->pData, image.GetData(), m_frameSize );
+    FrameHandle& info = pFrame->info;
+    info.camera = camera;
+    info.slot = pFrame->index;
+    info.sequence = index;
+    info.receivedSize = image.GetReceivedDataSize();
+    info.hostTimeUs = HostTimeUs();
+    info.timeStamp = image.GetTimeStamp();
+    info.metadata = image.GetMetadata();
+    return pFrame;
+}
+
+void FramePool::AddRef( PooledFrame* pFrame )
+{
+    pFrame->refs.fetch_add( 1, std::memory_order_relaxed );
+}
+
+void FramePool::Release( PooledFrame* pFrame )
+{
+    if ( pFrame == NULL )
+    {
+        return;
+    }
+    // the last consumer's reads of the frame come before it is reused
+    if ( pFrame->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+    {
+        m_inUse--;
+        Push( pFrame );
+    }
+}
+
+void FramePool::Push( PooledFrame* pFrame )
+{
+    unsigned long long head = m_freeHead.load( std::memory_order_relaxed );
+    do
+    {
+        pFrame->nextFree.store( (unsigned int)head, std::memory_order_relaxed );
+    }
+    while ( !m_freeHead.compare_exchange_weak( head, PackHead( pFrame->index, ( head >> 32 ) + 1 ),
+                                               std::memory_order_release, std::memory_order_relaxed ) );
+}
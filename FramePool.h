@@ -0,0 +1,112 @@
+/*****************************************************************
+  FRAME POOL
+
+  A fixed number of frame buffers, sized from the camera's Format7
+  settings and allocated once before the scan, for capturing with copies.
+  Instead of DeepCopy'ing every frame into a new Image, the scan loop
+  takes a free frame from the pool and copies into it; the frame carries
+  a reference count and goes back to the pool when the last consumer
+  (writer, recording) releases it. The frames are recycled, so once the
+  pool is allocated, capturing does not need the heap for frame data.
+
+  Acquire(), AddRef() and Release() are lock free and may be called from
+  any thread; the free frames are kept on a tagged stack.
+
+  The buffers sit on huge pages where the system has them (see
+  HugePages.h).
+
+*****************************************************************/
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include "HugePages.h"
+#include <atomic>
+
+// A frame buffer of a FramePool. image wraps the buffer and is set up once
+// by the pool, so handing a frame on does not create an Image.
+struct PooledFrame
+{
+    std::atomic<unsigned int> refs;
+    std::atomic<unsigned int> nextFree;     // free list link, only while free
+    unsigned int index;                     // position in the pool
+    unsigned char* pData;
+    FlyCapture2::Image image;
+    FrameHandle info;                       // timestamp and metadata of the frame held
+
+    PooledFrame() : refs( 0 ), nextFree( 0 ), index( 0 ), pData( NULL ) {}
+};
+
+class FramePool
+{
+public:
+    FramePool();
+    ~FramePool();
+
+    // Which pages the next Allocate() asks for; PAGES_AUTO by default.
+    void SetPageMode( PageMode mode ) { m_pageMode = mode; }
+
+    // NUMA node the next Allocate() takes its pages from, -1 (the default)
+    // for no preference.
+    void SetNumaNode( int node ) { m_node = node; }
+
+    // Sizes frames from the camera's current Format7 settings and
+    // allocates numFrames of them. Not thread safe; call before the scan.
+    FlyCapture2::Error Allocate( FlyCapture2::CameraBase* pCamera, unsigned int numFrames );
+
+    // A free frame with one reference, or NULL if all are in use.
+    PooledFrame* Acquire();
+
+    // Acquires a frame and copies image into it, e.g. straight from
+    // RetrieveBuffer. Its arrival time is taken now. NULL if the pool is
+    // empty or the image does not fit.
+    PooledFrame* Copy( const FlyCapture2::Image& image, unsigned int camera, int index );
+
+    // One more consumer of pFrame.
+    void AddRef( PooledFrame* pFrame );
+
+    // Drops one reference; the last one puts the frame back in the pool.
+    void Release( PooledFrame* pFrame );
+
+    unsigned int NumFrames() const { return m_numFrames; }
+    unsigned int FrameSize() const { return m_frameSize; }
+    PageMode Pages() const { return m_pages; }
+    unsigned int InUse() const { return m_inUse.load(); }
+    unsigned int HighWater() const { return m_highWater.load(); }
+
+    // Acquire() calls that found every frame in use.
+    unsigned int Exhausted() const { return m_exhausted.load(); }
+
+private:
+    FramePool( const FramePool& );
+    FramePool& operator=( const FramePool& );
+
+    void Free();
+    void Push( PooledFrame* pFrame );
+
+    unsigned char* m_pBase;
+    size_t m_mappedSize;
+    PageMode m_pageMode;
+    PageMode m_pages;
+    int m_node;
+    unsigned int m_frameSize;
+    unsigned int m_frameStride;
+
+    unsigned int m_rows;
+    unsigned int m_stride;
+    FlyCapture2::PixelFormat m_pixelFormat;
+
+    PooledFrame* m_pFrames;
+    unsigned int m_numFrames;
+
+    // index of the top free frame in the low half, a count bumped by
+    // every change in the high half so a stale pop cannot succeed
+    std::atomic<unsigned long long> m_freeHead;
+    std::atomic<unsigned int> m_inUse;
+    std::atomic<unsigned int> m_highWater;
+    std::atomic<unsigned int> m_exhausted;
+};
+
+#endif // FRAME_POOL_H
@@ -0,0 +1,236 @@
+/*****************************************************************
+  FRAME SPOOL
+
+  See FrameSpool.h.
+
+*****************************************************************/
+
+#include "FrameSpool.h"
+#include "CameraUtils.h"
+#include "NumaPlacement.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // every frame starts on its own page, so a spilled one can be dropped
+    // from memory without touching its neighbours
+    const unsigned int sk_frameAlignment = 4096;
+}
+
+FrameSpool::FrameSpool()
+    : m_pMemory( NULL ),
+      m_memorySize( 0 ),
+      m_memoryMapped( 0 ),
+      m_pageMode( PAGES_AUTO ),
+      m_pages( PAGES_NORMAL ),
+      m_node( -1 ),
+      m_pSpill( NULL ),
+      m_spillSize( 0 ),
+      m_spillFd( -1 ),
+      m_frameSize( 0 ),
+      m_frameStride( 0 ),
+      m_memoryFrames( 0 ),
+      m_spilled( 0 ),
+      m_rows( 0 ),
+      m_cols( 0 ),
+      m_stride( 0 ),
+      m_pixelFormat( UNSPECIFIED_PIXEL_FORMAT ),
+      m_bayerFormat( NONE )
+{
+}
+
+FrameSpool::~FrameSpool()
+{
+    Free();
+}
+
+void FrameSpool::Free()
+{
+    if ( m_pMemory != NULL )
+    {
+        UnmapFrameMemory( m_pMemory, m_memoryMapped );
+        m_pMemory = NULL;
+    }
+    if ( m_pSpill != NULL )
+    {
+        munmap( m_pSpill, m_spillSize );
+        m_pSpill = NULL;
+    }
+    if ( m_spillFd >= 0 )
+    {
+        close( m_spillFd );
+        m_spillFd = -1;
+    }
+    m_memorySize = 0;
+    m_spillSize = 0;
+    m_memoryFrames = 0;
+    m_spilled = 0;
+    m_info.clear();
+}
+
+Error FrameSpool::Allocate( CameraBase* pCamera, unsigned int numFrames, unsigned long long memoryBytes, const std::string& directory )
+{
+    Format7ImageSettings settings;
+    Error error = GetImageSettings( pCamera, &settings );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    CameraInfo camInfo;
+    error = pCamera->GetCameraInfo( &camInfo );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    Free();
+
+    m_rows = settings.height;
+    m_cols = settings.width;
+    m_stride = (unsigned int)( ( (unsigned long long)settings.width * Image::DetermineBitsPerPixel( settings.pixelFormat ) + 7 ) / 8 );
+    m_pixelFormat = settings.pixelFormat;
+    m_bayerFormat = camInfo.bayerTileFormat;
+    m_frameSize = m_stride * m_rows;
+    m_frameStride = ( m_frameSize + sk_frameAlignment - 1 ) / sk_frameAlignment * sk_frameAlignment;
+
+    m_memoryFrames = (unsigned int)( memoryBytes / m_frameStride );
+    if ( m_memoryFrames > numFrames )
+    {
+        m_memoryFrames = numFrames;
+    }
+    unsigned int spillFrames = numFrames - m_memoryFrames;
+
+    if ( m_memoryFrames > 0 )
+    {
+        m_memorySize = (size_t)m_memoryFrames * m_frameStride;
+        m_pMemory = MapFrameMemory( m_memorySize, m_pageMode, &m_pages, &m_memoryMapped );
+        if ( m_pMemory == NULL )
+        {
+            m_memorySize = 0;
+            return FailureError();
+        }
+
+        BindToNode( m_pMemory, m_memoryMapped, m_node );
+
+        // touch every page now, so the resident size is fixed before the
+        // scan and the first frames don't pay for page faults
+        memset( m_pMemory, 0, m_memorySize );
+    }
+
+    if ( spillFrames > 0 )
+    {
+        std::string path = directory + "/.spool-XXXXXX";
+        std::vector<char> name( path.begin(), path.end() );
+        name.push_back( 0 );
+        m_spillFd = mkstemp( &name[0] );
+        if ( m_spillFd < 0 )
+        {
+            Free();
+            return FailureError();
+        }
+        unlink( &name[0] );
+
+        // reserve the space now so a full disk shows before the scan
+        m_spillSize = (size_t)spillFrames * m_frameStride;
+        if ( fallocate( m_spillFd, 0, 0, (off_t)m_spillSize ) != 0 &&
+             ( ( errno != EOPNOTSUPP && errno != ENOSYS ) || ftruncate( m_spillFd, (off_t)m_spillSize ) != 0 ) )
+        {
+            Free();
+            return FailureError();
+        }
+        void* pSpill = mmap( NULL, m_spillSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_spillFd, 0 );
+        if ( pSpill == MAP_FAILED )
+        {
+            m_pSpill = NULL;
+            Free();
+            return FailureError();
+        }
+        m_pSpill = (unsigned char*)pSpill;
+    }
+
+    m_info.resize( numFrames );
+    return Error();
+}
+
+unsigned char* FrameSpool::FrameData( unsigned int index ) const
+{
+    if ( index < m_memoryFrames )
+    {
+        return m_pMemory + (size_t)index * m_frameStride;
+    }
+    return m_pSpill + (size_t)( index - m_memoryFrames ) * m_frameStride;
+}
+
+Error FrameSpool::Copy( unsigned int index, const Image& image, const FrameHandle& info )
+{
+    if ( index >= m_info.size() || image.GetData() == NULL || image.GetRows() != m_rows ||
+         image.GetStride() != m_stride || image.GetPixelFormat() != m_pixelFormat )
+    {
+        return FailureError();
+    }
+
+    unsigned char* pData = FrameData( index );
+    memcpy( pData, image.GetData(), m_frameSize );
+    m_info[index] = info;
+    m_info[index].slot = index;
+
+    if ( index >= m_memoryFrames )
+    {
+        // start writing the frame out and give its pages back; the data
+        // stays in the file and comes back on the next access
+        off_t offset = (off_t)( index - m_memoryFrames ) * m_frameStride;
+        sync_file_range( m_spillFd, offset, m_frameStride, SYNC_FILE_RANGE_WRITE );
+        madvise( pData, m_frameStride, MADV_DONTNEED );
+        m_spilled++;
+    }
+    return Error();
+}
+
+Error FrameSpool::Store( unsigned int index, const Image& image )
+{
+    FrameHandle info;
+    info.sequence = index;
+    info.receivedSize = image.GetReceivedDataSize();
+    info.hostTimeUs = HostTimeUs();
+    info.timeStamp = image.GetTimeStamp();
+    info.metadata = image.GetMetadata();
+    return Copy( index, image, info );
+}
+
+Error FrameSpool::Store( unsigned int index, const FrameArena& arena, const FrameHandle& handle )
+{
+    Image image;
+    arena.View( handle, &image );
+    return Copy( index, image, handle );
+}
+
+bool FrameSpool::View( unsigned int index, Image* pImage, FrameHandle* pInfo ) const
+{
+    if ( !IsStored( index ) )
+    {
+        *pImage = Image();
+        return false;
+    }
+    *pImage = Image( m_rows, m_cols, m_stride, FrameData( index ), m_frameSize, m_pixelFormat, m_bayerFormat );
+    if ( pInfo != NULL )
+    {
+        *pInfo = m_info[index];
+    }
+    return true;
+}
+
+void FrameSpool::Release( unsigned int index )
+{
+    if ( index >= m_memoryFrames && index < m_info.size() )
+    {
+        madvise( FrameData( index ), m_frameStride, MADV_DONTNEED );
+    }
+}
@@ -0,0 +1,107 @@
+/*****************************************************************
+  FRAME SPOOL
+
+  Holds the frames of a scan until they are saved, in bounded memory. The
+  first frames go into a fixed block of memory, allocated and touched up
+  front; once that is full, the rest go to a scratch file mapped into
+  memory. A spilled frame is copied into the mapping, handed to the kernel
+  for writeback and dropped from the process straight away, so the
+  resident size stays the same however long the scan is. Reading a
+  spilled frame back maps it in again until Release().
+
+  The scratch file is unlinked as soon as it is created, so it disappears
+  with the process.
+
+  Store() is called by the scan loop; View() and Release() may be called
+  from writer threads, each frame by one of them.
+
+*****************************************************************/
+
+#ifndef FRAME_SPOOL_H
+#define FRAME_SPOOL_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include "HugePages.h"
+#include <string>
+#include <vector>
+
+class FrameSpool
+{
+public:
+    FrameSpool();
+    ~FrameSpool();
+
+    // Which pages the memory part of the next Allocate() asks for.
+    void SetPageMode( PageMode mode ) { m_pageMode = mode; }
+
+    // NUMA node the memory part comes from, -1 for no preference.
+    void SetNumaNode( int node ) { m_node = node; }
+
+    // Sizes frames from the camera's current Format7 settings and makes
+    // room for numFrames of them: as many as fit in memoryBytes in memory,
+    // the rest in a scratch file in directory.
+    FlyCapture2::Error Allocate(
+        FlyCapture2::CameraBase* pCamera,
+        unsigned int numFrames,
+        unsigned long long memoryBytes,
+        const std::string& directory );
+
+    // Copies frame index in, e.g. straight from RetrieveBuffer. Its
+    // arrival time is taken now.
+    FlyCapture2::Error Store( unsigned int index, const FlyCapture2::Image& image );
+
+    // Same for a frame in an arena slot, which can be released as soon as
+    // this returns.
+    FlyCapture2::Error Store( unsigned int index, const FrameArena& arena, const FrameHandle& handle );
+
+    // Wraps frame index in an Image without copying and returns its
+    // timestamp and metadata in pInfo. False if it was never stored.
+    bool View( unsigned int index, FlyCapture2::Image* pImage, FrameHandle* pInfo ) const;
+
+    // Whether frame index was stored.
+    bool IsStored( unsigned int index ) const { return index < m_info.size() && m_info[index].IsValid(); }
+
+    // Done with frame index; a spilled frame leaves memory again.
+    void Release( unsigned int index );
+
+    unsigned int NumFrames() const { return (unsigned int)m_info.size(); }
+    unsigned int MemoryFrames() const { return m_memoryFrames; }
+    unsigned int Spilled() const { return m_spilled; }
+    unsigned long long MemoryBytes() const { return m_memorySize; }
+    PageMode Pages() const { return m_pages; }
+
+private:
+    FrameSpool( const FrameSpool& );
+    FrameSpool& operator=( const FrameSpool& );
+
+    void Free();
+    FlyCapture2::Error Copy( unsigned int index, const FlyCapture2::Image& image, const FrameHandle& info );
+    unsigned char* FrameData( unsigned int index ) const;
+
+    unsigned char* m_pMemory;
+    size_t m_memorySize;
+    size_t m_memoryMapped;
+    PageMode m_pageMode;
+    PageMode m_pages;
+    int m_node;
+    unsigned char* m_pSpill;
+    size_t m_spillSize;
+    int m_spillFd;
+
+    unsigned int m_frameSize;
+    unsigned int m_frameStride;
+    unsigned int m_memoryFrames;
+    unsigned int m_spilled;
+
+    unsigned int m_rows;
+    unsigned int m_cols;
+    unsigned int m_stride;
+    FlyCapture2::PixelFormat m_pixelFormat;
+    FlyCapture2::BayerTileFormat m_bayerFormat;
+
+    // per frame; an invalid slot means not stored
+    std::vector<FrameHandle> m_info;
+};
+
+#endif // FRAME_SPOOL_H
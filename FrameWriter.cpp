@@ -0,0 +1,414 @@
+/*****************************************************************
+  FRAME WRITER
+
+  See FrameWriter.h.
+
+*****************************************************************/
+
+#include "FrameWriter.h"
+#include "CameraUtils.h"
+#include "NumaPlacement.h"
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace FlyCapture2;
+
+bool FrameEncoding::Parse( const char* pName )
+{
+    png = false;
+    if ( !strcmp( pName, "none" ) )
+    {
+        tiffCompression = TIFFOption::NONE;
+    }
+    else if ( !strcmp( pName, "packbits" ) )
+    {
+        tiffCompression = TIFFOption::PACKBITS;
+    }
+    else if ( !strcmp( pName, "deflate" ) )
+    {
+        tiffCompression = TIFFOption::DEFLATE;
+    }
+    else if ( !strcmp( pName, "lzw" ) )
+    {
+        tiffCompression = TIFFOption::LZW;
+    }
+    else if ( !strncmp( pName, "png", 3 ) && ( pName[3] == 0 || pName[3] == ':' ) )
+    {
+        png = true;
+        pngLevel = pName[3] == ':' ? atoi( pName + 4 ) : 6;
+        if ( pngLevel > 9 )
+        {
+            pngLevel = 9;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string FrameEncoding::Name() const
+{
+    if ( png )
+    {
+        char name[16];
+        snprintf( name, sizeof( name ), "png:%u", pngLevel );
+        return name;
+    }
+    switch ( tiffCompression )
+    {
+    case TIFFOption::PACKBITS: return "tiff packbits";
+    case TIFFOption::DEFLATE: return "tiff deflate";
+    case TIFFOption::LZW: return "tiff lzw";
+    default: return "tiff";
+    }
+}
+
+Error FrameWriter::SaveFrame( Image* pImage, const std::string& directory, unsigned int camera, int index,
+                              const FrameEncoding& encoding, unsigned long long* pBytes )
+{
+    char filename[512];
+    snprintf( filename, sizeof( filename ), "%s/cam--%u-%d.%s", directory.c_str(), camera, index, encoding.Extension() );
+
+    Error error;
+    if ( encoding.png )
+    {
+        PNGOption option;
+        option.compressionLevel = encoding.pngLevel;
+        error = pImage->Save( filename, &option );
+    }
+    else
+    {
+        TIFFOption option;
+        option.compression = encoding.tiffCompression;
+        error = pImage->Save( filename, &option );
+    }
+
+    struct stat st;
+    *pBytes = error == PGRERROR_OK && stat( filename, &st ) == 0 ? st.st_size : 0;
+    return error;
+}
+
+FrameWriter::FrameWriter( const std::string& directory, unsigned int capacity, unsigned int numWorkers, unsigned int numCameras )
+    : m_directory( directory ),
+      m_capacity( capacity > 0 ? capacity : 1 ),
+      m_numWorkers( numWorkers > 0 ? numWorkers : 1 ),
+      m_queues( numCameras > 0 ? numCameras : 1 ),
+      m_nextOwned( m_numWorkers, 0 ),
+      m_queued( 0 ),
+      m_stopping( false )
+{
+    for ( unsigned int i = 0; i < m_queues.size(); i++ )
+    {
+        m_queues[i].ring.resize( m_capacity );
+        m_queues[i].head = 0;
+        m_queues[i].queued = 0;
+    }
+    m_stats.cameraMaxDepth.assign( m_queues.size(), 0 );
+    m_stats.cameraWritten.assign( m_queues.size(), 0 );
+}
+
+FrameWriter::~FrameWriter()
+{
+    Finish();
+}
+
+void FrameWriter::Start()
+{
+    Finish();
+    m_stopping = false;
+    for ( unsigned int i = 0; i < m_numWorkers; i++ )
+    {
+        m_threads.push_back( std::thread( &FrameWriter::WriteLoop, this, i ) );
+    }
+}
+
+void FrameWriter::Submit( unsigned int camera, int index, FrameArena* pArena, const FrameHandle& handle )
+{
+    Job job;
+    job.camera = camera;
+    job.index = index;
+    job.pArena = pArena;
+    job.handle = handle;
+    job.pSpool = NULL;
+    job.pPool = NULL;
+    job.pFrame = NULL;
+    job.pImage = NULL;
+    Enqueue( job );
+}
+
+void FrameWriter::Submit( unsigned int camera, int index, FrameSpool* pSpool )
+{
+    Job job;
+    job.camera = camera;
+    job.index = index;
+    job.pArena = NULL;
+    job.pSpool = pSpool;
+    job.pPool = NULL;
+    job.pFrame = NULL;
+    job.pImage = NULL;
+    Enqueue( job );
+}
+
+void FrameWriter::Submit( unsigned int camera, int index, FramePool* pPool, PooledFrame* pFrame )
+{
+    Job job;
+    job.camera = camera;
+    job.index = index;
+    job.pArena = NULL;
+    job.pSpool = NULL;
+    job.pPool = pPool;
+    job.pFrame = pFrame;
+    job.pImage = NULL;
+    Enqueue( job );
+}
+
+void FrameWriter::Submit( unsigned int camera, int index, const Image& image )
+{
+    Job job;
+    job.camera = camera;
+    job.index = index;
+    job.pArena = NULL;
+    job.pSpool = NULL;
+    job.pPool = NULL;
+    job.pFrame = NULL;
+    job.pImage = new Image( image );
+    Enqueue( job );
+}
+
+void FrameWriter::Enqueue( const Job& job )
+{
+    unsigned int camera = job.camera % m_queues.size();
+    Queue& queue = m_queues[camera];
+    std::unique_lock<std::mutex> lock( m_mutex );
+    if ( queue.queued >= m_capacity )
+    {
+        // backpressure: the scan waits rather than holding more frames
+        unsigned long long waitStartUs = HostTimeUs();
+        m_notFull.wait( lock, [this, &queue]{ return queue.queued < m_capacity; } );
+        unsigned long long waitedUs = HostTimeUs() - waitStartUs;
+        m_stats.blocked++;
+        m_stats.blockedUs += waitedUs;
+        if ( waitedUs > m_stats.maxBlockedUs )
+        {
+            m_stats.maxBlockedUs = waitedUs;
+        }
+    }
+    queue.ring[( queue.head + queue.queued ) % m_capacity] = job;
+    queue.queued++;
+    m_queued++;
+    m_stats.submitted++;
+    if ( queue.queued > m_stats.cameraMaxDepth[camera] )
+    {
+        m_stats.cameraMaxDepth[camera] = queue.queued;
+    }
+    if ( queue.queued > m_stats.maxDepth )
+    {
+        m_stats.maxDepth = queue.queued;
+    }
+    m_notEmpty.notify_one();
+}
+
+void FrameWriter::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stopping = true;
+    }
+    m_notEmpty.notify_all();
+    for ( unsigned int i = 0; i < m_threads.size(); i++ )
+    {
+        m_threads[i].join();
+    }
+    m_threads.clear();
+}
+
+void FrameWriter::WriteLoop( unsigned int worker )
+{
+    if ( !m_workerCpus.empty() )
+    {
+        PinThread( m_workerCpus[worker % m_workerCpus.size()] );
+    }
+    Image viewImage;
+    Image convertedImage;
+    std::unique_lock<std::mutex> lock( m_mutex );
+    for (;;)
+    {
+        m_notEmpty.wait( lock, [this]{ return m_stopping || m_queued > 0; } );
+        Job job;
+        if ( !Dequeue( worker, &job ) )
+        {
+            return;
+        }
+        // the scan may be waiting on any camera's queue
+        m_notFull.notify_all();
+
+        lock.unlock();
+        Write( job, &viewImage, &convertedImage );
+        lock.lock();
+    }
+}
+
+bool FrameWriter::Dequeue( unsigned int worker, Job* pJob )
+{
+    // this worker's own queues in turn while they have frames, so they stay
+    // on its camera's node; otherwise help with the deepest other one.
+    // Worker k owns queues k, k + numWorkers, ..., so with fewer workers
+    // than cameras every camera still has one.
+    const unsigned int numQueues = (unsigned int)m_queues.size();
+    const unsigned int first = worker % numQueues;
+    const unsigned int owned = worker < numQueues ? ( numQueues - worker + m_numWorkers - 1 ) / m_numWorkers : 1;
+    unsigned int camera = first;
+    bool found = false;
+    for ( unsigned int i = 0; i < owned && !found; i++ )
+    {
+        unsigned int turn = ( m_nextOwned[worker] + i ) % owned;
+        camera = first + turn * m_numWorkers;
+        if ( m_queues[camera].queued > 0 )
+        {
+            m_nextOwned[worker] = ( turn + 1 ) % owned;
+            found = true;
+        }
+    }
+    if ( !found )
+    {
+        for ( unsigned int i = 0; i < numQueues; i++ )
+        {
+            if ( m_queues[i].queued > m_queues[camera].queued )
+            {
+                camera = i;
+            }
+        }
+    }
+    Queue& queue = m_queues[camera];
+    if ( queue.queued == 0 )
+    {
+        return false;
+    }
+    *pJob = queue.ring[queue.head];
+    queue.head = ( queue.head + 1 ) % m_capacity;
+    queue.queued--;
+    m_queued--;
+    return true;
+}
+
+void FrameWriter::Write( Job& job, Image* pView, Image* pConverted )
+{
+    const Image* pImage = pView;
+    if ( job.pArena != NULL )
+    {
+        job.pArena->View( job.handle, pView );
+    }
+    else if ( job.pSpool != NULL )
+    {
+        if ( !job.pSpool->View( job.index, pView, NULL ) )
+        {
+            // never stored, so there is nothing to save or release
+            return;
+        }
+    }
+    else if ( job.pFrame != NULL )
+    {
+        pImage = &job.pFrame->image;
+    }
+    else
+    {
+        pImage = job.pImage;
+    }
+
+    unsigned long long startUs = HostTimeUs();
+    Error error = ConvertToRGB( *pImage, pConverted, m_demosaic );
+    unsigned long long convertUs = HostTimeUs() - startUs;
+    unsigned long long saveUs = 0;
+    unsigned long long bytes = 0;
+    if ( error == PGRERROR_OK )
+    {
+        startUs = HostTimeUs();
+        error = SaveFrame( pConverted, m_directory, job.camera, job.index, m_encoding, &bytes );
+        saveUs = HostTimeUs() - startUs;
+    }
+
+    // the slot is free again whether or not the frame made it to disk
+    if ( pImage == pView )
+    {
+        *pView = Image();
+    }
+    if ( job.pArena != NULL )
+    {
+        job.pArena->Release( &job.handle );
+    }
+    else if ( job.pSpool != NULL )
+    {
+        job.pSpool->Release( job.index );
+    }
+    else if ( job.pFrame != NULL )
+    {
+        job.pPool->Release( job.pFrame );
+    }
+    else
+    {
+        delete job.pImage;
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stats.convertUs += convertUs;
+    m_stats.saveUs += saveUs;
+    m_stats.bytes += bytes;
+    if ( convertUs > m_stats.maxConvertUs )
+    {
+        m_stats.maxConvertUs = convertUs;
+    }
+    if ( saveUs > m_stats.maxSaveUs )
+    {
+        m_stats.maxSaveUs = saveUs;
+    }
+    if ( error != PGRERROR_OK )
+    {
+        m_stats.errors++;
+        m_lastError = error;
+    }
+    else
+    {
+        m_stats.written++;
+        m_stats.cameraWritten[job.camera % m_queues.size()]++;
+    }
+}
+
+FrameWriterStats FrameWriter::Stats() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats;
+}
+
+Error FrameWriter::LastError() const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_lastError;
+}
+
+void FrameWriter::PrintStats() const
+{
+    FrameWriterStats stats = Stats();
+    unsigned long long frames = stats.written + stats.errors;
+    printf( "writer: %llu of %llu frames written by %u workers as %s, %llu failed, %.0f KB per frame\n",
+            stats.written, stats.submitted, m_numWorkers, m_encoding.Name().c_str(), stats.errors,
+            stats.written > 0 ? stats.bytes / 1024.0 / stats.written : 0.0 );
+    printf( "writer stages: convert %.1f ms per frame (max %.1f), encode and save %.1f ms per frame (max %.1f)\n",
+            frames > 0 ? stats.convertUs / 1000.0 / frames : 0.0, stats.maxConvertUs / 1000.0,
+            stats.written > 0 ? stats.saveUs / 1000.0 / stats.written : 0.0, stats.maxSaveUs / 1000.0 );
+    printf( "writer queue: %u of %u deep at most, scan blocked %llu times for %.1f ms (longest %.1f ms)\n",
+            stats.maxDepth, m_capacity, stats.blocked, stats.blockedUs / 1000.0, stats.maxBlockedUs / 1000.0 );
+    if ( m_queues.size() > 1 )
+    {
+        printf( "writer cameras:" );
+        for ( unsigned int i = 0; i < m_queues.size(); i++ )
+        {
+            printf( "%s %u: %llu written, queue %u deep at most", i > 0 ? ";" : "", i,
+                    stats.cameraWritten[i], stats.cameraMaxDepth[i] );
+        }
+        printf( "\n" );
+    }
+}
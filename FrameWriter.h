@@ -0,0 +1,190 @@
+/*****************************************************************
+  FRAME WRITER
+
+  Saves frames in the background while the scan is still running. The
+  scan loop submits frames into a bounded queue per camera; a pool of
+  writer threads converts each one to RGB and saves it as TIFF, then gives
+  its arena slot or pool frame back. Every worker converts into its own
+  output image, and file names only depend on camera and frame index, so
+  the result does not depend on which worker wrote what.
+
+  Worker k owns camera k's queue, and with fewer workers than cameras
+  also cameras k + workers, k + 2 * workers and so on, which it serves in
+  turn. Only when all of its own queues are empty does it help with the
+  deepest other one. So with a worker per camera each one stays on its
+  camera's frames (and NUMA node), every camera has a worker however
+  few there are, and a camera whose frames are slower to save does not
+  take the queue space of the others.
+
+  When a camera's queue is full, Submit() blocks until the writers catch
+  up, so memory stays bounded; how often and how long that happens is
+  counted. The queues are rings allocated up front, so submitting a frame
+  that lives in an arena, spool or pool does not touch the heap.
+
+  Frames are saved as uncompressed TIFF unless a FrameEncoding picks a
+  TIFF compression or PNG.
+
+*****************************************************************/
+
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include "FrameSpool.h"
+#include "FramePool.h"
+#include <sched.h>
+#include "Demosaic.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// How frames are written: TIFF with one of the SDK's compressions, or PNG
+// at a zlib level.
+struct FrameEncoding
+{
+    bool png;
+    FlyCapture2::TIFFOption::CompressionMethod tiffCompression;
+    unsigned int pngLevel;
+
+    FrameEncoding()
+        : png( false ), tiffCompression( FlyCapture2::TIFFOption::NONE ), pngLevel( 6 ) {}
+
+    // "none", "packbits", "deflate", "lzw", "png" or "png:<level>".
+    // Returns false for anything else.
+    bool Parse( const char* pName );
+    std::string Name() const;
+    const char* Extension() const { return png ? "png" : "tiff"; }
+};
+
+struct FrameWriterStats
+{
+    unsigned long long submitted;
+    unsigned long long written;
+    unsigned long long errors;           // frames that could not be converted or saved
+    unsigned int maxDepth;               // deepest any camera's queue got
+    unsigned long long blocked;          // submits that had to wait for room
+    unsigned long long blockedUs;        // total time producers spent waiting
+    unsigned long long maxBlockedUs;
+    unsigned long long convertUs;        // summed over all workers
+    unsigned long long maxConvertUs;
+    unsigned long long saveUs;
+    unsigned long long maxSaveUs;
+    unsigned long long bytes;            // size of the files written
+    std::vector<unsigned int> cameraMaxDepth;
+    std::vector<unsigned long long> cameraWritten;
+
+    FrameWriterStats()
+        : submitted( 0 ), written( 0 ), errors( 0 ), maxDepth( 0 ),
+          blocked( 0 ), blockedUs( 0 ), maxBlockedUs( 0 ),
+          convertUs( 0 ), maxConvertUs( 0 ), saveUs( 0 ), maxSaveUs( 0 ), bytes( 0 ) {}
+};
+
+class FrameWriter
+{
+public:
+    // Files go to directory/cam--<camera>-<index>.tiff (or .png). capacity
+    // is the number of frames queued at most per camera, numWorkers the
+    // number of threads converting and saving. Frames of cameras from
+    // numCameras on share the queues of the first ones.
+    FrameWriter( const std::string& directory, unsigned int capacity, unsigned int numWorkers = 1, unsigned int numCameras = 1 );
+    ~FrameWriter();
+
+    // Must be set before Start().
+    void SetEncoding( const FrameEncoding& encoding ) { m_encoding = encoding; }
+
+    // Must be set before Start(). The default converts with the SDK.
+    void SetDemosaic( const DemosaicSettings& settings ) { m_demosaic = settings; }
+
+    // Must be set before Start(). Worker k runs on cpus[k % cpus.size()];
+    // none, the default, lets them run anywhere, and so does an empty set.
+    // With one entry per camera, workers run next to the camera whose
+    // queue they look after.
+    void SetWorkerCpus( const std::vector<cpu_set_t>& cpus ) { m_workerCpus = cpus; }
+
+    // Saves an RGB image the way the writer does and returns the file size
+    // in pBytes.
+    static FlyCapture2::Error SaveFrame(
+        FlyCapture2::Image* pImage,
+        const std::string& directory,
+        unsigned int camera,
+        int index,
+        const FrameEncoding& encoding,
+        unsigned long long* pBytes );
+
+    void Start();
+
+    // Queues a frame living in an arena slot; the writer releases the slot
+    // once the frame is saved.
+    void Submit( unsigned int camera, int index, FrameArena* pArena, const FrameHandle& handle );
+
+    // Queues frame index of a spool; the writer releases it once saved.
+    // A frame that was never stored is skipped.
+    void Submit( unsigned int camera, int index, FrameSpool* pSpool );
+
+    // Queues a pool frame; the writer takes over the reference the caller
+    // held and releases it once the frame is saved.
+    void Submit( unsigned int camera, int index, FramePool* pPool, PooledFrame* pFrame );
+
+    // Queues a frame the writer keeps a reference to until it is saved.
+    void Submit( unsigned int camera, int index, const FlyCapture2::Image& image );
+
+    // Waits until everything queued is on disk and stops the writer.
+    void Finish();
+
+    FrameWriterStats Stats() const;
+    FlyCapture2::Error LastError() const;
+    void PrintStats() const;
+
+private:
+    FrameWriter( const FrameWriter& );
+    FrameWriter& operator=( const FrameWriter& );
+
+    struct Job
+    {
+        unsigned int camera;
+        int index;
+        FrameArena* pArena;
+        FrameHandle handle;
+        FrameSpool* pSpool;
+        FramePool* pPool;
+        PooledFrame* pFrame;
+        FlyCapture2::Image* pImage;     // owned, for frames submitted as an Image
+    };
+
+    // one camera's frames waiting to be written
+    struct Queue
+    {
+        std::vector<Job> ring;
+        unsigned int head;
+        unsigned int queued;
+    };
+
+    void Enqueue( const Job& job );
+    bool Dequeue( unsigned int worker, Job* pJob );
+    void WriteLoop( unsigned int worker );
+    void Write( Job& job, FlyCapture2::Image* pView, FlyCapture2::Image* pConverted );
+
+    std::string m_directory;
+    unsigned int m_capacity;
+    unsigned int m_numWorkers;
+    FrameEncoding m_encoding;
+    DemosaicSettings m_demosaic;
+    std::vector<cpu_set_t> m_workerCpus;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::vector<Queue> m_queues;
+    std::vector<unsigned int> m_nextOwned;  // per worker, which owned queue is next
+    unsigned int m_queued;               // over all queues
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+
+    FrameWriterStats m_stats;
+    FlyCapture2::Error m_lastError;
+};
+
+#endif // FRAME_WRITER_H
@@ -0,0 +1,82 @@
+/*****************************************************************
+  HEAP COUNTER
+
+  See HeapCounter.h.
+
+*****************************************************************/
+
+#include "HeapCounter.h"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    // plain data, so reading it from operator new never allocates itself
+    thread_local unsigned long long t_allocations = 0;
+    thread_local unsigned long long t_bytes = 0;
+
+    void* Allocate( std::size_t size )
+    {
+        t_allocations++;
+        t_bytes += size;
+        return malloc( size > 0 ? size : 1 );
+    }
+}
+
+HeapUsage ThreadHeapUsage()
+{
+    HeapUsage usage;
+    usage.allocations = t_allocations;
+    usage.bytes = t_bytes;
+    return usage;
+}
+
+void* operator new( std::size_t size )
+{
+    void* p = Allocate( size );
+    if ( p == NULL )
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[]( std::size_t size )
+{
+    void* p = Allocate( size );
+    if ( p == NULL )
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new( std::size_t size, const std::nothrow_t& ) noexcept
+{
+    return Allocate( size );
+}
+
+void* operator new[]( std::size_t size, const std::nothrow_t& ) noexcept
+{
+    return Allocate( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+    free( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+    free( p );
+}
+
+void operator delete( void* p, const std::nothrow_t& ) noexcept
+{
+    free( p );
+}
+
+void operator delete[]( void* p, const std::nothrow_t& ) noexcept
+{
+    free( p );
+}
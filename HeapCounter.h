@@ -0,0 +1,28 @@
+/*****************************************************************
+  HEAP COUNTER
+
+  Counts the heap allocations each thread makes through operator new,
+  so tests can show that a path does not allocate per frame once it is
+  running. Linking HeapCounter.o replaces the global operator new and
+  delete with versions that count and then call malloc and free; only
+  test programs link it, never the tool.
+
+  Allocations made with malloc directly are not counted.
+
+*****************************************************************/
+
+#ifndef HEAP_COUNTER_H
+#define HEAP_COUNTER_H
+
+struct HeapUsage
+{
+    unsigned long long allocations;
+    unsigned long long bytes;
+
+    HeapUsage() : allocations( 0 ), bytes( 0 ) {}
+};
+
+// Everything the calling thread allocated so far.
+HeapUsage ThreadHeapUsage();
+
+#endif // HEAP_COUNTER_H
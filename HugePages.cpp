@@ -0,0 +1,256 @@
+/*****************************************************************
+  HUGE PAGES
+
+  See HugePages.h.
+
+*****************************************************************/
+
+#include "HugePages.h"
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const size_t sk_hugePageSize = 2 * 1024 * 1024;
+
+    size_t AlignUp( size_t size, size_t alignment )
+    {
+        return ( size + alignment - 1 ) / alignment * alignment;
+    }
+
+    unsigned char* MapHugetlb( size_t size, size_t* pMapped )
+    {
+        size_t length = AlignUp( size, sk_hugePageSize );
+        void* p = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( p == MAP_FAILED )
+        {
+            return NULL;
+        }
+        *pMapped = length;
+        return (unsigned char*)p;
+    }
+
+    // transparent huge pages only back whole, 2 MB aligned stretches of a
+    // mapping, so map one page extra and trim to an aligned range
+    unsigned char* MapThp( size_t size, size_t* pMapped, bool* pAdvised )
+    {
+        size_t length = AlignUp( size, sk_hugePageSize );
+        void* p = mmap( NULL, length + sk_hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( p == MAP_FAILED )
+        {
+            return NULL;
+        }
+        uintptr_t start = (uintptr_t)p;
+        uintptr_t aligned = AlignUp( start, sk_hugePageSize );
+        if ( aligned > start )
+        {
+            munmap( p, aligned - start );
+        }
+        size_t tail = sk_hugePageSize - ( aligned - start );
+        if ( tail > 0 )
+        {
+            munmap( (void*)( aligned + length ), tail );
+        }
+        *pAdvised = madvise( (void*)aligned, length, MADV_HUGEPAGE ) == 0;
+        *pMapped = length;
+        return (unsigned char*)aligned;
+    }
+
+    int OpenTlbCounter( unsigned long long op )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.size = sizeof( attr );
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | ( op << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+    }
+
+    unsigned long long ReadCounter( int fd )
+    {
+        unsigned long long value = 0;
+        if ( fd < 0 || read( fd, &value, sizeof( value ) ) != sizeof( value ) )
+        {
+            return 0;
+        }
+        return value;
+    }
+}
+
+const char* PageModeName( PageMode mode )
+{
+    switch ( mode )
+    {
+    case PAGES_HUGETLB: return "hugetlb";
+    case PAGES_THP: return "thp";
+    case PAGES_NORMAL: return "4 KB";
+    default: return "auto";
+    }
+}
+
+bool ParsePageMode( const char* pName, PageMode* pMode )
+{
+    if ( !strcmp( pName, "auto" ) )
+    {
+        *pMode = PAGES_AUTO;
+    }
+    else if ( !strcmp( pName, "hugetlb" ) )
+    {
+        *pMode = PAGES_HUGETLB;
+    }
+    else if ( !strcmp( pName, "thp" ) )
+    {
+        *pMode = PAGES_THP;
+    }
+    else if ( !strcmp( pName, "off" ) )
+    {
+        *pMode = PAGES_NORMAL;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+unsigned char* MapFrameMemory( size_t size, PageMode mode, PageMode* pGot, size_t* pMapped )
+{
+    unsigned char* pBase = NULL;
+    if ( mode == PAGES_AUTO || mode == PAGES_HUGETLB )
+    {
+        pBase = MapHugetlb( size, pMapped );
+        if ( pBase != NULL )
+        {
+            *pGot = PAGES_HUGETLB;
+            return pBase;
+        }
+    }
+    if ( mode == PAGES_AUTO || mode == PAGES_THP )
+    {
+        bool advised = false;
+        pBase = MapThp( size, pMapped, &advised );
+        if ( pBase != NULL )
+        {
+            *pGot = advised ? PAGES_THP : PAGES_NORMAL;
+            return pBase;
+        }
+    }
+
+    void* p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( p == MAP_FAILED )
+    {
+        return NULL;
+    }
+    *pGot = PAGES_NORMAL;
+    *pMapped = size;
+    return (unsigned char*)p;
+}
+
+void UnmapFrameMemory( unsigned char* pBase, size_t mapped )
+{
+    if ( pBase != NULL )
+    {
+        munmap( pBase, mapped );
+    }
+}
+
+TlbMissCounter::TlbMissCounter()
+    : m_loadFd( -1 ),
+      m_storeFd( -1 ),
+      m_loads( 0 ),
+      m_stores( 0 )
+{
+}
+
+TlbMissCounter::~TlbMissCounter()
+{
+    Close();
+}
+
+void TlbMissCounter::Close()
+{
+    if ( m_loadFd >= 0 )
+    {
+        close( m_loadFd );
+        m_loadFd = -1;
+    }
+    if ( m_storeFd >= 0 )
+    {
+        close( m_storeFd );
+        m_storeFd = -1;
+    }
+}
+
+bool TlbMissCounter::Start()
+{
+    Close();
+    m_loads = 0;
+    m_stores = 0;
+
+    // not every CPU has both events; either may be missing
+    m_loadFd = OpenTlbCounter( PERF_COUNT_HW_CACHE_OP_READ );
+    m_storeFd = OpenTlbCounter( PERF_COUNT_HW_CACHE_OP_WRITE );
+    if ( m_loadFd >= 0 )
+    {
+        ioctl( m_loadFd, PERF_EVENT_IOC_RESET, 0 );
+        ioctl( m_loadFd, PERF_EVENT_IOC_ENABLE, 0 );
+    }
+    if ( m_storeFd >= 0 )
+    {
+        ioctl( m_storeFd, PERF_EVENT_IOC_RESET, 0 );
+        ioctl( m_storeFd, PERF_EVENT_IOC_ENABLE, 0 );
+    }
+    return m_loadFd >= 0 || m_storeFd >= 0;
+}
+
+void TlbMissCounter::Stop()
+{
+    // counts of threads started after Start() are added in when they exit
+    if ( m_loadFd >= 0 )
+    {
+        ioctl( m_loadFd, PERF_EVENT_IOC_DISABLE, 0 );
+        m_loads = ReadCounter( m_loadFd );
+    }
+    if ( m_storeFd >= 0 )
+    {
+        ioctl( m_storeFd, PERF_EVENT_IOC_DISABLE, 0 );
+        m_stores = ReadCounter( m_storeFd );
+    }
+}
+
+void TlbMissCounter::Print( const char* pLabel, unsigned long long numFrames ) const
+{
+    if ( !HasLoads() && !HasStores() )
+    {
+        printf( "%s: dTLB miss counters not available\n", pLabel );
+        return;
+    }
+    printf( "%s: dTLB misses", pLabel );
+    if ( HasLoads() )
+    {
+        printf( ", %llu loads", m_loads );
+        if ( numFrames > 0 )
+        {
+            printf( " (%.0f per frame)", (double)m_loads / numFrames );
+        }
+    }
+    if ( HasStores() )
+    {
+        printf( ", %llu stores", m_stores );
+        if ( numFrames > 0 )
+        {
+            printf( " (%.0f per frame)", (double)m_stores / numFrames );
+        }
+    }
+    printf( "\n" );
+}
@@ -0,0 +1,77 @@
+/*****************************************************************
+  HUGE PAGES
+
+  Memory for frame buffers on 2 MB pages instead of 4 KB ones. A frame of
+  the stereo cameras spans about 300 small pages, and every full-frame
+  pass (the driver's DMA, demosaicing, copying, saving) walks all of
+  them, so with small pages most of the time goes to TLB misses. Huge
+  pages come either from the hugetlbfs pool reserved by the administrator
+  (vm.nr_hugepages) or as transparent huge pages the kernel assembles in
+  an madvise'd region. When neither is there, normal pages are used.
+
+  TlbMissCounter reads the CPU's dTLB miss counters through perf events,
+  so the effect can be measured.
+
+*****************************************************************/
+
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <cstddef>
+
+enum PageMode
+{
+    PAGES_AUTO,         // hugetlbfs if reserved, else transparent, else normal
+    PAGES_HUGETLB,      // hugetlbfs pool only
+    PAGES_THP,          // transparent huge pages only
+    PAGES_NORMAL        // 4 KB pages
+};
+
+const char* PageModeName( PageMode mode );
+
+// "auto", "hugetlb", "thp" or "off".
+bool ParsePageMode( const char* pName, PageMode* pMode );
+
+// Maps at least size bytes of zeroed, readable and writable memory with
+// the pages mode asks for. A mode other than PAGES_AUTO that cannot be
+// had falls back to normal pages. pGot returns the kind of pages used,
+// pMapped the length to hand to UnmapFrameMemory(). Returns NULL if no
+// memory could be mapped at all.
+unsigned char* MapFrameMemory( size_t size, PageMode mode, PageMode* pGot, size_t* pMapped );
+void UnmapFrameMemory( unsigned char* pBase, size_t mapped );
+
+class TlbMissCounter
+{
+public:
+    TlbMissCounter();
+    ~TlbMissCounter();
+
+    // Starts counting the user space dTLB load and store misses of this
+    // process, including threads started after this call. Returns false
+    // if the CPU or the kernel does not let us count them.
+    bool Start();
+
+    // Stops counting; the counts are readable from here on.
+    void Stop();
+
+    bool HasLoads() const { return m_loadFd >= 0; }
+    bool HasStores() const { return m_storeFd >= 0; }
+    unsigned long long LoadMisses() const { return m_loads; }
+    unsigned long long StoreMisses() const { return m_stores; }
+
+    // One line starting with pLabel, per frame where numFrames > 0.
+    void Print( const char* pLabel, unsigned long long numFrames ) const;
+
+private:
+    TlbMissCounter( const TlbMissCounter& );
+    TlbMissCounter& operator=( const TlbMissCounter& );
+
+    void Close();
+
+    int m_loadFd;
+    int m_storeFd;
+    unsigned long long m_loads;
+    unsigned long long m_stores;
+};
+
+#endif // HUGE_PAGES_H
@@ -0,0 +1,114 @@
+/*****************************************************************
+  IMAGE MAT VIEW
+
+  See ImageMatView.h.
+
+*****************************************************************/
+
+#include "ImageMatView.h"
+
+using namespace FlyCapture2;
+
+namespace
+{
+    const int sk_noType = -1;
+}
+
+ImageMatView::ImageMatView()
+    : m_pArena( NULL ),
+      m_slot( FrameHandle::sk_invalidSlot ),
+      m_type( sk_noType )
+{
+}
+
+ImageMatView::ImageMatView( const FlyCapture2::Image& image )
+    : m_image( image ),
+      m_pArena( NULL ),
+      m_slot( FrameHandle::sk_invalidSlot ),
+      m_type( sk_noType )
+{
+    if ( m_image.GetData() == NULL || !MatType( m_image.GetPixelFormat(), &m_type ) )
+    {
+        m_type = sk_noType;
+    }
+}
+
+ImageMatView::ImageMatView( const FrameArena* pArena, const FrameHandle& handle )
+    : m_pArena( pArena ),
+      m_slot( handle.slot ),
+      m_type( sk_noType )
+{
+    if ( handle.IsValid() && pArena->IsClaimed( handle.slot ) )
+    {
+        pArena->View( handle, &m_image );
+        if ( m_image.GetData() == NULL || !MatType( m_image.GetPixelFormat(), &m_type ) )
+        {
+            m_type = sk_noType;
+        }
+    }
+}
+
+bool ImageMatView::IsValid() const
+{
+    if ( m_type == sk_noType )
+    {
+        return false;
+    }
+    return m_pArena == NULL || m_pArena->IsClaimed( m_slot );
+}
+
+cv::Mat ImageMatView::Mat() const
+{
+    if ( !IsValid() )
+    {
+        return cv::Mat();
+    }
+    return cv::Mat( (int)m_image.GetRows(), (int)m_image.GetCols(), m_type, m_image.GetData(), m_image.GetStride() );
+}
+
+int ImageMatView::BayerToBgrCode() const
+{
+    if ( m_type != CV_8UC1 && m_type != CV_16UC1 )
+    {
+        return -1;
+    }
+    // OpenCV names a Bayer layout by the second row's second and third
+    // pixels, which is the FlyCapture2 name read backwards
+    switch ( m_image.GetBayerTileFormat() )
+    {
+    case RGGB: return CV_BayerBG2BGR;
+    case GRBG: return CV_BayerGB2BGR;
+    case GBRG: return CV_BayerGR2BGR;
+    case BGGR: return CV_BayerRG2BGR;
+    default: return -1;
+    }
+}
+
+bool ImageMatView::MatType( PixelFormat format, int* pType )
+{
+    switch ( format )
+    {
+    case PIXEL_FORMAT_MONO8:
+    case PIXEL_FORMAT_RAW8:
+        *pType = CV_8UC1;
+        return true;
+    case PIXEL_FORMAT_MONO16:
+    case PIXEL_FORMAT_RAW16:
+        *pType = CV_16UC1;
+        return true;
+    case PIXEL_FORMAT_RGB8:
+    case PIXEL_FORMAT_BGR:
+        *pType = CV_8UC3;
+        return true;
+    case PIXEL_FORMAT_RGBU:
+    case PIXEL_FORMAT_BGRU:
+        *pType = CV_8UC4;
+        return true;
+    case PIXEL_FORMAT_RGB16:
+    case PIXEL_FORMAT_BGR16:
+        *pType = CV_16UC3;
+        return true;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,70 @@
+/*****************************************************************
+  IMAGE MAT VIEW
+
+  A cv::Mat header over the pixels of a FlyCapture2::Image or of a
+  FrameArena slot, so OpenCV can work on a frame in memory without
+  Convert, Save and imread, and without copying it.
+
+  The Mat borrows the memory: OpenCV does not reference count it, so it
+  is only good while the view is. The view keeps the buffer alive as far
+  as it can:
+
+  - made from an Image, it holds a copy of the Image, which shares (and
+    keeps a reference to) the SDK's buffer. An Image that only wraps
+    memory it does not own, like FrameArena::View() or
+    RawRecordingReader::View(), still depends on that memory's owner.
+  - made from a FrameArena slot, the caller keeps the handle claimed until
+    the view is gone. Mat() returns an empty Mat once the slot has been
+    released, rather than pixels the driver may be overwriting (the check
+    cannot tell if the slot has since been claimed for another frame).
+
+  Use Mat().clone() for anything that has to outlive the view.
+
+  Only formats with a whole number of bytes per pixel have a Mat type:
+  MONO8/RAW8 (CV_8UC1), MONO16/RAW16 (CV_16UC1), RGB8/BGR (CV_8UC3),
+  RGBU/BGRU (CV_8UC4) and RGB16/BGR16 (CV_16UC3). Note that OpenCV takes
+  3 channels as BGR; an RGB frame shows with red and blue swapped.
+
+*****************************************************************/
+
+#ifndef IMAGE_MAT_VIEW_H
+#define IMAGE_MAT_VIEW_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include <opencv2/opencv.hpp>
+
+class ImageMatView
+{
+public:
+    ImageMatView();
+
+    // Views image's buffer. Check IsValid() for unsupported formats.
+    explicit ImageMatView( const FlyCapture2::Image& image );
+
+    // Views the slot of handle. pArena and the claim on the slot must
+    // outlive the view.
+    ImageMatView( const FrameArena* pArena, const FrameHandle& handle );
+
+    bool IsValid() const;
+
+    // The Mat header over the frame, or an empty Mat.
+    cv::Mat Mat() const;
+
+    // The cv::cvtColor code turning a raw Bayer view into BGR, or -1 if
+    // the frame is not Bayer.
+    int BayerToBgrCode() const;
+
+    const FlyCapture2::Image& Source() const { return m_image; }
+
+    // The Mat type of a pixel format; false if it has none.
+    static bool MatType( FlyCapture2::PixelFormat format, int* pType );
+
+private:
+    FlyCapture2::Image m_image;
+    const FrameArena* m_pArena;
+    unsigned int m_slot;
+    int m_type;
+};
+
+#endif // IMAGE_MAT_VIEW_H
@@ -0,0 +1,179 @@
+/*****************************************************************
+  LATENCY CALIBRATOR
+
+  See LatencyCalibrator.h.
+
+*****************************************************************/
+
+#include "LatencyCalibrator.h"
+#include "CameraUtils.h"
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // long enough for any projector to have settled on a reference pattern
+    const unsigned long long sk_referenceSettleUs = 500000;
+    const unsigned int sk_referenceFrames = 5;
+    const int sk_toggleTimeoutMs = 1000;
+    const double sk_minContrast = 20.0;
+}
+
+LatencyCalibrator::LatencyCalibrator( PatternDisplay* pDisplay, CaptureEngine* pEngine, FrameArena* pArenas )
+    : m_pDisplay( pDisplay ),
+      m_pEngine( pEngine ),
+      m_pArenas( pArenas ),
+      m_group( pEngine->NumCameras() ),
+      m_ppTriggerCameras( NULL ),
+      m_numTriggerCameras( 0 ),
+      m_triggerTimeoutMs( 0 )
+{
+}
+
+void LatencyCalibrator::SetSoftwareTrigger( CameraBase** ppCameras, unsigned int numCameras, int timeoutMs )
+{
+    m_ppTriggerCameras = ppCameras;
+    m_numTriggerCameras = numCameras;
+    m_triggerTimeoutMs = timeoutMs;
+}
+
+double LatencyCalibrator::MeanLevel( const FrameHandle& frame ) const
+{
+    // a sparse grid of samples is plenty for a full field pattern
+    const FrameArena& arena = m_pArenas[frame.camera];
+    const unsigned char* pData = arena.SlotData( frame.slot );
+    unsigned int size = frame.receivedSize > 0 && frame.receivedSize <= arena.SlotSize() ? frame.receivedSize : arena.SlotSize();
+    unsigned long long sum = 0;
+    unsigned int count = 0;
+    for ( unsigned int offset = size / 2 % 4099; offset < size; offset += 4099 )
+    {
+        sum += pData[offset];
+        count++;
+    }
+    return count > 0 ? (double)sum / count : 0.0;
+}
+
+bool LatencyCalibrator::NextFrame( unsigned long long notBeforeUs, int timeoutMs, double* pLevel, unsigned long long* pArrivalUs )
+{
+    if ( m_numTriggerCameras > 0 )
+    {
+        // a frame triggered earlier would only be thrown away as too old
+        unsigned long long nowUs = HostTimeUs();
+        if ( nowUs < notBeforeUs )
+        {
+            std::this_thread::sleep_for( std::chrono::microseconds( notBeforeUs - nowUs ) );
+        }
+        for ( unsigned int i = 0; i < m_numTriggerCameras; i++ )
+        {
+            WaitForTriggerReady( m_ppTriggerCameras[i], m_triggerTimeoutMs );
+        }
+        FireSoftwareTrigger( m_numTriggerCameras, m_ppTriggerCameras );
+    }
+    if ( m_group.empty() || !m_pEngine->NextGroup( &m_group[0], notBeforeUs, timeoutMs ) )
+    {
+        return false;
+    }
+
+    *pLevel = MeanLevel( m_group[0] );
+    *pArrivalUs = m_group[0].hostTimeUs;
+    for ( unsigned int i = 0; i < m_group.size(); i++ )
+    {
+        m_pArenas[i].Release( &m_group[i] );
+    }
+    return true;
+}
+
+bool LatencyCalibrator::ReferenceLevel( const cv::Mat& pattern, double* pLevel )
+{
+    unsigned long long shownUs = HostTimeUs();
+    m_pDisplay->Show( pattern );
+
+    double sum = 0.0;
+    unsigned int count = 0;
+    unsigned long long arrivalUs;
+    double level;
+    while ( count < sk_referenceFrames )
+    {
+        if ( !NextFrame( shownUs + sk_referenceSettleUs, sk_toggleTimeoutMs + sk_referenceSettleUs / 1000, &level, &arrivalUs ) )
+        {
+            return false;
+        }
+        sum += level;
+        count++;
+    }
+    *pLevel = sum / count;
+    return true;
+}
+
+bool LatencyCalibrator::Measure( unsigned int numToggles, LatencyResult* pResult )
+{
+    pResult->samples = 0;
+    pResult->missed = 0;
+    pResult->minUs = 0;
+    pResult->medianUs = 0;
+    pResult->p99Us = 0;
+
+    cv::Mat black( 1200, 1600, CV_8UC3 );
+    cv::Mat white( 1200, 1600, CV_8UC3 );
+    black = cv::Scalar( 0, 0, 0 );
+    white = cv::Scalar( 255, 255, 255 );
+
+    double dark, bright;
+    if ( !ReferenceLevel( black, &dark ) || !ReferenceLevel( white, &bright ) || bright - dark < sk_minContrast )
+    {
+        return false;
+    }
+    double midpoint = ( dark + bright ) / 2.0;
+
+    std::vector<unsigned long long> samples;
+    bool lit = true;
+    for ( unsigned int i = 0; i < numToggles; i++ )
+    {
+        lit = !lit;
+        unsigned long long shownUs = HostTimeUs();
+        m_pDisplay->Show( lit ? white : black );
+
+        bool seen = false;
+        double level;
+        unsigned long long arrivalUs;
+        while ( !seen && HostTimeUs() - shownUs < sk_toggleTimeoutMs * 1000ULL &&
+                NextFrame( shownUs, sk_toggleTimeoutMs, &level, &arrivalUs ) )
+        {
+            if ( ( level > midpoint ) == lit )
+            {
+                samples.push_back( arrivalUs - shownUs );
+                seen = true;
+            }
+        }
+        if ( !seen )
+        {
+            pResult->missed++;
+        }
+
+        // let the change settle, and shift the next toggle against the
+        // display refresh and the camera frame clock
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 + ( i * 7 ) % 13 ) );
+    }
+
+    if ( samples.empty() )
+    {
+        return false;
+    }
+    std::sort( samples.begin(), samples.end() );
+    size_t n = samples.size();
+    pResult->samples = (unsigned int)n;
+    pResult->minUs = samples[0];
+    pResult->medianUs = samples[n / 2];
+    pResult->p99Us = samples[( n * 99 + 99 ) / 100 - 1];
+    return true;
+}
+
+void LatencyCalibrator::PrintResult( const LatencyResult& result )
+{
+    printf( "display to camera latency over %u toggles (%u missed): min %.1f ms, median %.1f ms, p99 %.1f ms\n",
+            result.samples, result.missed, result.minUs / 1000.0, result.medianUs / 1000.0, result.p99Us / 1000.0 );
+}
@@ -0,0 +1,65 @@
+/*****************************************************************
+  LATENCY CALIBRATOR
+
+  Measures how long it takes from PatternDisplay::Show() until a camera
+  frame that shows the new pattern arrives. The display is toggled between
+  black and white many times; for each toggle the first frame whose
+  brightness crosses the midpoint between the dark and bright reference
+  levels is taken as the arrival of the change.
+
+  The scan loop uses the result as its settle time: only frames arriving
+  at least that long after a slit was shown are used.
+
+*****************************************************************/
+
+#ifndef LATENCY_CALIBRATOR_H
+#define LATENCY_CALIBRATOR_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include "CaptureEngine.h"
+#include "PatternDisplay.h"
+#include <vector>
+
+struct LatencyResult
+{
+    unsigned int samples;       // toggles that were seen by the camera
+    unsigned int missed;        // toggles that never showed up
+    unsigned long long minUs;
+    unsigned long long medianUs;
+    unsigned long long p99Us;
+};
+
+class LatencyCalibrator
+{
+public:
+    // Frames come from the running engine; camera 0 is watched. pArenas
+    // are the arenas the engine claims into.
+    LatencyCalibrator( PatternDisplay* pDisplay, CaptureEngine* pEngine, FrameArena* pArenas );
+
+    // With software triggered cameras the calibrator has to trigger every
+    // frame it looks at.
+    void SetSoftwareTrigger( FlyCapture2::CameraBase** ppCameras, unsigned int numCameras, int timeoutMs );
+
+    // Runs numToggles black/white toggles. Returns false if the camera
+    // does not see the display at all.
+    bool Measure( unsigned int numToggles, LatencyResult* pResult );
+
+    static void PrintResult( const LatencyResult& result );
+
+private:
+    bool NextFrame( unsigned long long notBeforeUs, int timeoutMs, double* pLevel, unsigned long long* pArrivalUs );
+    bool ReferenceLevel( const cv::Mat& pattern, double* pLevel );
+    double MeanLevel( const FrameHandle& frame ) const;
+
+    PatternDisplay* m_pDisplay;
+    CaptureEngine* m_pEngine;
+    FrameArena* m_pArenas;
+    std::vector<FrameHandle> m_group;
+
+    FlyCapture2::CameraBase** m_ppTriggerCameras;
+    unsigned int m_numTriggerCameras;
+    int m_triggerTimeoutMs;
+};
+
+#endif // LATENCY_CALIBRATOR_H
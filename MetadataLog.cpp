@@ -0,0 +1,583 @@
+/*****************************************************************
+  METADATA LOG
+
+  See MetadataLog.h.
+
+*****************************************************************/
+
+#include "MetadataLog.h"
+#include "CameraUtils.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    const char sk_magic[8] = { 'F', 'C', '2', 'M', 'E', 'T', 'A', 0 };
+    const unsigned int sk_version = 1;
+    const unsigned int sk_headerSize = 4096;
+    const unsigned int sk_blockMagic = 0x4B4C4246;      // "FBLK"
+    const unsigned int sk_blockHeaderSize = 64;
+    const unsigned int sk_flushIntervalMs = 10;
+
+    struct BlockHeader
+    {
+        unsigned int magic;
+        unsigned int rows;
+        unsigned long long firstRow;
+    };
+
+    struct Field
+    {
+        const char* pName;
+        unsigned int size;
+        unsigned int offset;
+        bool isSigned;
+    };
+
+#define METADATA_FIELD( name, isSigned ) { #name, sizeof( ( (MetadataRow*)0 )->name ), offsetof( MetadataRow, name ), isSigned }
+    const Field sk_fields[] =
+    {
+        METADATA_FIELD( camera, false ),
+        METADATA_FIELD( event, false ),
+        METADATA_FIELD( slit, true ),
+        METADATA_FIELD( status, true ),
+        METADATA_FIELD( sequence, false ),
+        METADATA_FIELD( hostTimeUs, false ),
+        METADATA_FIELD( timeStampSeconds, false ),
+        METADATA_FIELD( timeStampMicroSeconds, false ),
+        METADATA_FIELD( cycleSeconds, false ),
+        METADATA_FIELD( cycleCount, false ),
+        METADATA_FIELD( cycleOffset, false ),
+        METADATA_FIELD( embeddedTimeStamp, false ),
+        METADATA_FIELD( embeddedGain, false ),
+        METADATA_FIELD( embeddedShutter, false ),
+        METADATA_FIELD( embeddedBrightness, false ),
+        METADATA_FIELD( embeddedExposure, false ),
+        METADATA_FIELD( embeddedWhiteBalance, false ),
+        METADATA_FIELD( embeddedFrameCounter, false ),
+        METADATA_FIELD( embeddedStrobePattern, false ),
+        METADATA_FIELD( embeddedGPIOPinState, false ),
+        METADATA_FIELD( embeddedROIPosition, false ),
+        METADATA_FIELD( receivedSize, false ),
+        METADATA_FIELD( imageDropped, false ),
+        METADATA_FIELD( imageCorrupt, false ),
+        METADATA_FIELD( imageXmitFailed, false ),
+        METADATA_FIELD( imageDriverDropped, false ),
+        METADATA_FIELD( temperature, false ),
+    };
+#undef METADATA_FIELD
+    const unsigned int sk_numFields = sizeof( sk_fields ) / sizeof( sk_fields[0] );
+
+    bool WriteAll( int fd, const unsigned char* pData, size_t size, unsigned long long offset )
+    {
+        while ( size > 0 )
+        {
+            ssize_t written = pwrite( fd, pData, size, (off_t)offset );
+            if ( written <= 0 )
+            {
+                return false;
+            }
+            pData += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+}
+
+MetadataRow MakeMetadataRow( MetadataEvent event, const FrameHandle& handle, int slit, int status )
+{
+    MetadataRow row;
+    memset( &row, 0, sizeof( row ) );
+    row.camera = handle.camera;
+    row.event = event;
+    row.slit = slit;
+    row.status = status;
+    row.sequence = handle.sequence;
+    row.hostTimeUs = handle.hostTimeUs;
+    row.receivedSize = handle.receivedSize;
+    row.timeStampSeconds = handle.timeStamp.seconds;
+    row.timeStampMicroSeconds = handle.timeStamp.microSeconds;
+    row.cycleSeconds = handle.timeStamp.cycleSeconds;
+    row.cycleCount = handle.timeStamp.cycleCount;
+    row.cycleOffset = handle.timeStamp.cycleOffset;
+    row.embeddedTimeStamp = handle.metadata.embeddedTimeStamp;
+    row.embeddedGain = handle.metadata.embeddedGain;
+    row.embeddedShutter = handle.metadata.embeddedShutter;
+    row.embeddedBrightness = handle.metadata.embeddedBrightness;
+    row.embeddedExposure = handle.metadata.embeddedExposure;
+    row.embeddedWhiteBalance = handle.metadata.embeddedWhiteBalance;
+    row.embeddedFrameCounter = handle.metadata.embeddedFrameCounter;
+    row.embeddedStrobePattern = handle.metadata.embeddedStrobePattern;
+    row.embeddedGPIOPinState = handle.metadata.embeddedGPIOPinState;
+    row.embeddedROIPosition = handle.metadata.embeddedROIPosition;
+    return row;
+}
+
+MetadataRow MakeMetadataRow( MetadataEvent event, unsigned int camera, const Image& image, int slit )
+{
+    FrameHandle handle;
+    handle.camera = camera;
+    handle.receivedSize = image.GetReceivedDataSize();
+    handle.hostTimeUs = HostTimeUs();
+    handle.timeStamp = image.GetTimeStamp();
+    handle.metadata = image.GetMetadata();
+    return MakeMetadataRow( event, handle, slit );
+}
+
+MetadataRow MakeGrabFailedRow( unsigned int camera, ErrorType type )
+{
+    MetadataRow row;
+    memset( &row, 0, sizeof( row ) );
+    row.camera = camera;
+    row.event = META_GRAB_FAILED;
+    row.slit = -1;
+    row.status = type;
+    row.hostTimeUs = HostTimeUs();
+    return row;
+}
+
+MetadataRow MakeCameraStatsRow( unsigned int camera, const CameraStats& stats )
+{
+    MetadataRow row;
+    memset( &row, 0, sizeof( row ) );
+    row.camera = camera;
+    row.event = META_CAMERA_STATS;
+    row.slit = -1;
+    row.hostTimeUs = HostTimeUs();
+    row.imageDropped = stats.imageDropped;
+    row.imageCorrupt = stats.imageCorrupt;
+    row.imageXmitFailed = stats.imageXmitFailed;
+    row.imageDriverDropped = stats.imageDriverDropped;
+    row.temperature = stats.temperature;
+    return row;
+}
+
+const char* MetadataEventName( unsigned int event )
+{
+    switch ( event )
+    {
+    case META_FRAME_ARRIVED: return "arrived";
+    case META_FRAME_USED: return "used";
+    case META_FRAME_DROPPED: return "dropped";
+    case META_GRAB_FAILED: return "grab-failed";
+    case META_CAMERA_STATS: return "camera-stats";
+    default: return "unknown";
+    }
+}
+
+MetadataLog::MetadataLog()
+    : m_fd( -1 ),
+      m_next( 0 ),
+      m_lost( 0 ),
+      m_accepting( false ),
+      m_appending( 0 ),
+      m_written( 0 ),
+      m_failed( false ),
+      m_stopping( false )
+{
+    memset( &m_header, 0, sizeof( m_header ) );
+    for ( unsigned int i = 0; i < sk_numSlots; i++ )
+    {
+        m_slots[i].block = 0;
+        m_slots[i].filled = 0;
+        m_slots[i].pData = NULL;
+    }
+}
+
+MetadataLog::~MetadataLog()
+{
+    Close();
+}
+
+Error MetadataLog::Open( const std::string& path )
+{
+    Close();
+
+    // each column holds sk_blockRows values back to back; with 4096 rows
+    // every array stays 8 byte aligned
+    m_columns.clear();
+    m_rowOffsets.clear();
+    unsigned long long offset = sk_blockHeaderSize;
+    for ( unsigned int i = 0; i < sk_numFields; i++ )
+    {
+        MetadataColumn column;
+        memset( &column, 0, sizeof( column ) );
+        strncpy( column.name, sk_fields[i].pName, sizeof( column.name ) - 1 );
+        column.size = sk_fields[i].size;
+        column.offset = (unsigned int)offset;
+        m_columns.push_back( column );
+        m_rowOffsets.push_back( sk_fields[i].offset );
+        offset += (unsigned long long)column.size * sk_blockRows;
+    }
+
+    memcpy( m_header.magic, sk_magic, sizeof( sk_magic ) );
+    m_header.version = sk_version;
+    m_header.headerSize = sk_headerSize;
+    m_header.blockRows = sk_blockRows;
+    m_header.numColumns = sk_numFields;
+    m_header.blockSize = ( offset + 4095 ) / 4096 * 4096;
+    m_header.createdUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    unsigned char header[sk_headerSize];
+    memset( header, 0, sizeof( header ) );
+    memcpy( header, &m_header, sizeof( m_header ) );
+    memcpy( header + sizeof( m_header ), &m_columns[0], m_columns.size() * sizeof( MetadataColumn ) );
+
+    m_fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if ( m_fd < 0 )
+    {
+        return FailureError();
+    }
+    if ( !WriteAll( m_fd, header, sizeof( header ), 0 ) )
+    {
+        close( m_fd );
+        m_fd = -1;
+        return FailureError();
+    }
+
+    for ( unsigned int i = 0; i < sk_numSlots; i++ )
+    {
+        m_slots[i].pData = new unsigned char[m_header.blockSize]();
+        m_slots[i].filled = 0;
+        m_slots[i].block.store( i, std::memory_order_release );
+    }
+    m_next = 0;
+    m_lost = 0;
+    m_written = 0;
+    m_failed = false;
+    m_stopping = false;
+    m_accepting = true;
+    m_thread = std::thread( &MetadataLog::FlushLoop, this );
+    return Error();
+}
+
+bool MetadataLog::Append( const MetadataRow& row )
+{
+    // Close() waits for m_appending to drain after it stops accepting, so a
+    // row claimed here is always written
+    m_appending.fetch_add( 1 );
+    if ( !m_accepting.load() )
+    {
+        m_appending.fetch_sub( 1 );
+        return false;
+    }
+
+    // a row may only be claimed once its block has a slot; the check and
+    // the claim are tied together by the compare-exchange on m_next
+    unsigned long long next = m_next.load( std::memory_order_relaxed );
+    Slot* pSlot;
+    for (;;)
+    {
+        unsigned long long block = next / sk_blockRows;
+        pSlot = &m_slots[block % sk_numSlots];
+        if ( pSlot->block.load( std::memory_order_acquire ) != block )
+        {
+            m_lost++;
+            m_appending.fetch_sub( 1 );
+            return false;
+        }
+        if ( m_next.compare_exchange_weak( next, next + 1, std::memory_order_relaxed ) )
+        {
+            break;
+        }
+    }
+
+    unsigned int index = (unsigned int)( next % sk_blockRows );
+    const unsigned char* pRow = reinterpret_cast<const unsigned char*>( &row );
+    for ( unsigned int c = 0; c < m_columns.size(); c++ )
+    {
+        unsigned int size = m_columns[c].size;
+        memcpy( pSlot->pData + m_columns[c].offset + (size_t)index * size, pRow + m_rowOffsets[c], size );
+    }
+    pSlot->filled.fetch_add( 1, std::memory_order_release );
+    m_appending.fetch_sub( 1 );
+    return true;
+}
+
+bool MetadataLog::WriteBlock( unsigned long long block, unsigned int rows )
+{
+    unsigned char* pData = m_slots[block % sk_numSlots].pData;
+    BlockHeader header;
+    memset( &header, 0, sizeof( header ) );
+    header.magic = sk_blockMagic;
+    header.rows = rows;
+    header.firstRow = block * sk_blockRows;
+    memcpy( pData, &header, sizeof( header ) );
+    return WriteAll( m_fd, pData, m_header.blockSize, sk_headerSize + block * m_header.blockSize );
+}
+
+void MetadataLog::FlushLoop()
+{
+    for (;;)
+    {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_wake.wait_for( lock, std::chrono::milliseconds( sk_flushIntervalMs ), [this] { return m_stopping; } );
+            stopping = m_stopping;
+        }
+
+        // full blocks go out in order; the slot then moves on to the block
+        // sk_numSlots further on
+        for (;;)
+        {
+            Slot& slot = m_slots[m_written % sk_numSlots];
+            if ( slot.filled.load( std::memory_order_acquire ) < sk_blockRows )
+            {
+                break;
+            }
+            if ( !WriteBlock( m_written, sk_blockRows ) )
+            {
+                m_failed = true;
+            }
+            slot.filled.store( 0, std::memory_order_relaxed );
+            slot.block.store( m_written + sk_numSlots, std::memory_order_release );
+            m_written++;
+        }
+
+        if ( stopping )
+        {
+            return;
+        }
+    }
+}
+
+Error MetadataLog::Close()
+{
+    if ( m_fd < 0 )
+    {
+        return Error();
+    }
+
+    m_accepting = false;
+    while ( m_appending.load() != 0 )
+    {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+
+    // everything before block m_written is on disk, and every row claimed
+    // has been filled in, so what is left is one partial block
+    unsigned int rows = (unsigned int)( m_next.load() - m_written * sk_blockRows );
+    if ( rows > 0 && !WriteBlock( m_written, rows ) )
+    {
+        m_failed = true;
+    }
+
+    close( m_fd );
+    m_fd = -1;
+    for ( unsigned int i = 0; i < sk_numSlots; i++ )
+    {
+        delete[] m_slots[i].pData;
+        m_slots[i].pData = NULL;
+    }
+    return m_failed ? FailureError() : Error();
+}
+
+MetadataLogReader::MetadataLogReader()
+    : m_pBase( NULL ),
+      m_mappedSize( 0 ),
+      m_numBlocks( 0 ),
+      m_numRows( 0 )
+{
+    memset( &m_header, 0, sizeof( m_header ) );
+}
+
+MetadataLogReader::~MetadataLogReader()
+{
+    Close();
+}
+
+void MetadataLogReader::Close()
+{
+    if ( m_pBase != NULL )
+    {
+        munmap( m_pBase, m_mappedSize );
+        m_pBase = NULL;
+    }
+    m_mappedSize = 0;
+    m_columns.clear();
+    m_rowOffsets.clear();
+    m_numBlocks = 0;
+    m_numRows = 0;
+}
+
+Error MetadataLogReader::Open( const std::string& path )
+{
+    Close();
+
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        return FailureError();
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || st.st_size < (off_t)sk_headerSize )
+    {
+        close( fd );
+        return FailureError();
+    }
+    void* pMapped = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( pMapped == MAP_FAILED )
+    {
+        return FailureError();
+    }
+    m_pBase = static_cast<unsigned char*>( pMapped );
+    m_mappedSize = st.st_size;
+
+    memcpy( &m_header, m_pBase, sizeof( m_header ) );
+    unsigned long long columnsEnd = sizeof( m_header ) + (unsigned long long)m_header.numColumns * sizeof( MetadataColumn );
+    if ( memcmp( m_header.magic, sk_magic, sizeof( sk_magic ) ) != 0 || m_header.version != sk_version ||
+         m_header.blockRows == 0 || m_header.blockSize < sk_blockHeaderSize ||
+         m_header.headerSize < columnsEnd || m_header.headerSize > m_mappedSize )
+    {
+        Close();
+        return FailureError();
+    }
+    m_columns.resize( m_header.numColumns );
+    if ( m_header.numColumns > 0 )
+    {
+        memcpy( &m_columns[0], m_pBase + sizeof( m_header ), m_header.numColumns * sizeof( MetadataColumn ) );
+    }
+
+    // every column's values must lie inside the block, after its header
+    for ( unsigned int i = 0; i < m_columns.size(); i++ )
+    {
+        unsigned long long columnEnd = m_columns[i].offset + (unsigned long long)m_columns[i].size * m_header.blockRows;
+        if ( m_columns[i].offset < sk_blockHeaderSize || columnEnd > m_header.blockSize )
+        {
+            Close();
+            return FailureError();
+        }
+    }
+
+    // columns are matched by name, so a log with fewer or more of them
+    // still reads; missing ones come back as 0
+    for ( unsigned int i = 0; i < sk_numFields; i++ )
+    {
+        int column = FindColumn( sk_fields[i].pName );
+        m_rowOffsets.push_back( column >= 0 && m_columns[column].size == sk_fields[i].size ? column : -1 );
+    }
+
+    // only the last block can be partial; a torn one ends the log
+    unsigned long long numBlocks = ( m_mappedSize - m_header.headerSize ) / m_header.blockSize;
+    for ( unsigned long long b = 0; b < numBlocks; b++ )
+    {
+        const BlockHeader* pBlock = reinterpret_cast<const BlockHeader*>( m_pBase + m_header.headerSize + b * m_header.blockSize );
+        if ( pBlock->magic != sk_blockMagic || pBlock->rows == 0 || pBlock->rows > m_header.blockRows )
+        {
+            break;
+        }
+        m_numBlocks++;
+        m_numRows += pBlock->rows;
+        if ( pBlock->rows < m_header.blockRows )
+        {
+            break;
+        }
+    }
+    return Error();
+}
+
+unsigned int MetadataLogReader::BlockRows( unsigned long long block ) const
+{
+    const BlockHeader* pBlock = reinterpret_cast<const BlockHeader*>( m_pBase + m_header.headerSize + block * m_header.blockSize );
+    return pBlock->rows;
+}
+
+int MetadataLogReader::FindColumn( const char* pName ) const
+{
+    for ( unsigned int i = 0; i < m_columns.size(); i++ )
+    {
+        if ( strncmp( m_columns[i].name, pName, sizeof( m_columns[i].name ) ) == 0 )
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+const void* MetadataLogReader::Column( unsigned long long block, unsigned int column ) const
+{
+    return m_pBase + m_header.headerSize + block * m_header.blockSize + m_columns[column].offset;
+}
+
+void MetadataLogReader::Row( unsigned long long i, MetadataRow* pRow ) const
+{
+    memset( pRow, 0, sizeof( *pRow ) );
+    unsigned long long block = i / m_header.blockRows;
+    unsigned int index = (unsigned int)( i % m_header.blockRows );
+    unsigned char* pOut = reinterpret_cast<unsigned char*>( pRow );
+    for ( unsigned int f = 0; f < sk_numFields; f++ )
+    {
+        if ( m_rowOffsets[f] >= 0 )
+        {
+            const unsigned char* pColumn = static_cast<const unsigned char*>( Column( block, m_rowOffsets[f] ) );
+            memcpy( pOut + sk_fields[f].offset, pColumn + (size_t)index * sk_fields[f].size, sk_fields[f].size );
+        }
+    }
+}
+
+Error DumpMetadataLog( const std::string& path )
+{
+    MetadataLogReader reader;
+    Error error = reader.Open( path );
+    if ( error != PGRERROR_OK )
+    {
+        return error;
+    }
+
+    for ( unsigned int f = 0; f < sk_numFields; f++ )
+    {
+        printf( f == 0 ? "%s" : ",%s", sk_fields[f].pName );
+    }
+    printf( "\n" );
+
+    for ( unsigned long long i = 0; i < reader.NumRows(); i++ )
+    {
+        MetadataRow row;
+        reader.Row( i, &row );
+        const unsigned char* pRow = reinterpret_cast<const unsigned char*>( &row );
+        for ( unsigned int f = 0; f < sk_numFields; f++ )
+        {
+            const void* pValue = pRow + sk_fields[f].offset;
+            if ( f > 0 )
+            {
+                printf( "," );
+            }
+            if ( pValue == &row.event )
+            {
+                printf( "%s", MetadataEventName( row.event ) );
+            }
+            else if ( sk_fields[f].size == 8 )
+            {
+                printf( "%llu", *static_cast<const unsigned long long*>( pValue ) );
+            }
+            else if ( sk_fields[f].isSigned )
+            {
+                printf( "%d", *static_cast<const int*>( pValue ) );
+            }
+            else
+            {
+                printf( "%u", *static_cast<const unsigned int*>( pValue ) );
+            }
+        }
+        printf( "\n" );
+    }
+    return Error();
+}
@@ -0,0 +1,213 @@
+/*****************************************************************
+  METADATA LOG
+
+  One binary log per session with a row for everything that happened to
+  a frame: when it arrived, which slit step used it, which ones were
+  dropped or failed, plus the cameras' CameraStats counters at the start
+  and end of the scan. It is kept whether images are saved as TIFF, PNG or
+  raw recordings, so timing survives every scan.
+
+  The log is columnar. Rows are collected in blocks of sk_blockRows; in a
+  block each field is stored as one contiguous array, so a reader that
+  wants, say, every hostTimeUs maps the file and walks one array per
+  block:
+
+      [header + column table][block 0][block 1]...
+
+  Blocks have a fixed size and are only ever appended; the last one may
+  be partly filled. After a crash everything up to the last full block
+  written is still readable.
+
+  Append() is lock free and may be called from any number of threads,
+  e.g. the grab threads and the SDK's callback thread. It copies the row
+  into a block in memory; a background thread writes full blocks out. If
+  that thread is so far behind that every block is still waiting, the row
+  is counted as lost instead of blocking the caller.
+
+*****************************************************************/
+
+#ifndef METADATA_LOG_H
+#define METADATA_LOG_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+enum MetadataEvent
+{
+    META_FRAME_ARRIVED,         // claimed by a grab thread or the callback
+    META_FRAME_USED,            // taken by the scan for slit step `slit`
+    META_FRAME_DROPPED,         // the consumer was too far behind (status says why)
+    META_GRAB_FAILED,           // RetrieveBuffer or the claim failed; status is the ErrorType
+    META_CAMERA_STATS           // a CameraStats snapshot, in the stats columns
+};
+
+// Why a frame was dropped, in the status column of META_FRAME_DROPPED.
+enum MetadataDropReason
+{
+    META_DROP_RING_FULL = 1,        // the grab thread's queue was full
+    META_DROP_STALE = 2,            // arrived before the scan step that wanted it
+    META_DROP_UNPAIRED = 3          // no frame from the other cameras to pair it with
+};
+
+// One row. All fields are fixed size so each maps onto one column.
+struct MetadataRow
+{
+    unsigned long long hostTimeUs;          // HostTimeUs() when the event happened / frame arrived
+    unsigned long long sequence;
+    unsigned long long timeStampSeconds;
+    unsigned int timeStampMicroSeconds;
+    unsigned int cycleSeconds;
+    unsigned int cycleCount;
+    unsigned int cycleOffset;
+    unsigned int embeddedTimeStamp;
+    unsigned int embeddedGain;
+    unsigned int embeddedShutter;
+    unsigned int embeddedBrightness;
+    unsigned int embeddedExposure;
+    unsigned int embeddedWhiteBalance;
+    unsigned int embeddedFrameCounter;
+    unsigned int embeddedStrobePattern;
+    unsigned int embeddedGPIOPinState;
+    unsigned int embeddedROIPosition;
+    unsigned int receivedSize;
+    unsigned int camera;
+    unsigned int event;                     // MetadataEvent
+    int slit;                               // scan step, -1 if none
+    int status;                             // 0, a MetadataDropReason or a FlyCapture2::ErrorType
+    unsigned int imageDropped;              // CameraStats, META_CAMERA_STATS rows only
+    unsigned int imageCorrupt;
+    unsigned int imageXmitFailed;
+    unsigned int imageDriverDropped;
+    unsigned int temperature;               // tenths of a kelvin
+};
+
+MetadataRow MakeMetadataRow( MetadataEvent event, const FrameHandle& handle, int slit, int status = 0 );
+MetadataRow MakeMetadataRow( MetadataEvent event, unsigned int camera, const FlyCapture2::Image& image, int slit );
+MetadataRow MakeGrabFailedRow( unsigned int camera, FlyCapture2::ErrorType type );
+MetadataRow MakeCameraStatsRow( unsigned int camera, const FlyCapture2::CameraStats& stats );
+
+const char* MetadataEventName( unsigned int event );
+
+// The column table stored in the file header.
+struct MetadataColumn
+{
+    char name[32];
+    unsigned int size;                      // bytes per value
+    unsigned int offset;                    // of the value array from the start of a block
+};
+
+struct MetadataLogHeader
+{
+    char magic[8];                          // "FC2META\0"
+    unsigned int version;
+    unsigned int headerSize;                // offset of block 0
+    unsigned int blockRows;
+    unsigned int numColumns;
+    unsigned long long blockSize;
+    unsigned long long createdUs;           // wall clock, microseconds since 1970
+};
+
+class MetadataLog
+{
+public:
+    static const unsigned int sk_blockRows = 4096;
+
+    MetadataLog();
+    ~MetadataLog();
+
+    // Creates or truncates path and starts the writer thread.
+    FlyCapture2::Error Open( const std::string& path );
+
+    // Lock free. Returns false if the row was lost (log closed or the
+    // writer too far behind).
+    bool Append( const MetadataRow& row );
+
+    // Writes every row appended so far, including a partial last block.
+    FlyCapture2::Error Close();
+
+    bool IsOpen() const { return m_fd >= 0; }
+    unsigned long long Rows() const { return m_next.load(); }
+    unsigned long long Lost() const { return m_lost.load(); }
+
+private:
+    MetadataLog( const MetadataLog& );
+    MetadataLog& operator=( const MetadataLog& );
+
+    static const unsigned int sk_numSlots = 8;
+
+    struct Slot
+    {
+        std::atomic<unsigned long long> block;      // block this slot is collecting
+        std::atomic<unsigned int> filled;           // rows copied in so far
+        unsigned char* pData;
+    };
+
+    void FlushLoop();
+    bool WriteBlock( unsigned long long block, unsigned int rows );
+
+    int m_fd;
+    MetadataLogHeader m_header;
+    std::vector<MetadataColumn> m_columns;
+    std::vector<unsigned int> m_rowOffsets;         // of each column's field in MetadataRow
+
+    Slot m_slots[sk_numSlots];
+    std::atomic<unsigned long long> m_next;         // rows claimed
+    std::atomic<unsigned long long> m_lost;
+    std::atomic<bool> m_accepting;
+    std::atomic<unsigned int> m_appending;          // Append() calls in progress
+    unsigned long long m_written;                   // blocks on disk
+    bool m_failed;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+};
+
+class MetadataLogReader
+{
+public:
+    MetadataLogReader();
+    ~MetadataLogReader();
+
+    // Maps the file read only. Blocks cut short by a crash are ignored.
+    FlyCapture2::Error Open( const std::string& path );
+    void Close();
+
+    unsigned long long NumRows() const { return m_numRows; }
+    unsigned long long NumBlocks() const { return m_numBlocks; }
+    unsigned int BlockRows( unsigned long long block ) const;
+    const std::vector<MetadataColumn>& Columns() const { return m_columns; }
+
+    // Index of the column called name, or -1.
+    int FindColumn( const char* pName ) const;
+
+    // The value array of a column in one block, BlockRows( block ) long.
+    const void* Column( unsigned long long block, unsigned int column ) const;
+
+    // Gathers row i.
+    void Row( unsigned long long i, MetadataRow* pRow ) const;
+
+private:
+    MetadataLogReader( const MetadataLogReader& );
+    MetadataLogReader& operator=( const MetadataLogReader& );
+
+    unsigned char* m_pBase;
+    size_t m_mappedSize;
+    MetadataLogHeader m_header;
+    std::vector<MetadataColumn> m_columns;
+    std::vector<int> m_rowOffsets;                  // of each MetadataRow field's column, -1 if missing
+    unsigned long long m_numBlocks;
+    unsigned long long m_numRows;
+};
+
+// Prints the log as CSV, one line per row.
+FlyCapture2::Error DumpMetadataLog( const std::string& path );
+
+#endif // METADATA_LOG_H
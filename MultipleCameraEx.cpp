@@ -9,10 +9,34 @@
 *****************************************************************/
 
 #include "FlyCapture2.h"
+#include "SyntheticCamera.h"
+#include "ReplayCamera.h"
+#include "FrameArena.h"
+#include "FrameSpool.h"
+#include "FramePool.h"
+#include "HugePages.h"
+#include "NumaPlacement.h"
+#include "CaptureEngine.h"
+#include "CameraUtils.h"
+#include "PatternDisplay.h"
+#include "LatencyCalibrator.h"
+#include "FrameWriter.h"
+#include "RawRecording.h"
+#include "DemosaicReader.h"
+#include "Demosaic.h"
+#include "DemosaicBench.h"
+#include "StorageSelfTest.h"
+#include "MetadataLog.h"
 #include <vector>
+#include <algorithm>
+#include <string>
 #include <opencv2/opencv.hpp>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <ctime>
 
 using namespace FlyCapture2;
 using namespace std;
@@ -48,65 +72,10 @@ int main(int argc, char* argv[]) {
     cout << "Welcome to the ASI software.\n There are two modes - calibration and data mode. The calibration mode enables you to take pictures from each camera one at a time while changing the orientation of the checkerboard pattern with each 'run'. The Scanning mode is where a moving slit is projected onto the object and  images taken by both cameras are synchronized with it." << endl;
     cout << "The general syntax of the command is \n\n" << endl;
     cout << "./out -mode -count -int -color\n\n" << endl;
+    cout << "Without cameras attached, '-source synthetic' generates frames in software (see also -cameras, -display, -size, -fps, -pixfmt, -jitter, -drop, -corrupt, -stall).\n" << endl;
+    cout << "'-source replay' plays back a saved capture instead (see also -replaydir, -replayspeed).\n" << endl;
 
-    Error error;
-    CameraInfo camInfo;
-
-    BusManager busMgr;
-    unsigned int numCameras;
-
-    error = busMgr.GetNumOfCameras(&numCameras);
-    if (error != PGRERROR_OK)
-    {
-        PrintError( error );
-        return -1;
-    }
-    printf("cameras: %u\n", numCameras);
-
-    // create a new array of cameras     
-    Camera* pcam[2] ;
-
-    // now we do the formalities needed to establish a connection
-    for (unsigned int i=0; i<numCameras; i++) {
-      // connect to a camera 
-      PGRGuid guid;
-      pcam[i] = new Camera();
-
-      error = busMgr.GetCameraFromIndex( i, &guid );
-      if (error != PGRERROR_OK)
-        {
-            PrintError( error );
-            return -1;
-        }
-
-      error = pcam[i]->Connect(&guid);
-      if (error != PGRERROR_OK)
-        {
-            PrintError( error );
-            return -1;
-        }
-
-      // Get the camera information
-      error = pcam[i]->GetCameraInfo( &camInfo );
-      if (error != PGRERROR_OK)
-        {
-            PrintError( error );
-            return -1;
-        }
-      // uncomment the following line if you really care about the camera info
-      // PrintCameraInfo(&camInfo);
-
-      // Next we turn isochronous images capture ON for both cameras
-      error = pcam[i]->StartCapture();
-      if (error != PGRERROR_OK)
-    	  {
-       	 	PrintError( error );
-       	 	return -1;
-    	  }
-
-     }
-
-	Image rawImage, convertedImage;	// prepare the image object and keep
+	Image rawImage;	// prepare the image object and keep
 
 
 	// checking command line parameters
@@ -115,6 +84,74 @@ int main(int argc, char* argv[]) {
 	// setting defaults. mode is slit, no of images is 50, intensity is midway and color is white.
 	int mode = 0, numImages = 50, intensity = 255, color = 0;
 
+	// source 0 is the cameras on the bus, 1 is the synthetic backend, 2
+	// replays the TIFFs in replayDir
+	int source = 0;
+	std::string replayDir = "./images";
+	// cameraCount is how many synthetic or replayed cameras to run (0 is
+	// the stereo pair), or how many of the cameras on the bus to use (0 is
+	// all of them)
+	unsigned int cameraCount = 0;
+	bool display = true;
+	// zeroCopy captures into a FrameArena instead of DeepCopy'ing every frame
+	bool zeroCopy = false;
+	// threaded runs one grab thread per camera (CaptureEngine) instead of
+	// calling RetrieveBuffer on each camera in turn; callbacks feeds the
+	// engine from the SDK's image event callback instead of grab threads
+	bool threaded = false;
+	bool callbacks = false;
+	// frames of one multi-view group may differ by this much in capture time,
+	// 0 is half a frame period
+	int pairTolUs = 0;
+	// syncStart starts all cameras with StartSyncCapture so their exposures
+	// are phase aligned, instead of one StartCapture after the other
+	bool syncStart = false;
+	// triggered exposes every camera once per slit position with a software
+	// trigger instead of taking whatever the free-running cameras deliver
+	bool triggered = false;
+	int triggerTimeoutMs = 0;
+	unsigned int triggerFrameUs = 0;
+	// settleUs is how long after a slit is shown its light reaches the
+	// cameras; measureLatency measures it before the scan
+	int settleUs = 0;
+	bool measureLatency = false;
+	int latencyToggles = 50;
+	// streamWrite saves frames while the scan runs instead of after it,
+	// holding at most writeQueue frames in memory
+	bool streamWrite = false;
+	int writeQueue = 32;
+	// memCapMB > 0 holds the frames of a scan saved afterwards in that much
+	// memory per camera and spills the rest to a scratch file (FrameSpool)
+	int memCapMB = 0;
+	// which pages the arenas and spools are mapped on, see HugePages.h
+	PageMode pageMode = PAGES_AUTO;
+	// numaPlacement keeps each camera's threads and buffers on one NUMA
+	// node: the one its USB controller hangs off, or numaNodes[camera]
+	bool numaPlacement = false;
+	std::vector<int> numaNodes;
+	// saveThreads converts and saves frames in parallel, one per core by default
+	unsigned int saveThreads = std::thread::hardware_concurrency();
+	// rawFormat records one raw file per camera instead of TIFFs;
+	// exportFile turns such a recording back into TIFFs and exits
+	bool rawFormat = false;
+	const char* exportFile = NULL;
+	// dumpMetaFile prints a session's metadata log as CSV and exits
+	const char* dumpMetaFile = NULL;
+	// how raw recordings reach the disk, see AsyncWriter; preallocate
+	// reserves each recording's full size before the scan
+	RawWriteConfig rawConfig;
+	bool preallocate = true;
+	// selfTestMB > 0 benchmarks the output directory before the scan,
+	// writing that much per configuration, and picks the writer settings
+	int selfTestMB = 0;
+	// encoding of the saved images, see FrameEncoding::Parse
+	FrameEncoding encoding;
+	// who turns raw frames into RGB for saving, the SDK or Demosaic();
+	// demosaicBench times the demosaic kernels on that many frames and exits
+	DemosaicSettings demosaic;
+	int demosaicBench = 0;
+	SyntheticCameraConfig synthConfig;
+
 	// parse command line arguments
 	for (int cmd = 1; cmd < argc - 1; cmd += 2) {
 	  if (!strcmp(argv[cmd],"-mode")) {
@@ -149,9 +186,180 @@ int main(int argc, char* argv[]) {
 	    } else if (mode == 1) {
 		cout << "Mode is calibration, will use only white." << endl;
 	    }
-          }
+          } else if (!strcmp(argv[cmd],"-cameras")) {
+	    cameraCount = atoi(argv[cmd + 1]);
+          } else if (!strcmp(argv[cmd],"-source")) {
+	    if (!strcmp(argv[cmd + 1], "synthetic")) {
+	      cout << "source is synthetic cameras" << endl;
+	      source = 1;
+	    } else if (!strcmp(argv[cmd + 1], "replay")) {
+	      cout << "source is a replay of saved frames" << endl;
+	      source = 2;
+	    }
+	  } else if (!strcmp(argv[cmd],"-replaydir")) {
+	    replayDir = argv[cmd + 1];
+	  } else if (!strcmp(argv[cmd],"-replayspeed")) {
+	    synthConfig.paced = strcmp(argv[cmd + 1], "max") != 0;
+	    cout << "replay runs at " << (synthConfig.paced ? "the frame rate" : "full speed") << endl;
+	  } else if (!strcmp(argv[cmd],"-capture")) {
+	    zeroCopy = !strcmp(argv[cmd + 1], "zerocopy");
+	    cout << "capture is " << (zeroCopy ? "zero copy" : "copy") << endl;
+	  } else if (!strcmp(argv[cmd],"-grab")) {
+	    callbacks = !strcmp(argv[cmd + 1], "callback");
+	    threaded = callbacks || !strcmp(argv[cmd + 1], "threaded");
+	    cout << "grabbing is " << (callbacks ? "image event callbacks" : threaded ? "one thread per camera" : "serial") << endl;
+	  } else if (!strcmp(argv[cmd],"-start")) {
+	    syncStart = !strcmp(argv[cmd + 1], "sync");
+	    cout << "cameras start " << (syncStart ? "synchronized" : "one after another") << endl;
+	  } else if (!strcmp(argv[cmd],"-trigger")) {
+	    triggered = !strcmp(argv[cmd + 1], "software");
+	    cout << "cameras are " << (triggered ? "software triggered" : "free running") << endl;
+	  } else if (!strcmp(argv[cmd],"-settle")) {
+	    measureLatency = !strcmp(argv[cmd + 1], "auto");
+	    settleUs = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-write")) {
+	    streamWrite = !strcmp(argv[cmd + 1], "stream");
+	    cout << "images are saved " << (streamWrite ? "during the scan" : "after the scan") << endl;
+	  } else if (!strcmp(argv[cmd],"-memcap")) {
+	    memCapMB = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-hugepages")) {
+	    if (!ParsePageMode(argv[cmd + 1], &pageMode)) {
+	      cout << "unknown page mode " << argv[cmd + 1] << ", using auto" << endl;
+	    }
+	  } else if (!strcmp(argv[cmd],"-numa")) {
+	    numaPlacement = strcmp(argv[cmd + 1], "off") != 0;
+	    numaNodes.clear();
+	    if (numaPlacement && strcmp(argv[cmd + 1], "auto") != 0) {
+	      // one node per camera, e.g. 0/1
+	      std::string nodes = argv[cmd + 1];
+	      for (size_t start = 0; start < nodes.size(); ) {
+	        size_t end = nodes.find('/', start);
+	        if (end == std::string::npos) {
+	          end = nodes.size();
+	        }
+	        numaNodes.push_back(atoi(nodes.substr(start, end - start).c_str()));
+	        start = end + 1;
+	      }
+	    }
+	  } else if (!strcmp(argv[cmd],"-writequeue")) {
+	    writeQueue = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-savethreads")) {
+	    saveThreads = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-format")) {
+	    rawFormat = !strcmp(argv[cmd + 1], "raw");
+	    cout << "images are saved as " << (rawFormat ? "one raw recording per camera" : "TIFF files") << endl;
+	  } else if (!strcmp(argv[cmd],"-compress")) {
+	    if (!encoding.Parse(argv[cmd + 1])) {
+	      cout << "unknown compression " << argv[cmd + 1] << ", saving uncompressed" << endl;
+	    }
+	    cout << "images are saved as " << encoding.Name() << endl;
+	  } else if (!strcmp(argv[cmd],"-demosaic")) {
+	    demosaic.sdk = !ParseDemosaicMethod(argv[cmd + 1], &demosaic.method);
+	    cout << "frames are demosaiced by " << (demosaic.sdk ? "the SDK" : DemosaicMethodName(demosaic.method)) << endl;
+	  } else if (!strcmp(argv[cmd],"-demosaicbench")) {
+	    demosaicBench = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-iobackend")) {
+	    if (!ParseAsyncWriterBackend(argv[cmd + 1], &rawConfig.backend)) {
+	      cout << "unknown io backend " << argv[cmd + 1] << ", using auto" << endl;
+	    }
+	    cout << "raw recordings are written with the " << AsyncWriterBackendName(rawConfig.backend) << " backend" << endl;
+	  } else if (!strcmp(argv[cmd],"-prealloc")) {
+	    preallocate = strcmp(argv[cmd + 1], "off") != 0;
+	  } else if (!strcmp(argv[cmd],"-selftest")) {
+	    selfTestMB = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-export")) {
+	    exportFile = argv[cmd + 1];
+	  } else if (!strcmp(argv[cmd],"-dumpmeta")) {
+	    dumpMetaFile = argv[cmd + 1];
+	  } else if (!strcmp(argv[cmd],"-pairtol")) {
+	    pairTolUs = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-display")) {
+	    display = strcmp(argv[cmd + 1], "off") != 0;
+	  } else if (!strcmp(argv[cmd],"-fps")) {
+	    synthConfig.frameRate = atof(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-size")) {
+	    // the Bayer tile is 2x2, so both sides must be even
+	    unsigned int cols = 0, rows = 0;
+	    if (sscanf(argv[cmd + 1], "%ux%u", &cols, &rows) != 2 || cols < 4 || rows < 4 || cols % 2 || rows % 2) {
+	      cout << "-size takes <width>x<height>, both even and at least 4, e.g. 1288x964" << endl;
+	      return -1;
+	    }
+	    synthConfig.cols = cols;
+	    synthConfig.rows = rows;
+	  } else if (!strcmp(argv[cmd],"-pixfmt")) {
+	    synthConfig.pixelFormat = !strcmp(argv[cmd + 1], "raw12") ? PIXEL_FORMAT_RAW12 : PIXEL_FORMAT_RAW8;
+	  } else if (!strcmp(argv[cmd],"-jitter")) {
+	    synthConfig.jitterUs = atoi(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-drop")) {
+	    synthConfig.dropRate = atof(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-corrupt")) {
+	    synthConfig.corruptRate = atof(argv[cmd + 1]);
+	  } else if (!strcmp(argv[cmd],"-stall")) {
+	    synthConfig.stallRate = atof(argv[cmd + 1]);
+	  }
+	}
+
+	if (saveThreads == 0) {
+	  saveThreads = 1;
+	}
+
+	if (demosaicBench > 0) {
+	  bool exact = RunDemosaicBenchmark(synthConfig.rows, synthConfig.cols, demosaicBench, saveThreads);
+	  return exact ? 0 : -1;
+	}
+
+	if (dumpMetaFile != NULL) {
+	  Error dumpError = DumpMetadataLog(dumpMetaFile);
+	  if (dumpError != PGRERROR_OK) {
+	    printf("%s is not a metadata log\n", dumpMetaFile);
+	    return -1;
+	  }
+	  return 0;
+	}
+
+	if (exportFile != NULL) {
+	  RawRecordingReader reader;
+	  Error exportError = reader.Open(exportFile);
+	  if (exportError != PGRERROR_OK) {
+	    printf("%s is not a raw recording\n", exportFile);
+	    return -1;
+	  }
+	  printf("Exporting %llu frames of camera %u to ./images\n", reader.NumFrames(), reader.Header().camera);
+	  std::chrono::steady_clock::time_point exportStart = std::chrono::steady_clock::now();
+	  DemosaicReader demosaicReader(&reader);
+	  demosaicReader.SetDemosaic(demosaic);
+	  exportError = ExportFrames(&demosaicReader, "./images", saveThreads, encoding);
+	  printf("Exported in %.3f s\n",
+	         std::chrono::duration<double>(std::chrono::steady_clock::now() - exportStart).count());
+	  demosaicReader.PrintStats();
+	  if (exportError != PGRERROR_OK) {
+	    PrintError( exportError );
+	    return -1;
+	  }
+	  return 0;
+	}
+
+	// the latency measurement watches frames coming out of the grab threads
+	if (measureLatency && !threaded) {
+	  cout << "measuring the settle time grabs with one thread per camera" << endl;
+	  threaded = true;
+	}
+
+	// frames saved during the scan are not held, so there is nothing to cap
+	bool spooled = memCapMB > 0 && !streamWrite;
+	if (memCapMB > 0 && streamWrite) {
+	  cout << "frames saved during the scan are not held in memory, ignoring -memcap" << endl;
+	}
+
+	// the grab threads hand frames over as arena handles
+	if (threaded && !zeroCopy) {
+	  cout << "threaded grabbing captures without copies" << endl;
+	  zeroCopy = true;
 	}
 
+	// copies go into a fixed pool of frames rather than a new Image each
+	bool pooled = !zeroCopy && !spooled;
+
 	// handling default cases in case of not entering arguments..
 	if (mode_specified == false) {
 	  cout << "Mode not specified. going with slitscan." << endl;
@@ -159,6 +367,10 @@ int main(int argc, char* argv[]) {
 	if (count_specified == false) {
 	  cout << "No of images not specified, default is 50." << endl;
 	}
+	if (numImages <= 0) {
+	  cout << "The number of images must be at least 1" << endl;
+	  return -1;
+	}
 	if (int_specified == false) {
 	  cout << "Intensity not specified, going with max" << endl;
 	}
@@ -166,19 +378,352 @@ int main(int argc, char* argv[]) {
 	  cout << "Colour not specified, default is white" << endl;
 	}
 
-	std::vector<Image> vecImages1;
-        vecImages1.resize(numImages);
-	std::vector<Image> vecImages2;
-        vecImages2.resize(numImages);
+    Error error;
+    CameraInfo camInfo;
+
+    BusManager busMgr;
+    unsigned int numCameras;
+
+    if (source != 0) {
+      // the synthetic rig is the stereo pair unless asked for more views
+      numCameras = cameraCount > 0 ? cameraCount : 2;
+    } else {
+      error = busMgr.GetNumOfCameras(&numCameras);
+      if (error != PGRERROR_OK)
+      {
+          PrintError( error );
+          return -1;
+      }
+      if (cameraCount > 0 && cameraCount < numCameras) {
+        numCameras = cameraCount;
+      }
+    }
+    printf("cameras: %u\n", numCameras);
+    if (numCameras == 0) {
+      printf("No cameras to capture from\n");
+      return -1;
+    }
+
+    // create a new array of cameras     
+    std::vector<CameraBase*> pcam(numCameras, (CameraBase*)NULL);
+    // the frame buffers of each camera when capturing without copies
+    std::vector<FrameArena> arena(numCameras);
+    // the NUMA node and cores each camera's work is kept on
+    std::vector<CameraPlacement> placement(numCameras);
+    std::vector<unsigned int> frameBytes(numCameras, 0);
+    // where the frames of each camera wait to be saved under -memcap
+    std::vector<FrameSpool> spool(numCameras);
+    // the frames of each camera when capturing with copies
+    std::vector<FramePool> pool(numCameras);
+
+    // now we do the formalities needed to establish a connection
+    for (unsigned int i=0; i<numCameras; i++) {
+      // connect to a camera 
+      PGRGuid guid;
+      if (source == 1) {
+        pcam[i] = new SyntheticCamera(synthConfig, i);
+        error = pcam[i]->Connect();
+      } else if (source == 2) {
+        SyntheticCameraConfig replayConfig = synthConfig;
+        unsigned int numReplayFrames = 0;
+        error = ReplayCamera::Probe(replayDir, i, &replayConfig, &numReplayFrames);
+        if (error != PGRERROR_OK) {
+          printf("No frames of camera %u in %s\n", i, replayDir.c_str());
+          PrintError( error );
+          return -1;
+        }
+        printf("replaying %u frames of camera %u (%ux%u)\n", numReplayFrames, i, replayConfig.cols, replayConfig.rows);
+        pcam[i] = new ReplayCamera(replayConfig, i, replayDir, i, numReplayFrames);
+        error = pcam[i]->Connect();
+      } else {
+        pcam[i] = new Camera();
+
+        error = busMgr.GetCameraFromIndex( i, &guid );
+        if (error != PGRERROR_OK)
+          {
+              PrintError( error );
+              return -1;
+          }
+
+        error = pcam[i]->Connect(&guid);
+      }
+      if (error != PGRERROR_OK)
+        {
+            PrintError( error );
+            return -1;
+        }
+
+      // Get the camera information
+      error = pcam[i]->GetCameraInfo( &camInfo );
+      if (error != PGRERROR_OK)
+        {
+            PrintError( error );
+            return -1;
+        }
+      // uncomment the following line if you really care about the camera info
+      // PrintCameraInfo(&camInfo);
+
+      GetFrameSize(pcam[i], &frameBytes[i]);
+      if (numaPlacement) {
+        if (i < numaNodes.size()) {
+          if (!SetPlacementNode(numaNodes[i], &placement[i])) {
+            printf("camera %u: there is no NUMA node %d\n", i, numaNodes[i]);
+          }
+        } else if (source != 0 || FindCameraPlacement(&busMgr, guid, camInfo, &placement[i]) != PGRERROR_OK) {
+          printf("camera %u: USB controller not found, not placing it\n", i);
+        }
+        if (placement[i].IsKnown()) {
+          printf("camera %u: node %d of %u, cores %s%s%s, USB link %u\n", i, placement[i].node, NumNumaNodes(),
+                 FormatCpuList(placement[i].cpus).c_str(), placement[i].controller.empty() ? "" : ", controller ",
+                 placement[i].controller.c_str(), placement[i].usbLink);
+        }
+      }
+
+      // the grab threads pair frames by the timestamp and frame counter the
+      // camera embeds in the first pixels of each image
+      if (threaded) {
+        error = EnableEmbeddedInfo(pcam[i]);
+        if (error != PGRERROR_OK)
+          {
+              PrintError( error );
+              return -1;
+          }
+      }
+
+      // one exposure per trigger; a frame that is not there well after the
+      // exposure and transfer should have ended is not coming
+      if (triggered) {
+        if (ExposureAndTransferUs(pcam[i]) > triggerFrameUs) {
+          triggerFrameUs = ExposureAndTransferUs(pcam[i]);
+        }
+        int frameMs = ExposureAndTransferUs(pcam[i]) / 1000;
+        if (2 * frameMs + 10 > triggerTimeoutMs) {
+          triggerTimeoutMs = 2 * frameMs + 10;
+        }
+        FC2Config config;
+        error = SetSoftwareTrigger(pcam[i], true);
+        if (error == PGRERROR_OK) {
+          error = pcam[i]->GetConfiguration(&config);
+        }
+        if (error == PGRERROR_OK) {
+          config.grabTimeout = triggerTimeoutMs;
+          error = pcam[i]->SetConfiguration(&config);
+        }
+        if (error != PGRERROR_OK)
+          {
+              PrintError( error );
+              return -1;
+          }
+      }
+
+      // hand the driver one slot per frame of the scan, plus a few it can
+      // keep in flight, so every frame stays where it landed until saved;
+      // when saving during the scan or into a spool the slots are reused
+      // once the frame has moved on; the grab threads' ring and the pairing
+      // stage hold frames of their own on top
+      if (zeroCopy) {
+        int engineFrames = threaded ? (int)CaptureEngine::FramesHeld() : 0;
+        int numSlots = numImages;
+        if (streamWrite && writeQueue + (int)saveThreads + engineFrames + 1 < numSlots) {
+          numSlots = writeQueue + (int)saveThreads + engineFrames + 1;
+        } else if (spooled && engineFrames + 32 < numSlots) {
+          numSlots = engineFrames + 32;
+        }
+        arena[i].SetPageMode(pageMode);
+        arena[i].SetNumaNode(placement[i].node);
+        error = arena[i].Allocate(pcam[i], numSlots + 4);
+        if (error == PGRERROR_OK) {
+          error = arena[i].Register(pcam[i]);
+        }
+        if (error != PGRERROR_OK)
+          {
+              PrintError( error );
+              return -1;
+          }
+        printf("camera %u: %u frame buffers on %s pages\n", i, arena[i].NumSlots(), PageModeName(arena[i].Pages()));
+      }
+
+      // frames saved after the scan are all held until then; when saving
+      // during the scan, only those waiting for or inside the writers
+      if (pooled) {
+        unsigned int poolFrames = numImages;
+        if (streamWrite && rawFormat) {
+          poolFrames = 2;
+        } else if (streamWrite && writeQueue + saveThreads + 2 < poolFrames) {
+          poolFrames = writeQueue + saveThreads + 2;
+        }
+        pool[i].SetPageMode(pageMode);
+        pool[i].SetNumaNode(placement[i].node);
+        error = pool[i].Allocate(pcam[i], poolFrames);
+        if (error != PGRERROR_OK)
+          {
+              PrintError( error );
+              return -1;
+          }
+        printf("camera %u: pool of %u frames on %s pages\n", i, pool[i].NumFrames(), PageModeName(pool[i].Pages()));
+      }
+
+      if (spooled) {
+        spool[i].SetPageMode(pageMode);
+        spool[i].SetNumaNode(placement[i].node);
+        error = spool[i].Allocate(pcam[i], numImages, memCapMB * 1024ULL * 1024ULL, "./images");
+        if (error != PGRERROR_OK)
+          {
+              printf("No room for %d frames of camera %u in ./images\n", numImages, i);
+              PrintError( error );
+              return -1;
+          }
+        printf("camera %u: %u frames in %.1f MB of memory on %s pages, %u in a scratch file\n", i, spool[i].MemoryFrames(),
+               spool[i].MemoryBytes() / 1e6, PageModeName(spool[i].Pages()), spool[i].NumFrames() - spool[i].MemoryFrames());
+      }
+
+     }
+
+    if (selfTestMB > 0) {
+      StorageDemand demand;
+      Format7ImageSettings imageSettings;
+      error = GetImageSettings(pcam[0], &imageSettings);
+      if (error != PGRERROR_OK)
+        {
+            PrintError( error );
+            return -1;
+        }
+      // the test frame is camera 0's, tile layout included
+      CameraInfo firstInfo;
+      error = pcam[0]->GetCameraInfo(&firstInfo);
+      if (error != PGRERROR_OK)
+        {
+            PrintError( error );
+            return -1;
+        }
+      Property frameRate(FRAME_RATE);
+      pcam[0]->GetProperty(&frameRate);
+      demand.rows = imageSettings.height;
+      demand.cols = imageSettings.width;
+      demand.pixelFormat = imageSettings.pixelFormat;
+      demand.bayerFormat = firstInfo.bayerTileFormat;
+      demand.frameRate = frameRate.absValue;
+      demand.numCameras = numCameras;
+      demand.numFrames = numImages;
+      demand.raw = rawFormat;
+      demand.streaming = streamWrite;
+      demand.demosaic = demosaic;
+      StorageChoice choice;
+      error = RunStorageSelfTest("./images", demand, selfTestMB * 1024ULL * 1024ULL, saveThreads, &choice);
+      if (error != PGRERROR_OK)
+        {
+            PrintError( error );
+            return -1;
+        }
+      if (rawFormat) {
+        rawConfig = choice.rawConfig;
+      } else {
+        encoding = choice.encoding;
+        saveThreads = choice.saveThreads;
+      }
+    }
+
+    // the recordings and the metadata log of this scan are named after its start
+    char session[32];
+    time_t sessionStart = time(NULL);
+    strftime(session, sizeof(session), "%Y%m%d-%H%M%S", localtime(&sessionStart));
+
+    // every frame's timing and fate goes to the metadata log, whatever the
+    // images are saved as
+    char metaLogName[512];
+    snprintf(metaLogName, sizeof(metaLogName), "./images/scan-%s.fcmeta", session);
+    MetadataLog metaLog;
+    error = metaLog.Open(metaLogName);
+    if (error != PGRERROR_OK) {
+      printf("Could not create %s\n", metaLogName);
+      PrintError( error );
+      return -1;
+    }
+    for (unsigned int i=0; i<numCameras; i++) {
+      CameraStats stats;
+      if (pcam[i]->GetStats( &stats ) == PGRERROR_OK) {
+        metaLog.Append(MakeCameraStatsRow(i, stats));
+      }
+    }
+
+    // Next we turn isochronous images capture ON for all cameras, once all
+    // of them are set up so that none streams while another is still being
+    // configured
+    // TLB misses from the first frame until the last one is saved, in
+    // every thread started from here on
+    TlbMissCounter tlbMisses;
+    tlbMisses.Start();
+    NodeTraffic nodeTraffic;
+    nodeTraffic.Start();
+
+    CaptureEngine engine;
+    engine.SetPairingTolerance(pairTolUs);
+    engine.SetMetadataLog(&metaLog);
+    engine.SetPlacement(&placement[0], numCameras);
+
+    // writer worker k runs next to camera k; a camera with no known
+    // placement leaves its workers unpinned (an empty set)
+    std::vector<cpu_set_t> workerCpus;
+    bool anyPlaced = false;
+    for (unsigned int i=0; i<numCameras; i++) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      if (placement[i].IsKnown()) {
+        cpus = placement[i].cpus;
+        anyPlaced = true;
+      }
+      workerCpus.push_back(cpus);
+    }
+    if (!anyPlaced) {
+      workerCpus.clear();
+    }
+    if (callbacks) {
+      error = engine.StartCallbacks(&pcam[0], &arena[0], numCameras, syncStart);
+      if (error != PGRERROR_OK)
+    	  {
+       	 	PrintError( error );
+       	 	return -1;
+    	  }
+    }
+    else if (syncStart) {
+      error = StartSyncCapture(numCameras, &pcam[0]);
+      if (error != PGRERROR_OK)
+    	  {
+       	 	PrintError( error );
+       	 	return -1;
+    	  }
+    }
+    else
+    for (unsigned int i=0; i<numCameras; i++) {
+      error = pcam[i]->StartCapture();
+      if (error != PGRERROR_OK)
+    	  {
+       	 	PrintError( error );
+       	 	return -1;
+    	  }
+    }
+
+    if (threaded && !callbacks) {
+      engine.Start(&pcam[0], &arena[0], numCameras);
+    }
+
+	// the frames of every camera for every scan step
+	std::vector< std::vector<PooledFrame*> > vecPooled(numCameras, std::vector<PooledFrame*>(numImages, (PooledFrame*)NULL));
+	std::vector< std::vector<FrameHandle> > vecFrames(numCameras, std::vector<FrameHandle>(numImages));
+	// the slit sweeps the middle 60% of the projector rows over the whole scan
 	int slitRow = 1200, slitCol = 1600, slitStart = 0.3*slitRow, slitMove = 0.6*slitRow/50;
+	// long scans stop the slit at the bottom row rather than run off the pattern
+	int slitLast = slitRow - 1;
 	cv::Mat projectedSlit(slitRow, slitCol, CV_8UC1);
 	cv::cvtColor(projectedSlit, projectedSlit, CV_GRAY2RGB);
 	    
 	// we'll create a namedWindow which can be closed by us
-	cvNamedWindow("Image1", CV_WINDOW_NORMAL);
-	cvSetWindowProperty("Image1", CV_WND_PROP_FULLSCREEN, CV_WINDOW_FULLSCREEN);
-	cv::imshow("Image1", projectedSlit);
-	cv::waitKey(1000);
+	if (display) {
+	  cvNamedWindow("Image1", CV_WINDOW_NORMAL);
+	  cvSetWindowProperty("Image1", CV_WND_PROP_FULLSCREEN, CV_WINDOW_FULLSCREEN);
+	  cv::imshow("Image1", projectedSlit);
+	  cv::waitKey(1000);
+	}
 
 	cv::Vec3b black, green, white, slit_color;
 	black.val[0] = 0; black.val[1] = 0; black.val[2] = 0;
@@ -192,110 +737,418 @@ int main(int argc, char* argv[]) {
 	  slit_color = green;
 	}
 
-	cvStartWindowThread();
+	if (display) {
+	  cvStartWindowThread();
+	}
+
+	// find out how long a new pattern takes to reach the cameras; the
+	// synthetic cameras watch a simulated projector instead of the window
+	if (measureLatency) {
+	  SimulatedDisplay simulatedDisplay;
+	  WindowDisplay windowDisplay("Image1");
+	  PatternDisplay* pDisplay = NULL;
+	  if (source != 0) {
+	    pDisplay = &simulatedDisplay;
+	    for (unsigned int i=0; i<numCameras; i++) {
+	      ((SyntheticCamera*)pcam[i])->SetSceneCallback(&SimulatedDisplay::SceneLevel, &simulatedDisplay);
+	    }
+	  } else if (display) {
+	    pDisplay = &windowDisplay;
+	  }
+
+	  if (pDisplay == NULL) {
+	    cout << "measuring the settle time needs the projector window" << endl;
+	  } else {
+	    LatencyCalibrator calibrator(pDisplay, &engine, &arena[0]);
+	    if (triggered) {
+	      calibrator.SetSoftwareTrigger(&pcam[0], numCameras, triggerTimeoutMs);
+	    }
+	    LatencyResult latency;
+	    if (calibrator.Measure(latencyToggles, &latency)) {
+	      LatencyCalibrator::PrintResult(latency);
+	      settleUs = latency.p99Us;
+	    } else {
+	      cout << "the cameras do not see the display, not settling" << endl;
+	    }
+	  }
 
+	  if (source != 0) {
+	    for (unsigned int i=0; i<numCameras; i++) {
+	      ((SyntheticCamera*)pcam[i])->SetSceneCallback(NULL, NULL);
+	    }
+	  }
+	}
+	if (settleUs > 0) {
+	  printf("settling %.1f ms after every slit\n", settleUs / 1000.0);
+	}
+
+	cout << "saving with " << saveThreads << " threads" << endl;
+	FrameWriter writer("./images", writeQueue, saveThreads, numCameras);
+	writer.SetEncoding(encoding);
+	writer.SetDemosaic(demosaic);
+	writer.SetWorkerCpus(workerCpus);
+	if (streamWrite && !rawFormat) {
+	  writer.Start();
+	}
+
+	// one recording per camera, named after the start of the scan
+	std::vector<RawRecordingWriter> recording(numCameras);
+	std::vector<std::string> recordingName(numCameras);
+	if (rawFormat) {
+	  for (unsigned int cam=0; cam < numCameras; cam++) {
+	    char name[512];
+	    snprintf(name, sizeof(name), "./images/scan-%s-cam%u.fcraw", session, cam);
+	    recordingName[cam] = name;
+	    recording[cam].SetConfig(rawConfig);
+	    error = recording[cam].Open(recordingName[cam], cam);
+	    if (error != PGRERROR_OK) {
+	      printf("Could not create %s\n", recordingName[cam].c_str());
+	      PrintError( error );
+	      return -1;
+	    }
+
+	    // the frame size is known from the Format7 settings, so the whole
+	    // recording can be put on disk now rather than while the scan runs
+	    if (preallocate) {
+	      unsigned int frameSize = 0;
+	      error = GetFrameSize(pcam[cam], &frameSize);
+	      if (error == PGRERROR_OK) {
+	        error = recording[cam].Reserve(numImages, frameSize);
+	      }
+	      if (error != PGRERROR_OK) {
+	        printf("Not enough space for %d frames in %s\n", numImages, recordingName[cam].c_str());
+	        PrintError( error );
+	        return -1;
+	      }
+	      if (recording[cam].ReservedBytes() == 0) {
+	        printf("%s: the filesystem cannot preallocate, writing as the scan goes\n", recordingName[cam].c_str());
+	      } else {
+	        printf("%s: %.1f MB reserved\n", recordingName[cam].c_str(), recording[cam].ReservedBytes() / 1e6);
+	      }
+	    }
+	  }
+	}
+
+	std::chrono::steady_clock::time_point captureStart = std::chrono::steady_clock::now();
+
+	// one frame of every camera per scan step
+	std::vector<FrameHandle> group(numCameras);
 
 	for (int j=0; j < numImages; j++ ) {
 	    // first display the window with the slit
 	    // We will update the Mat object and update the slit position
+	    unsigned long long shownUs = HostTimeUs();
 
 	  // if the mode is slitscan, prepare the slit
 	  if (mode == 0) {
 	    for (int a = 400; a < 800; a++) {
 		if (j > 0) {
-		     projectedSlit.at<cv::Vec3b>(cv::Point(a, slitStart + (j - 1)*slitMove)) = black;
+		     projectedSlit.at<cv::Vec3b>(cv::Point(a, std::min(slitStart + (j - 1)*slitMove, slitLast))) = black;
 		}
-		projectedSlit.at<cv::Vec3b>(cv::Point(a, slitStart + j*slitMove)) = slit_color;
+		projectedSlit.at<cv::Vec3b>(cv::Point(a, std::min(slitStart + j*slitMove, slitLast))) = slit_color;
 	    }
 
-	    cv::imshow("Image1", projectedSlit);
-	    cv::waitKey(1);
+	    if (display) {
+	      cv::imshow("Image1", projectedSlit);
+	      cv::waitKey(1);
+	    }
 	  }
 
 	  // if the mode is calibration, we just show a white screen
 	  if (mode == 1) {
 	      cout << "Setting static illumination for calibration" << endl;
 	      projectedSlit = cv::Scalar(intensity, intensity, intensity);
-	      cv::imshow("Image1", projectedSlit);
-	      cv::waitKey(1);
+	      if (display) {
+	        cv::imshow("Image1", projectedSlit);
+	        cv::waitKey(1);
+	      }
 	  }
 
 
-	    // then we capture the image from both cameras
+	    // then we capture the image from every camera, taking only frames that
+	    // arrived once the slit had settled
+	    unsigned long long stepStartUs = settleUs > 0 ? shownUs + settleUs : HostTimeUs();
+	    if (triggered) {
+	      // fire so that the frames arrive no earlier than the settle time
+	      // after the slit was shown
+	      unsigned long long fireUs = stepStartUs - (settleUs > (int)triggerFrameUs ? triggerFrameUs : settleUs);
+	      if (fireUs > HostTimeUs()) {
+	        std::this_thread::sleep_for(std::chrono::microseconds(fireUs - HostTimeUs()));
+	      }
+
+	      // expose all cameras once for this slit position, as soon as every
+	      // one of them can take a trigger
+	      for (unsigned int cam=0; cam < numCameras; cam++) {
+	        error = WaitForTriggerReady(pcam[cam], triggerTimeoutMs);
+	        if (error != PGRERROR_OK) {
+	          PrintError( error );
+	        }
+	      }
+	      stepStartUs = HostTimeUs();
+	      error = FireSoftwareTrigger(numCameras, &pcam[0]);
+	      if (error != PGRERROR_OK) {
+	        PrintError( error );
+	      }
+	    }
+	    if (threaded) {
+	      if (engine.NextGroup(&group[0], stepStartUs, triggered ? triggerTimeoutMs : 5000)) {
+	        for (unsigned int cam=0; cam < numCameras; cam++) {
+	          vecFrames[cam][j] = group[cam];
+	          metaLog.Append(MakeMetadataRow(META_FRAME_USED, group[cam], j));
+	        }
+	      } else {
+	        printf("No frames from all cameras for image %d\n", j);
+	      }
+	    } else {
+	    // no arrival times to filter by, so wait out the settle time
+	    if (HostTimeUs() < stepStartUs) {
+	      std::this_thread::sleep_for(std::chrono::microseconds(stepStartUs - HostTimeUs()));
+	    }
 	    for (unsigned int cam=0; cam < numCameras; cam++) {
 		error = pcam[cam]->RetrieveBuffer( &rawImage );
 		if (error != PGRERROR_OK)
 		{
 		  PrintError( error );
+		  metaLog.Append(MakeGrabFailedRow(cam, error.GetType()));
 		  continue;
 		}
 
-		if(cam==0) {
-			vecImages1[j].DeepCopy(&rawImage);
+		if (zeroCopy) {
+			if (arena[cam].Claim(rawImage, cam, &vecFrames[cam][j])) {
+			  metaLog.Append(MakeMetadataRow(META_FRAME_USED, vecFrames[cam][j], j));
+			} else {
+			  metaLog.Append(MakeGrabFailedRow(cam, PGRERROR_FAILED));
+			}
+			continue;
+		}
+		metaLog.Append(MakeMetadataRow(META_FRAME_USED, cam, rawImage, j));
+		if (spooled) {
+			error = spool[cam].Store(j, rawImage);
+			if (error != PGRERROR_OK) {
+			  PrintError( error );
+			}
 		} else {
-			vecImages2[j].DeepCopy(&rawImage);
+			vecPooled[cam][j] = pool[cam].Copy(rawImage, cam, j);
 		}
 	    }
+	    }
+
+	    // move the frames out of the arena so its slots can be reused
+	    if (spooled && zeroCopy) {
+	      for (unsigned int cam=0; cam < numCameras; cam++) {
+	        if (vecFrames[cam][j].IsValid()) {
+	          error = spool[cam].Store(j, arena[cam], vecFrames[cam][j]);
+	          if (error != PGRERROR_OK) {
+	            PrintError( error );
+	          }
+	          arena[cam].Release(&vecFrames[cam][j]);
+	        }
+	      }
+	    }
+
+	    // hand the frames of this step to the writer; it owns them from now on
+	    if (streamWrite && rawFormat) {
+	      for (unsigned int cam=0; cam < numCameras; cam++) {
+	        // a camera with no frame this step must not report the last error again
+	        error = Error();
+	        if (zeroCopy && vecFrames[cam][j].IsValid()) {
+	          error = recording[cam].Append(arena[cam], vecFrames[cam][j], j);
+	          arena[cam].Release(&vecFrames[cam][j]);
+	        } else if (vecPooled[cam][j] != NULL) {
+	          PooledFrame* pFrame = vecPooled[cam][j];
+	          error = recording[cam].Append(pFrame->image, MakeFrameRecord(pFrame->info, j));
+	          pool[cam].Release(pFrame);
+	          vecPooled[cam][j] = NULL;
+	        }
+	        if (error != PGRERROR_OK) {
+	          PrintError( error );
+	        }
+	      }
+	    } else if (streamWrite) {
+	      for (unsigned int cam=0; cam < numCameras; cam++) {
+	        if (zeroCopy && vecFrames[cam][j].IsValid()) {
+	          writer.Submit(cam, j, &arena[cam], vecFrames[cam][j]);
+	          vecFrames[cam][j] = FrameHandle();
+	        } else if (vecPooled[cam][j] != NULL) {
+	          writer.Submit(cam, j, &pool[cam], vecPooled[cam][j]);
+	          vecPooled[cam][j] = NULL;
+	        }
+	      }
+	    }
 	    
 	    if (mode == 1) {
 		// cvDestroyWindow("Image1"); 
-		cv::waitKey(0);
+		if (display) {
+		  cv::waitKey(0);
+		}
 	        cout << "Captured image " << j << " of " << numImages << endl;
 		// cout << "Press ENTER to continue...";
 		// cin.ignore();
 	    }
 	}
 
+	std::chrono::steady_clock::time_point captureEnd = std::chrono::steady_clock::now();
+	double captureSeconds = std::chrono::duration<double>(captureEnd - captureStart).count();
+	// what the rig as a whole delivered, to see how it scales with views
+	unsigned long long capturedBytes = 0;
+	for (unsigned int cam=0; cam < numCameras; cam++) {
+	  capturedBytes += (unsigned long long)numImages * frameBytes[cam];
+	}
+	printf("Captured %d frames per camera from %u cameras in %.3f s (%.1f fps, %.1f MB/s in all)\n", numImages, numCameras,
+	       captureSeconds, numImages / captureSeconds, capturedBytes / 1e6 / captureSeconds);
+	if (zeroCopy) {
+	  for (unsigned int cam=0; cam < numCameras; cam++) {
+	    printf("camera %u: %u of %u arena slots in use at most, %u frames dropped on overrun\n", cam,
+	           arena[cam].HighWater(), arena[cam].NumSlots(), arena[cam].Overruns());
+	  }
+	}
+	if (pooled) {
+	  for (unsigned int cam=0; cam < numCameras; cam++) {
+	    printf("camera %u: %u of %u pool frames in use at most, pool empty %u times\n", cam,
+	           pool[cam].HighWater(), pool[cam].NumFrames(), pool[cam].Exhausted());
+	  }
+	}
+	if (spooled) {
+	  for (unsigned int cam=0; cam < numCameras; cam++) {
+	    printf("camera %u: %u frames spilled to the scratch file\n", cam, spool[cam].Spilled());
+	  }
+	}
+	if (threaded) {
+	  engine.PrintStats();
+	  engine.Stop();
+	}
+
+	// the drop counters at the end of the scan, next to the ones from its start
+	for (unsigned int i=0; i<numCameras; i++) {
+	  CameraStats stats;
+	  if (pcam[i]->GetStats( &stats ) == PGRERROR_OK) {
+	    metaLog.Append(MakeCameraStatsRow(i, stats));
+	  }
+	}
+	unsigned long long metaRows = metaLog.Rows();
+	unsigned long long metaLost = metaLog.Lost();
+	error = metaLog.Close();
+	if (error != PGRERROR_OK) {
+	  PrintError( error );
+	}
+	printf("%s: %llu rows, %llu lost\n", metaLogName, metaRows, metaLost);
+
 	// then destroy the window
-	cvDestroyWindow("Image1"); 
+	if (display) {
+	  cvDestroyWindow("Image1"); 
+	}
+
 
+	if (streamWrite && !rawFormat) {
+	  writer.Finish();
+	  printf("All frames on disk %.3f s after the last one was captured\n",
+	         std::chrono::duration<double>(std::chrono::steady_clock::now() - captureEnd).count());
+	  writer.PrintStats();
+	  if (writer.Stats().errors > 0) {
+	    PrintError( writer.LastError() );
+	  }
+	}
 
 	//Process and store the images captured
 	if (numCameras > 0) {
+  	if (rawFormat) {
+  	if (!streamWrite) {
+  	  for (int j=0; j < numImages; j++) {
+  	    for (unsigned int cam=0; cam < numCameras; cam++) {
+  	      error = Error();
+  	      if (spooled) {
+  	        Image image;
+  	        FrameHandle info;
+  	        if (!spool[cam].View(j, &image, &info)) {
+  	          continue;
+  	        }
+  	        error = recording[cam].Append(image, MakeFrameRecord(info, j));
+  	        spool[cam].Release(j);
+  	      } else if (zeroCopy && vecFrames[cam][j].IsValid()) {
+  	        error = recording[cam].Append(arena[cam], vecFrames[cam][j], j);
+  	        arena[cam].Release(&vecFrames[cam][j]);
+  	      } else if (vecPooled[cam][j] != NULL) {
+  	        PooledFrame* pFrame = vecPooled[cam][j];
+  	        error = recording[cam].Append(pFrame->image, MakeFrameRecord(pFrame->info, j));
+  	        pool[cam].Release(pFrame);
+  	        vecPooled[cam][j] = NULL;
+  	      }
+  	      if (error != PGRERROR_OK) {
+  	        PrintError( error );
+  	      }
+  	    }
+  	  }
+  	}
+  	for (unsigned int cam=0; cam < numCameras; cam++) {
+  	  error = recording[cam].Close();
+  	  if (error != PGRERROR_OK) {
+  	    PrintError( error );
+  	  }
+  	  printf("%s: %llu frames, %.1f MB written in %.3f s%s, %.1f MB as RGB\n", recordingName[cam].c_str(), recording[cam].NumFrames(),
+  	         recording[cam].BytesWritten() / 1e6, recording[cam].WriteUs() / 1e6,
+  	         recording[cam].IsDirect() ? " (O_DIRECT)" : "",
+  	         3.0 * recording[cam].Header().rows * recording[cam].Header().cols * recording[cam].NumFrames() / 1e6);
+  	  AsyncWriter::PrintStats(recordingName[cam].c_str(), recording[cam].BackendName(), recording[cam].WriterStats());
+  	}
+  	printf("All frames on disk %.3f s after the last one was captured\n",
+  	       std::chrono::duration<double>(std::chrono::steady_clock::now() - captureEnd).count());
+  	} else if (!streamWrite) {
   	printf("Saving images.. please wait\n");
+  	std::chrono::steady_clock::time_point saveStart = std::chrono::steady_clock::now();
+  	// the arena slots stay untouched until released, so the writers work
+  	// straight out of them and release each one once it is saved
+  	FrameWriter saver("./images", 2 * saveThreads, saveThreads, numCameras);
+  	saver.SetEncoding(encoding);
+  	saver.SetDemosaic(demosaic);
+  	saver.SetWorkerCpus(workerCpus);
+  	saver.Start();
   	for (int j=0; j < numImages; j++) {
-  		error = vecImages1[j].Convert( PIXEL_FORMAT_RGB, &convertedImage );
-                  if (error != PGRERROR_OK)
-                  {
-                    PrintError( error );
-                    return -1;
-                  }
-
-                  // Create a unique filename
-                  char filename[512];
-                  sprintf( filename, "./images/cam--%d-%d.tiff", 0, j);
-
-                  // Save the image. If a file format is not passed in, then the file
-                  // extension is parsed to attempt to determine the file format.
-                  error = convertedImage.Save( filename );
-                  if (error != PGRERROR_OK)
-                  {
-                    PrintError( error );
-                    return -1;
-                  }
-  		            //Do the same for the second camera
-  		            error = vecImages2[j].Convert( PIXEL_FORMAT_RGB, &convertedImage );
-                  if (error != PGRERROR_OK)
-                  {
-                    PrintError( error );
-                    return -1;
-                  }
-
-                  // Create a unique filename
-                  char filename2[512];
-                  sprintf( filename2, "./images/cam--%d-%d.tiff", 1, j);
-
-                  // Save the image. If a file format is not passed in, then the file
-                  // extension is parsed to attempt to determine the file format.
-                  error = convertedImage.Save( filename2 );
-                  if (error != PGRERROR_OK)
-                  {
-                    PrintError( error );
-                    return -1;
-                  }
+  	  for (unsigned int cam=0; cam < numCameras; cam++) {
+  	    if (spooled) {
+  	      if (spool[cam].IsStored(j))
+  	        saver.Submit(cam, j, &spool[cam]);
+  	    } else if (zeroCopy && vecFrames[cam][j].IsValid()) {
+  	      saver.Submit(cam, j, &arena[cam], vecFrames[cam][j]);
+  	      vecFrames[cam][j] = FrameHandle();
+  	    } else if (vecPooled[cam][j] != NULL) {
+  	      saver.Submit(cam, j, &pool[cam], vecPooled[cam][j]);
+  	      vecPooled[cam][j] = NULL;
+  	    }
+  	  }
+  	}
+  	saver.Finish();
+  	double saveSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - saveStart).count();
+  	printf("Saved %d frames per camera from %u cameras in %.3f s (%.1f frames/s in all)\n", numImages, numCameras,
+  	       saveSeconds, numImages * numCameras / saveSeconds);
+  	saver.PrintStats();
+  	if (saver.Stats().errors > 0) {
+  	  PrintError( saver.LastError() );
+  	}
   	}
+
+    	tlbMisses.Stop();
+    	tlbMisses.Print("capture and save", (unsigned long long)numImages * numCameras);
+    	nodeTraffic.Stop();
+    	if (numaPlacement) {
+    	  for (unsigned int i=0; i<numCameras; i++) {
+    	    nodeTraffic.AddFrames(placement[i].node, (unsigned long long)numImages * frameBytes[i]);
+    	  }
+    	  nodeTraffic.Print(captureSeconds);
+    	}
+
     	for ( unsigned int i = 0; i < numCameras; i++ )
     	{
+        	CameraStats stats;
+        	if (pcam[i]->GetStats( &stats ) == PGRERROR_OK) {
+        	  printf("camera %u: %u dropped, %u corrupt, %u failed\n", i,
+        	         stats.imageDropped, stats.imageCorrupt, stats.imageXmitFailed);
+        	}
+        	if (source == 2) {
+        	  ((ReplayCamera*)pcam[i])->PrintStats();
+        	}
+        	if (triggered) {
+        	  SetSoftwareTrigger(pcam[i], false);
+        	}
         	pcam[i]->StopCapture();
         	pcam[i]->Disconnect();
 	        delete pcam[i];
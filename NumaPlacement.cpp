@@ -0,0 +1,360 @@
+/*****************************************************************
+  NUMA PLACEMENT
+
+  See NumaPlacement.h.
+
+*****************************************************************/
+
+#include "NumaPlacement.h"
+#include "CameraUtils.h"
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    const char* sk_usbDevices = "/sys/bus/usb/devices";
+    const char* sk_nodes = "/sys/devices/system/node";
+    const unsigned int sk_pointGreyVendor = 0x1e10;
+
+    // from <numaif.h>, which needs libnuma
+    const int sk_mpolPreferred = 1;
+
+    std::string ReadLine( const std::string& path )
+    {
+        char line[4096];
+        FILE* f = fopen( path.c_str(), "r" );
+        if ( f == NULL )
+        {
+            return std::string();
+        }
+        if ( fgets( line, sizeof( line ), f ) == NULL )
+        {
+            line[0] = 0;
+        }
+        fclose( f );
+        size_t length = strlen( line );
+        while ( length > 0 && ( line[length - 1] == '\n' || line[length - 1] == ' ' ) )
+        {
+            line[--length] = 0;
+        }
+        return line;
+    }
+
+    bool Exists( const std::string& path )
+    {
+        return access( path.c_str(), F_OK ) == 0;
+    }
+
+    // the USB serial string is the camera serial, in decimal on some
+    // models and in hex on others
+    bool SerialMatches( const std::string& serial, unsigned int serialNumber )
+    {
+        if ( serial.empty() )
+        {
+            return false;
+        }
+        return strtoull( serial.c_str(), NULL, 10 ) == serialNumber || strtoull( serial.c_str(), NULL, 16 ) == serialNumber;
+    }
+
+    // the first directory above the USB device that has a numa_node is the
+    // controller's PCI device
+    bool FindController( const std::string& device, std::string* pController )
+    {
+        char resolved[PATH_MAX];
+        if ( realpath( device.c_str(), resolved ) == NULL )
+        {
+            return false;
+        }
+        std::string path = resolved;
+        while ( path.size() > strlen( "/sys/devices" ) )
+        {
+            if ( Exists( path + "/numa_node" ) )
+            {
+                *pController = path;
+                return true;
+            }
+            path = path.substr( 0, path.rfind( '/' ) );
+        }
+        return false;
+    }
+}
+
+unsigned int NumNumaNodes()
+{
+    unsigned int numNodes = 0;
+    DIR* pDir = opendir( sk_nodes );
+    if ( pDir == NULL )
+    {
+        return 1;
+    }
+    struct dirent* pEntry;
+    while ( ( pEntry = readdir( pDir ) ) != NULL )
+    {
+        unsigned int node;
+        if ( sscanf( pEntry->d_name, "node%u", &node ) == 1 )
+        {
+            numNodes++;
+        }
+    }
+    closedir( pDir );
+    return numNodes > 0 ? numNodes : 1;
+}
+
+Error FindCameraPlacement( BusManager* pBusManager, PGRGuid guid, const CameraInfo& camInfo, CameraPlacement* pPlacement )
+{
+    *pPlacement = CameraPlacement();
+    pBusManager->GetUsbLinkInfo( guid, &pPlacement->usbLink );
+
+    DIR* pDir = opendir( sk_usbDevices );
+    if ( pDir == NULL )
+    {
+        return FailureError();
+    }
+
+    // prefer the serial number; the bus number only if it is unambiguous
+    std::string bySerial;
+    std::string byBus;
+    unsigned int onBus = 0;
+    struct dirent* pEntry;
+    while ( ( pEntry = readdir( pDir ) ) != NULL )
+    {
+        // interfaces are named <port>:<config>.<interface>
+        if ( pEntry->d_name[0] == '.' || strchr( pEntry->d_name, ':' ) != NULL )
+        {
+            continue;
+        }
+        std::string device = std::string( sk_usbDevices ) + "/" + pEntry->d_name;
+        if ( strtoul( ReadLine( device + "/idVendor" ).c_str(), NULL, 16 ) != sk_pointGreyVendor )
+        {
+            continue;
+        }
+        if ( SerialMatches( ReadLine( device + "/serial" ), camInfo.serialNumber ) )
+        {
+            bySerial = device;
+        }
+        if ( (unsigned int)atoi( ReadLine( device + "/busnum" ).c_str() ) == camInfo.busNumber )
+        {
+            byBus = device;
+            onBus++;
+        }
+    }
+    closedir( pDir );
+
+    std::string device = !bySerial.empty() ? bySerial : onBus == 1 ? byBus : std::string();
+    if ( device.empty() || !FindController( device, &pPlacement->controller ) )
+    {
+        return FailureError();
+    }
+
+    // a machine without NUMA reports -1
+    int node = atoi( ReadLine( pPlacement->controller + "/numa_node" ).c_str() );
+    pPlacement->node = node >= 0 ? node : 0;
+    if ( !ParseCpuList( ReadLine( pPlacement->controller + "/local_cpulist" ).c_str(), &pPlacement->cpus ) )
+    {
+        SetPlacementNode( pPlacement->node, pPlacement );
+    }
+    return Error();
+}
+
+bool SetPlacementNode( int node, CameraPlacement* pPlacement )
+{
+    char path[256];
+    snprintf( path, sizeof( path ), "%s/node%d/cpulist", sk_nodes, node );
+    cpu_set_t cpus;
+    if ( node < 0 || !ParseCpuList( ReadLine( path ).c_str(), &cpus ) )
+    {
+        return false;
+    }
+    pPlacement->node = node;
+    pPlacement->cpus = cpus;
+    return true;
+}
+
+bool ParseCpuList( const char* pList, cpu_set_t* pCpus )
+{
+    CPU_ZERO( pCpus );
+    const char* p = pList;
+    while ( *p != 0 )
+    {
+        char* pEnd;
+        long first = strtol( p, &pEnd, 10 );
+        if ( pEnd == p || first < 0 )
+        {
+            return false;
+        }
+        long last = first;
+        p = pEnd;
+        if ( *p == '-' )
+        {
+            last = strtol( p + 1, &pEnd, 10 );
+            if ( pEnd == p + 1 || last < first )
+            {
+                return false;
+            }
+            p = pEnd;
+        }
+        for ( long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++ )
+        {
+            CPU_SET( cpu, pCpus );
+        }
+        if ( *p == ',' )
+        {
+            p++;
+        }
+        else if ( *p != 0 )
+        {
+            return false;
+        }
+    }
+    return CPU_COUNT( pCpus ) > 0;
+}
+
+std::string FormatCpuList( const cpu_set_t& cpus )
+{
+    std::string list;
+    for ( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+    {
+        if ( !CPU_ISSET( cpu, &cpus ) )
+        {
+            continue;
+        }
+        int last = cpu;
+        while ( last + 1 < CPU_SETSIZE && CPU_ISSET( last + 1, &cpus ) )
+        {
+            last++;
+        }
+        char range[32];
+        snprintf( range, sizeof( range ), last > cpu ? "%s%d-%d" : "%s%d", list.empty() ? "" : ",", cpu, last );
+        list += range;
+        cpu = last;
+    }
+    return list;
+}
+
+bool PinThread( const cpu_set_t& cpus )
+{
+    if ( CPU_COUNT( &cpus ) == 0 )
+    {
+        return false;
+    }
+    return pthread_setaffinity_np( pthread_self(), sizeof( cpus ), &cpus ) == 0;
+}
+
+bool BindToNode( void* pBase, size_t size, int node )
+{
+    if ( node < 0 || pBase == NULL || size == 0 )
+    {
+        return false;
+    }
+    unsigned long mask[16];
+    if ( node >= (int)( sizeof( mask ) * 8 ) )
+    {
+        return false;
+    }
+    memset( mask, 0, sizeof( mask ) );
+    mask[node / ( 8 * sizeof( unsigned long ) )] = 1UL << ( node % ( 8 * sizeof( unsigned long ) ) );
+
+    // preferred rather than bound, so a full node falls back to another
+    // instead of failing the allocation
+    return syscall( __NR_mbind, pBase, size, sk_mpolPreferred, mask, sizeof( mask ) * 8 + 1, 0 ) == 0;
+}
+
+void NodeTraffic::Read( std::vector<NodeCounters>* pCounters )
+{
+    pCounters->clear();
+    DIR* pDir = opendir( sk_nodes );
+    if ( pDir == NULL )
+    {
+        return;
+    }
+    struct dirent* pEntry;
+    while ( ( pEntry = readdir( pDir ) ) != NULL )
+    {
+        unsigned int node;
+        if ( sscanf( pEntry->d_name, "node%u", &node ) != 1 )
+        {
+            continue;
+        }
+        if ( node >= pCounters->size() )
+        {
+            pCounters->resize( node + 1 );
+        }
+        NodeCounters& counters = ( *pCounters )[node];
+
+        std::string path = std::string( sk_nodes ) + "/" + pEntry->d_name + "/numastat";
+        FILE* f = fopen( path.c_str(), "r" );
+        if ( f == NULL )
+        {
+            continue;
+        }
+        char name[64];
+        unsigned long long value;
+        while ( fscanf( f, "%63s %llu", name, &value ) == 2 )
+        {
+            if ( !strcmp( name, "numa_hit" ) ) counters.hit = value;
+            else if ( !strcmp( name, "numa_miss" ) ) counters.miss = value;
+            else if ( !strcmp( name, "numa_foreign" ) ) counters.foreign = value;
+            else if ( !strcmp( name, "local_node" ) ) counters.local = value;
+            else if ( !strcmp( name, "other_node" ) ) counters.other = value;
+        }
+        fclose( f );
+    }
+    closedir( pDir );
+}
+
+void NodeTraffic::Start()
+{
+    Read( &m_start );
+    m_delta.assign( m_start.size(), NodeCounters() );
+}
+
+void NodeTraffic::AddFrames( int node, unsigned long long numBytes )
+{
+    if ( node < 0 )
+    {
+        return;
+    }
+    if ( (size_t)node >= m_delta.size() )
+    {
+        m_delta.resize( node + 1 );
+    }
+    m_delta[node].frameBytes += numBytes;
+}
+
+void NodeTraffic::Stop()
+{
+    std::vector<NodeCounters> end;
+    Read( &end );
+    if ( end.size() > m_delta.size() )
+    {
+        m_delta.resize( end.size() );
+    }
+    for ( size_t node = 0; node < end.size() && node < m_start.size(); node++ )
+    {
+        m_delta[node].hit = end[node].hit - m_start[node].hit;
+        m_delta[node].miss = end[node].miss - m_start[node].miss;
+        m_delta[node].foreign = end[node].foreign - m_start[node].foreign;
+        m_delta[node].local = end[node].local - m_start[node].local;
+        m_delta[node].other = end[node].other - m_start[node].other;
+    }
+}
+
+void NodeTraffic::Print( double seconds ) const
+{
+    for ( size_t node = 0; node < m_delta.size(); node++ )
+    {
+        const NodeCounters& counters = m_delta[node];
+        printf( "node %u: %.1f MB/s of frames, pages allocated %llu as asked, %llu for another node, "
+                "%llu from local threads, %llu from remote ones; %llu meant for it went elsewhere\n",
+                (unsigned int)node, seconds > 0.0 ? counters.frameBytes / 1e6 / seconds : 0.0,
+                counters.hit, counters.miss, counters.local, counters.other, counters.foreign );
+    }
+}
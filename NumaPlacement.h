@@ -0,0 +1,102 @@
+/*****************************************************************
+  NUMA PLACEMENT
+
+  On a machine with more than one NUMA node, each USB3 host controller
+  sits on the PCI bus of one of them. Frames DMA'd by that controller land
+  fastest in that node's memory, and the threads that touch them next run
+  best on that node's cores. This finds, for each camera, the controller
+  it is plugged into and that controller's node, through sysfs:
+
+      /sys/bus/usb/devices/<port>       the camera, matched by vendor and
+                                        serial number (or bus number)
+        -> .../0000:00:14.0/usb2/...    its path goes through the
+                                        controller's PCI device, which has
+           numa_node, local_cpulist     the node and the cores next to it
+
+  The grab thread, the writer workers and the frame buffers of each camera
+  can then be kept on that node. NodeTraffic reads the kernel's per-node
+  allocation counters and the frame bytes per node around the scan, so
+  the placement can be checked.
+
+*****************************************************************/
+
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+#include "FlyCapture2.h"
+#include <sched.h>
+#include <string>
+#include <vector>
+
+struct CameraPlacement
+{
+    int node;                       // NUMA node, -1 if unknown
+    cpu_set_t cpus;                 // cores to run the camera's threads on, empty if unknown
+    std::string controller;         // sysfs path of the USB host controller
+    unsigned int usbLink;           // BusManager::GetUsbLinkInfo, 0 if unknown
+
+    CameraPlacement() : node( -1 ), usbLink( 0 ) { CPU_ZERO( &cpus ); }
+
+    bool IsKnown() const { return node >= 0; }
+};
+
+// Number of NUMA nodes online, 1 on a machine without NUMA.
+unsigned int NumNumaNodes();
+
+// Finds the controller and node of a camera on the bus. Fails if the
+// camera cannot be found in sysfs, e.g. a synthetic one.
+FlyCapture2::Error FindCameraPlacement(
+    FlyCapture2::BusManager* pBusManager,
+    FlyCapture2::PGRGuid guid,
+    const FlyCapture2::CameraInfo& camInfo,
+    CameraPlacement* pPlacement );
+
+// Places a camera on node by hand; the cores are all of the node's.
+bool SetPlacementNode( int node, CameraPlacement* pPlacement );
+
+// "0-3,8-11" style, as in sysfs.
+bool ParseCpuList( const char* pList, cpu_set_t* pCpus );
+std::string FormatCpuList( const cpu_set_t& cpus );
+
+// Runs the calling thread on cpus only. Does nothing for an empty set.
+bool PinThread( const cpu_set_t& cpus );
+
+// Asks for the pages of [pBase, pBase + size) to come from node. Must be
+// called before the memory is first touched. Does nothing for node -1.
+bool BindToNode( void* pBase, size_t size, int node );
+
+// Per node: the kernel's page allocation counters (system wide) and the
+// frame bytes the cameras on that node delivered, between Start() and
+// Stop().
+class NodeTraffic
+{
+public:
+    void Start();
+    void Stop();
+
+    // Frames of numBytes from a camera placed on node.
+    void AddFrames( int node, unsigned long long numBytes );
+
+    // One line per node.
+    void Print( double seconds ) const;
+
+private:
+    struct NodeCounters
+    {
+        unsigned long long hit;         // allocations that got the node they wanted
+        unsigned long long miss;        // wanted another node but landed here
+        unsigned long long foreign;     // wanted this node but landed elsewhere
+        unsigned long long local;       // allocated by a thread running on the node
+        unsigned long long other;       // allocated here by a thread on another node
+        unsigned long long frameBytes;
+
+        NodeCounters() : hit( 0 ), miss( 0 ), foreign( 0 ), local( 0 ), other( 0 ), frameBytes( 0 ) {}
+    };
+
+    static void Read( std::vector<NodeCounters>* pCounters );
+
+    std::vector<NodeCounters> m_start;
+    std::vector<NodeCounters> m_delta;
+};
+
+#endif // NUMA_PLACEMENT_H
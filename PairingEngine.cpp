@@ -0,0 +1,305 @@
+/*****************************************************************
+  PAIRING ENGINE
+
+  See PairingEngine.h.
+
+*****************************************************************/
+
+#include "PairingEngine.h"
+#include "CameraUtils.h"
+#include <cstdio>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // the cycle time seconds field counts modulo 128
+    const unsigned long long sk_cycleWrapUs = 128000000ULL;
+}
+
+PairingEngine::PairingEngine( unsigned int numCameras, unsigned int toleranceUs )
+{
+    Reset( numCameras, toleranceUs );
+}
+
+void PairingEngine::Reset( unsigned int numCameras, unsigned int toleranceUs )
+{
+    m_numCameras = numCameras;
+    m_toleranceUs = toleranceUs;
+
+    CameraState state;
+    state.seen = false;
+    state.lastTimeUs = 0;
+    state.haveOffset = false;
+    state.offsetUs = 0;
+    state.offsetFrames = 0;
+    state.lastCameraUs = 0;
+    state.wrapUs = 0;
+    state.haveCounter = false;
+    state.lastCounter = 0;
+    m_cameras.assign( numCameras, state );
+
+    m_groups.clear();
+    m_orphans.clear();
+    m_orphanLog.clear();
+    m_firstTimeUs = 0;
+
+    m_stats.groups = 0;
+    m_stats.maxSkewUs = 0;
+    m_stats.totalSkewUs = 0;
+    m_stats.frames.assign( numCameras, 0 );
+    m_stats.orphans.assign( numCameras, 0 );
+    m_stats.counterGaps.assign( numCameras, 0 );
+    m_stats.offsetSumUs.assign( numCameras, 0 );
+    m_stats.minOffsetUs.assign( numCameras, 0 );
+    m_stats.maxOffsetUs.assign( numCameras, 0 );
+}
+
+unsigned long long PairingEngine::CaptureTimeUs( const FrameHandle& frame )
+{
+    CameraState& state = m_cameras[frame.camera];
+
+    unsigned long long cameraUs;
+    const TimeStamp& timeStamp = frame.timeStamp;
+    if ( frame.metadata.embeddedTimeStamp != 0 )
+    {
+        cameraUs = EmbeddedTimeStampUs( frame.metadata.embeddedTimeStamp );
+    }
+    else if ( timeStamp.cycleSeconds != 0 || timeStamp.cycleCount != 0 || timeStamp.cycleOffset != 0 )
+    {
+        cameraUs = CycleTimeUs( timeStamp.cycleSeconds, timeStamp.cycleCount, timeStamp.cycleOffset );
+    }
+    else
+    {
+        return frame.hostTimeUs;
+    }
+
+    if ( state.haveOffset && cameraUs + sk_cycleWrapUs / 2 < state.lastCameraUs )
+    {
+        state.wrapUs += sk_cycleWrapUs;
+    }
+    state.lastCameraUs = cameraUs;
+    cameraUs += state.wrapUs;
+
+    // the frame that reached us fastest gives the best estimate of the
+    // offset; only recent frames count, as the clocks drift apart
+    OffsetSample sample;
+    sample.frame = state.offsetFrames++;
+    sample.offsetUs = (long long)frame.hostTimeUs - (long long)cameraUs;
+    while ( !state.offsets.empty() && state.offsets.back().offsetUs >= sample.offsetUs )
+    {
+        state.offsets.pop_back();
+    }
+    state.offsets.push_back( sample );
+    while ( state.offsets.front().frame + sk_offsetWindow <= sample.frame )
+    {
+        state.offsets.pop_front();
+    }
+    state.offsetUs = state.offsets.front().offsetUs;
+    state.haveOffset = true;
+    return (unsigned long long)( (long long)cameraUs + state.offsetUs );
+}
+
+void PairingEngine::Push( const FrameHandle& frame )
+{
+    if ( frame.camera >= m_numCameras )
+    {
+        m_orphans.push_back( frame );
+        return;
+    }
+
+    unsigned int camera = frame.camera;
+    CameraState& state = m_cameras[camera];
+    m_stats.frames[camera]++;
+
+    unsigned int counter = frame.metadata.embeddedFrameCounter;
+    if ( state.haveCounter && counter > state.lastCounter + 1 )
+    {
+        m_stats.counterGaps[camera] += counter - state.lastCounter - 1;
+    }
+    if ( state.haveCounter || counter != 0 )
+    {
+        state.haveCounter = true;
+        state.lastCounter = counter;
+    }
+
+    Pending pending;
+    pending.frame = frame;
+    pending.timeUs = CaptureTimeUs( frame );
+    state.pending.push_back( pending );
+    if ( !state.seen || pending.timeUs > state.lastTimeUs )
+    {
+        state.lastTimeUs = pending.timeUs;
+    }
+    state.seen = true;
+    if ( m_firstTimeUs == 0 )
+    {
+        m_firstTimeUs = pending.timeUs;
+    }
+
+    // a camera that never delivers must not make the others queue forever
+    if ( state.pending.size() > sk_maxPending )
+    {
+        Orphan( camera );
+    }
+
+    Match();
+}
+
+void PairingEngine::Match()
+{
+    for (;;)
+    {
+        // the earliest time each camera can still deliver: its oldest
+        // waiting frame, or if none waits, after its newest frame so far
+        unsigned long long latestUs = 0;
+        bool complete = true;
+        for ( unsigned int i = 0; i < m_numCameras; i++ )
+        {
+            const CameraState& state = m_cameras[i];
+            if ( !state.pending.empty() )
+            {
+                if ( state.pending.front().timeUs > latestUs )
+                {
+                    latestUs = state.pending.front().timeUs;
+                }
+            }
+            else
+            {
+                complete = false;
+                if ( state.seen && state.lastTimeUs > latestUs )
+                {
+                    latestUs = state.lastTimeUs;
+                }
+            }
+        }
+
+        bool orphaned = false;
+        for ( unsigned int i = 0; i < m_numCameras; i++ )
+        {
+            CameraState& state = m_cameras[i];
+            if ( !state.pending.empty() && state.pending.front().timeUs + m_toleranceUs < latestUs )
+            {
+                Orphan( i );
+                orphaned = true;
+            }
+        }
+        if ( orphaned )
+        {
+            continue;
+        }
+        if ( !complete || m_numCameras == 0 )
+        {
+            return;
+        }
+
+        // every head is within the tolerance of the latest one
+        unsigned long long earliestUs = latestUs;
+        unsigned long long referenceUs = m_cameras[0].pending.front().timeUs;
+        for ( unsigned int i = 0; i < m_numCameras; i++ )
+        {
+            CameraState& state = m_cameras[i];
+            unsigned long long timeUs = state.pending.front().timeUs;
+            if ( timeUs < earliestUs )
+            {
+                earliestUs = timeUs;
+            }
+            long long offsetUs = (long long)timeUs - (long long)referenceUs;
+            m_stats.offsetSumUs[i] += offsetUs;
+            if ( m_stats.groups == 0 || offsetUs < m_stats.minOffsetUs[i] )
+            {
+                m_stats.minOffsetUs[i] = offsetUs;
+            }
+            if ( m_stats.groups == 0 || offsetUs > m_stats.maxOffsetUs[i] )
+            {
+                m_stats.maxOffsetUs[i] = offsetUs;
+            }
+            m_groups.push_back( state.pending.front().frame );
+            state.pending.pop_front();
+        }
+        unsigned long long skewUs = latestUs - earliestUs;
+        m_stats.groups++;
+        m_stats.totalSkewUs += skewUs;
+        if ( skewUs > m_stats.maxSkewUs )
+        {
+            m_stats.maxSkewUs = skewUs;
+        }
+    }
+}
+
+void PairingEngine::Orphan( unsigned int camera )
+{
+    CameraState& state = m_cameras[camera];
+    const Pending& pending = state.pending.front();
+    if ( m_orphanLog.size() < sk_maxReportedOrphans )
+    {
+        OrphanRecord record;
+        record.camera = camera;
+        record.frameCounter = pending.frame.metadata.embeddedFrameCounter;
+        record.timeUs = pending.timeUs;
+        m_orphanLog.push_back( record );
+    }
+    m_stats.orphans[camera]++;
+    m_orphans.push_back( pending.frame );
+    state.pending.pop_front();
+}
+
+bool PairingEngine::PopGroup( FrameHandle* pFrames )
+{
+    if ( m_numCameras == 0 || m_groups.size() < m_numCameras )
+    {
+        return false;
+    }
+    for ( unsigned int i = 0; i < m_numCameras; i++ )
+    {
+        pFrames[i] = m_groups.front();
+        m_groups.pop_front();
+    }
+    return true;
+}
+
+bool PairingEngine::PopOrphan( FrameHandle* pFrame )
+{
+    if ( m_orphans.empty() )
+    {
+        return false;
+    }
+    *pFrame = m_orphans.front();
+    m_orphans.pop_front();
+    return true;
+}
+
+void PairingEngine::Flush()
+{
+    for ( unsigned int i = 0; i < m_numCameras; i++ )
+    {
+        while ( !m_cameras[i].pending.empty() )
+        {
+            Orphan( i );
+        }
+    }
+}
+
+void PairingEngine::PrintReport() const
+{
+    printf( "pairing: %llu groups within %u us, skew mean %.1f us, max %llu us\n",
+            m_stats.groups, m_toleranceUs,
+            m_stats.groups > 0 ? (double)m_stats.totalSkewUs / m_stats.groups : 0.0,
+            m_stats.maxSkewUs );
+    for ( unsigned int i = 0; i < m_numCameras; i++ )
+    {
+        printf( "camera %u: %llu frames, %llu orphans, %llu missing by frame counter\n", i,
+                m_stats.frames[i], m_stats.orphans[i], m_stats.counterGaps[i] );
+        if ( i > 0 && m_stats.groups > 0 )
+        {
+            printf( "camera %u vs camera 0: offset mean %.1f us, min %lld us, max %lld us\n", i,
+                    (double)m_stats.offsetSumUs[i] / m_stats.groups, m_stats.minOffsetUs[i], m_stats.maxOffsetUs[i] );
+        }
+    }
+    for ( unsigned int i = 0; i < m_orphanLog.size(); i++ )
+    {
+        const OrphanRecord& record = m_orphanLog[i];
+        printf( "  orphan: camera %u, frame counter %u, at %.3f ms\n", record.camera, record.frameCounter,
+                ( (long long)record.timeUs - (long long)m_firstTimeUs ) / 1000.0 );
+    }
+}
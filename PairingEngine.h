@@ -0,0 +1,134 @@
+/*****************************************************************
+  PAIRING ENGINE
+
+  Matches frames across cameras by capture time instead of by loop index,
+  so a dropped or failed frame on one camera costs one orphan instead of
+  shifting every later pair.
+
+  Capture time comes from the embedded timestamp when the camera writes
+  one, else from the cycle time in Image::GetTimeStamp(), else from the
+  host arrival time. Camera clocks are free running, so each camera's time
+  is mapped onto the host clock with the smallest host-minus-camera offset
+  of its last frames (the frame with the least transfer latency). Taking
+  the minimum over a window rather than the whole stream lets the mapping
+  follow a camera clock that drifts against the host's, in either
+  direction.
+
+  Frames of one camera arrive in time order. A frame whose time is more
+  than the tolerance before the earliest frame another camera can still
+  deliver can never be matched and becomes an orphan; when the heads of
+  all cameras lie within the tolerance they are emitted as one group.
+  Every frame is looked at a bounded number of times, so the cost per frame
+  is O(1) amortized for a fixed number of cameras.
+
+  Not thread safe; meant to be driven by the single consumer thread.
+
+*****************************************************************/
+
+#ifndef PAIRING_ENGINE_H
+#define PAIRING_ENGINE_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include <vector>
+#include <deque>
+
+struct PairingStats
+{
+    unsigned long long groups;                  // matched groups emitted
+    unsigned long long maxSkewUs;               // largest time spread inside a group
+    unsigned long long totalSkewUs;
+    std::vector<unsigned long long> frames;     // frames pushed, per camera
+    std::vector<unsigned long long> orphans;    // frames that found no partner, per camera
+    std::vector<unsigned long long> counterGaps;// frames missing by the embedded frame counter, per camera
+
+    // capture time of each camera's frame minus camera 0's, over all groups
+    std::vector<long long> offsetSumUs;
+    std::vector<long long> minOffsetUs;
+    std::vector<long long> maxOffsetUs;
+};
+
+class PairingEngine
+{
+public:
+    // Frames a camera may have waiting for a partner; the oldest one
+    // becomes an orphan when another arrives.
+    static const unsigned int sk_maxPending = 64;
+
+    // toleranceUs is the largest capture time difference still treated as
+    // the same exposure; keep it below half a frame period.
+    PairingEngine( unsigned int numCameras = 0, unsigned int toleranceUs = 0 );
+
+    void Reset( unsigned int numCameras, unsigned int toleranceUs );
+
+    // Adds a frame of camera frame.camera.
+    void Push( const FrameHandle& frame );
+
+    // Takes the next matched group, one frame per camera in pFrames[camera].
+    bool PopGroup( FrameHandle* pFrames );
+
+    // Takes the next frame that could not be matched. The caller releases it.
+    bool PopOrphan( FrameHandle* pFrame );
+
+    // End of stream: everything still waiting for a partner becomes an orphan.
+    void Flush();
+
+    unsigned int ToleranceUs() const { return m_toleranceUs; }
+    const PairingStats& Stats() const { return m_stats; }
+    void PrintReport() const;
+
+private:
+    struct Pending
+    {
+        FrameHandle frame;
+        unsigned long long timeUs;
+    };
+
+    struct OrphanRecord
+    {
+        unsigned int camera;
+        unsigned int frameCounter;
+        unsigned long long timeUs;
+    };
+
+    struct OffsetSample
+    {
+        unsigned long long frame;               // which of the camera's frames
+        long long offsetUs;
+    };
+
+    struct CameraState
+    {
+        std::deque<Pending> pending;
+        bool seen;
+        unsigned long long lastTimeUs;          // time of the newest frame pushed
+        bool haveOffset;
+        long long offsetUs;                     // host minus camera clock
+        // candidates for the smallest offset in the window, increasing
+        std::deque<OffsetSample> offsets;
+        unsigned long long offsetFrames;        // frames with a camera time so far
+        unsigned long long lastCameraUs;        // for unwrapping the 128 s cycle time
+        unsigned long long wrapUs;
+        bool haveCounter;
+        unsigned int lastCounter;
+    };
+
+    // capture time of a frame on the host clock; updates the clock mapping
+    unsigned long long CaptureTimeUs( const FrameHandle& frame );
+    void Match();
+    void Orphan( unsigned int camera );
+
+    static const unsigned int sk_offsetWindow = 256;
+    static const unsigned int sk_maxReportedOrphans = 16;
+
+    unsigned int m_numCameras;
+    unsigned int m_toleranceUs;
+    std::vector<CameraState> m_cameras;
+    std::deque<FrameHandle> m_groups;           // numCameras handles per group
+    std::deque<FrameHandle> m_orphans;
+    std::vector<OrphanRecord> m_orphanLog;
+    unsigned long long m_firstTimeUs;
+    PairingStats m_stats;
+};
+
+#endif // PAIRING_ENGINE_H
@@ -0,0 +1,74 @@
+/*****************************************************************
+  PATTERN DISPLAY
+
+  See PatternDisplay.h.
+
+*****************************************************************/
+
+#include "PatternDisplay.h"
+#include "CameraUtils.h"
+
+void WindowDisplay::Show( const cv::Mat& pattern )
+{
+    cv::imshow( m_windowName, pattern );
+    cv::waitKey( 1 );
+}
+
+SimulatedDisplay::SimulatedDisplay( const SimulatedDisplayConfig& config )
+    : m_config( config ),
+      m_originUs( HostTimeUs() ),
+      m_numShown( 0 )
+{
+    if ( m_config.refreshRate <= 0.0f )
+    {
+        m_config.refreshRate = 60.0f;
+    }
+}
+
+void SimulatedDisplay::Show( const cv::Mat& pattern )
+{
+    cv::Scalar mean = cv::mean( pattern );
+    int channels = pattern.channels() > 0 && pattern.channels() <= 4 ? pattern.channels() : 1;
+    double sum = 0.0;
+    for ( int i = 0; i < channels; i++ )
+    {
+        sum += mean[i];
+    }
+
+    Change change;
+    change.level = (unsigned char)( sum / channels + 0.5 );
+
+    // the pattern goes out on the first refresh after the pipeline latency
+    long long latencyUs = m_config.latencyUs;
+    if ( m_config.jitterUs > 0 )
+    {
+        latencyUs += (long long)( ( m_numShown * 2654435761ULL ) % ( 2 * m_config.jitterUs + 1 ) ) - m_config.jitterUs;
+    }
+    unsigned long long periodUs = (unsigned long long)( 1000000.0f / m_config.refreshRate );
+    unsigned long long readyUs = HostTimeUs() + ( latencyUs > 0 ? latencyUs : 0 );
+    change.visibleUs = m_originUs + ( readyUs - m_originUs + periodUs - 1 ) / periodUs * periodUs;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_numShown++;
+    m_changes.push_back( change );
+    if ( m_changes.size() > sk_maxHistory )
+    {
+        m_changes.pop_front();
+    }
+}
+
+unsigned char SimulatedDisplay::LevelAt( unsigned long long hostTimeUs ) const
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    unsigned char level = 0;
+    for ( std::deque<Change>::const_iterator it = m_changes.begin(); it != m_changes.end() && it->visibleUs <= hostTimeUs; ++it )
+    {
+        level = it->level;
+    }
+    return level;
+}
+
+unsigned char SimulatedDisplay::SceneLevel( unsigned long long hostTimeUs, const void* pData )
+{
+    return ( (const SimulatedDisplay*)pData )->LevelAt( hostTimeUs );
+}
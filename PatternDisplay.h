@@ -0,0 +1,85 @@
+/*****************************************************************
+  PATTERN DISPLAY
+
+  Where the projected patterns go. WindowDisplay is the fullscreen OpenCV
+  window on the projector. SimulatedDisplay models a projector with a
+  fixed pipeline latency and a refresh clock; SyntheticCameras pointed at
+  it see its brightness, which gives a headless display-to-camera loopback.
+
+*****************************************************************/
+
+#ifndef PATTERN_DISPLAY_H
+#define PATTERN_DISPLAY_H
+
+#include <opencv2/opencv.hpp>
+#include <deque>
+#include <mutex>
+#include <string>
+
+class PatternDisplay
+{
+public:
+    virtual ~PatternDisplay() {}
+
+    // Hands the pattern to the display. The light can change later than
+    // this returns; finding out how much later is what the latency
+    // calibration is for.
+    virtual void Show( const cv::Mat& pattern ) = 0;
+};
+
+class WindowDisplay : public PatternDisplay
+{
+public:
+    // The window must already exist (cvNamedWindow).
+    explicit WindowDisplay( const std::string& windowName ) : m_windowName( windowName ) {}
+
+    virtual void Show( const cv::Mat& pattern );
+
+private:
+    std::string m_windowName;
+};
+
+struct SimulatedDisplayConfig
+{
+    unsigned int latencyUs;         // from Show() until the next refresh picks the pattern up
+    unsigned int jitterUs;          // +/- on the latency
+    float refreshRate;              // Hz; the pattern appears on a refresh
+
+    SimulatedDisplayConfig()
+    {
+        latencyUs = 30000;
+        jitterUs = 2000;
+        refreshRate = 60.0f;
+    }
+};
+
+class SimulatedDisplay : public PatternDisplay
+{
+public:
+    explicit SimulatedDisplay( const SimulatedDisplayConfig& config = SimulatedDisplayConfig() );
+
+    virtual void Show( const cv::Mat& pattern );
+
+    // Mean brightness (0-255) on screen at hostTimeUs (HostTimeUs clock).
+    unsigned char LevelAt( unsigned long long hostTimeUs ) const;
+
+    // Signature of SyntheticCamera::SceneFn; pData is the SimulatedDisplay.
+    static unsigned char SceneLevel( unsigned long long hostTimeUs, const void* pData );
+
+private:
+    struct Change
+    {
+        unsigned long long visibleUs;
+        unsigned char level;
+    };
+
+    static const unsigned int sk_maxHistory = 64;
+
+    SimulatedDisplayConfig m_config;
+    unsigned long long m_originUs;
+    unsigned long long m_numShown;
+    mutable std::mutex m_mutex;
+    std::deque<Change> m_changes;
+};
+
+#endif // PATTERN_DISPLAY_H
@@ -0,0 +1,431 @@
+/*****************************************************************
+  RAW RECORDING
+
+  See RawRecording.h.
+
+*****************************************************************/
+
+#include "RawRecording.h"
+#include "CameraUtils.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    const char sk_magic[8] = { 'F', 'C', '2', 'R', 'A', 'W', 0, 0 };
+    const unsigned int sk_version = 1;
+
+    // O_DIRECT wants offsets, sizes and buffers aligned to the logical
+    // block size; a page covers every disk we use
+    const unsigned int sk_alignment = 4096;
+    const unsigned int sk_headerSize = 4096;
+
+    unsigned long long AlignUp( unsigned long long size )
+    {
+        return ( size + sk_alignment - 1 ) / sk_alignment * sk_alignment;
+    }
+
+    unsigned char* AllocateAligned( size_t size )
+    {
+        void* p = NULL;
+        if ( posix_memalign( &p, sk_alignment, size ) != 0 )
+        {
+            return NULL;
+        }
+        memset( p, 0, size );
+        return (unsigned char*)p;
+    }
+}
+
+RawFrameRecord MakeFrameRecord( const FrameHandle& handle, unsigned int index )
+{
+    RawFrameRecord record;
+    memset( &record, 0, sizeof( record ) );
+    record.index = index;
+    record.receivedSize = handle.receivedSize;
+    record.sequence = handle.sequence;
+    record.hostTimeUs = handle.hostTimeUs;
+    record.timeStampSeconds = handle.timeStamp.seconds;
+    record.timeStampMicroSeconds = handle.timeStamp.microSeconds;
+    record.cycleSeconds = handle.timeStamp.cycleSeconds;
+    record.cycleCount = handle.timeStamp.cycleCount;
+    record.cycleOffset = handle.timeStamp.cycleOffset;
+    record.embeddedTimeStamp = handle.metadata.embeddedTimeStamp;
+    record.embeddedGain = handle.metadata.embeddedGain;
+    record.embeddedShutter = handle.metadata.embeddedShutter;
+    record.embeddedBrightness = handle.metadata.embeddedBrightness;
+    record.embeddedExposure = handle.metadata.embeddedExposure;
+    record.embeddedWhiteBalance = handle.metadata.embeddedWhiteBalance;
+    record.embeddedFrameCounter = handle.metadata.embeddedFrameCounter;
+    record.embeddedStrobePattern = handle.metadata.embeddedStrobePattern;
+    record.embeddedGPIOPinState = handle.metadata.embeddedGPIOPinState;
+    record.embeddedROIPosition = handle.metadata.embeddedROIPosition;
+    return record;
+}
+
+RawFrameRecord MakeFrameRecord( const Image& image, unsigned int index, unsigned long long sequence )
+{
+    FrameHandle handle;
+    handle.sequence = sequence;
+    handle.receivedSize = image.GetReceivedDataSize();
+    handle.timeStamp = image.GetTimeStamp();
+    handle.metadata = image.GetMetadata();
+    return MakeFrameRecord( handle, index );
+}
+
+RawRecordingWriter::RawRecordingWriter()
+    : m_fd( -1 ),
+      m_direct( false ),
+      m_pWriter( NULL ),
+      m_pBuffer( NULL ),
+      m_bufferFrames( 0 ),
+      m_buffered( 0 ),
+      m_flushed( 0 ),
+      m_bytesWritten( 0 ),
+      m_writeUs( 0 ),
+      m_reservedBytes( 0 )
+{
+    memset( &m_header, 0, sizeof( m_header ) );
+}
+
+RawRecordingWriter::~RawRecordingWriter()
+{
+    Close();
+}
+
+void RawRecordingWriter::Free()
+{
+    // the writer waits for its writes, so it goes before the file
+    delete m_pWriter;
+    m_pWriter = NULL;
+    m_pBuffer = NULL;
+    if ( m_fd >= 0 )
+    {
+        close( m_fd );
+        m_fd = -1;
+    }
+    m_bufferFrames = 0;
+    m_buffered = 0;
+}
+
+Error RawRecordingWriter::Open( const std::string& path, unsigned int camera )
+{
+    Close();
+
+    m_fd = m_config.direct ? open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644 ) : -1;
+    m_direct = m_fd >= 0;
+    if ( m_fd < 0 && ( errno == EINVAL || !m_config.direct ) )
+    {
+        // e.g. tmpfs
+        m_fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    }
+    if ( m_fd < 0 )
+    {
+        return FailureError();
+    }
+
+    memset( &m_header, 0, sizeof( m_header ) );
+    memcpy( m_header.magic, sk_magic, sizeof( sk_magic ) );
+    m_header.version = sk_version;
+    m_header.headerSize = sk_headerSize;
+    m_header.camera = camera;
+    m_header.recordSize = sizeof( RawFrameRecord );
+    m_header.createdUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    m_records.clear();
+    m_backendName.clear();
+    m_writerStats = AsyncWriterStats();
+    m_flushed = 0;
+    m_bytesWritten = 0;
+    m_writeUs = 0;
+    m_reservedBytes = 0;
+    return Error();
+}
+
+Error RawRecordingWriter::Reserve( unsigned long long numFrames, unsigned int frameSize )
+{
+    if ( m_fd < 0 )
+    {
+        return FailureError();
+    }
+
+    // the record table grows without reallocating during the scan
+    m_records.reserve( numFrames );
+
+    // the same layout Close() writes: header, frames, record table
+    unsigned long long size = sk_headerSize + numFrames * AlignUp( frameSize ) + AlignUp( numFrames * sizeof( RawFrameRecord ) );
+    if ( fallocate( m_fd, 0, 0, (off_t)size ) != 0 )
+    {
+        if ( errno == EOPNOTSUPP || errno == ENOSYS )
+        {
+            return Error();
+        }
+        return FailureError();
+    }
+    m_reservedBytes = size;
+    return Error();
+}
+
+Error RawRecordingWriter::Append( const Image& image, const RawFrameRecord& record )
+{
+    if ( m_fd < 0 || image.GetData() == NULL )
+    {
+        return FailureError();
+    }
+
+    if ( m_pWriter == NULL )
+    {
+        // the first frame fixes the geometry of the recording
+        m_header.rows = image.GetRows();
+        m_header.cols = image.GetCols();
+        m_header.stride = image.GetStride();
+        m_header.pixelFormat = image.GetPixelFormat();
+        m_header.bayerFormat = image.GetBayerTileFormat();
+        m_header.frameSize = m_header.stride * m_header.rows;
+        m_header.frameStride = (unsigned int)AlignUp( m_header.frameSize );
+
+        m_bufferFrames = m_config.batchBytes / m_header.frameStride > 0 ? m_config.batchBytes / m_header.frameStride : 1;
+        m_pWriter = AsyncWriter::Create( m_fd, m_direct, m_config.numBuffers, (size_t)m_bufferFrames * m_header.frameStride,
+                                         m_config.backend );
+        if ( m_pWriter == NULL )
+        {
+            return FailureError();
+        }
+        m_backendName = m_pWriter->Name();
+    }
+    else if ( image.GetRows() != m_header.rows || image.GetStride() != m_header.stride ||
+              (unsigned int)image.GetPixelFormat() != m_header.pixelFormat )
+    {
+        return FailureError();
+    }
+
+    if ( m_pBuffer == NULL )
+    {
+        unsigned long long startUs = HostTimeUs();
+        m_pBuffer = m_pWriter->Acquire();
+        m_writeUs += HostTimeUs() - startUs;
+        if ( m_pBuffer == NULL )
+        {
+            return FailureError();
+        }
+    }
+    memcpy( m_pBuffer + (size_t)m_buffered * m_header.frameStride, image.GetData(), m_header.frameSize );
+    m_buffered++;
+    m_records.push_back( record );
+
+    if ( m_buffered == m_bufferFrames )
+    {
+        return Flush();
+    }
+    return Error();
+}
+
+Error RawRecordingWriter::Append( const FrameArena& arena, const FrameHandle& handle, unsigned int index )
+{
+    Image image;
+    arena.View( handle, &image );
+    return Append( image, MakeFrameRecord( handle, index ) );
+}
+
+Error RawRecordingWriter::Flush()
+{
+    if ( m_buffered == 0 )
+    {
+        return Error();
+    }
+    Error error = m_pWriter->Submit( m_pBuffer, (size_t)m_buffered * m_header.frameStride,
+                                     m_header.headerSize + m_flushed * m_header.frameStride );
+    m_pBuffer = NULL;
+    m_flushed += m_buffered;
+    m_buffered = 0;
+    return error;
+}
+
+Error RawRecordingWriter::WriteAt( const unsigned char* pData, size_t size, unsigned long long offset )
+{
+    unsigned long long startUs = HostTimeUs();
+    size_t done = 0;
+    while ( done < size )
+    {
+        ssize_t n = pwrite( m_fd, pData + done, size - done, offset + done );
+        if ( n < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if ( n < 0 && errno == EINVAL && m_direct )
+        {
+            // the filesystem accepted O_DIRECT at open but not this write
+            fcntl( m_fd, F_SETFL, fcntl( m_fd, F_GETFL ) & ~O_DIRECT );
+            m_direct = false;
+            continue;
+        }
+        if ( n <= 0 )
+        {
+            return FailureError();
+        }
+        done += n;
+    }
+    m_bytesWritten += size;
+    m_writeUs += HostTimeUs() - startUs;
+    return Error();
+}
+
+Error RawRecordingWriter::Close()
+{
+    if ( m_fd < 0 )
+    {
+        return Error();
+    }
+
+    Error error = Flush();
+    if ( m_pWriter != NULL )
+    {
+        unsigned long long startUs = HostTimeUs();
+        Error writeError = m_pWriter->Wait();
+        m_writeUs += HostTimeUs() - startUs;
+        if ( error == PGRERROR_OK )
+        {
+            error = writeError;
+        }
+        m_writerStats = m_pWriter->Stats();
+        m_bytesWritten += m_writerStats.bytes;
+        m_direct = m_direct && m_pWriter->IsDirect();
+        delete m_pWriter;
+        m_pWriter = NULL;
+    }
+
+    m_header.numFrames = m_records.size();
+    m_header.recordOffset = m_header.headerSize + m_header.numFrames * m_header.frameStride;
+    if ( error == PGRERROR_OK && !m_records.empty() )
+    {
+        size_t tableSize = AlignUp( m_records.size() * sizeof( RawFrameRecord ) );
+        unsigned char* pTable = AllocateAligned( tableSize );
+        if ( pTable == NULL )
+        {
+            error = FailureError();
+        }
+        else
+        {
+            memcpy( pTable, &m_records[0], m_records.size() * sizeof( RawFrameRecord ) );
+            error = WriteAt( pTable, tableSize, m_header.recordOffset );
+            free( pTable );
+        }
+    }
+
+    // give back whatever was reserved for frames that never came
+    if ( error == PGRERROR_OK && m_reservedBytes > 0 )
+    {
+        unsigned long long end = m_header.recordOffset + AlignUp( m_records.size() * sizeof( RawFrameRecord ) );
+        if ( end < m_reservedBytes && ftruncate( m_fd, (off_t)end ) != 0 )
+        {
+            error = FailureError();
+        }
+    }
+
+    // the header goes last, so an interrupted recording reads as empty
+    if ( error == PGRERROR_OK )
+    {
+        unsigned char* pHeader = AllocateAligned( sk_headerSize );
+        if ( pHeader == NULL )
+        {
+            error = FailureError();
+        }
+        else
+        {
+            memcpy( pHeader, &m_header, sizeof( m_header ) );
+            error = WriteAt( pHeader, sk_headerSize, 0 );
+            free( pHeader );
+        }
+    }
+
+    Free();
+    return error;
+}
+
+RawRecordingReader::RawRecordingReader()
+    : m_pBase( NULL ),
+      m_mappedSize( 0 ),
+      m_pRecords( NULL )
+{
+    memset( &m_header, 0, sizeof( m_header ) );
+}
+
+RawRecordingReader::~RawRecordingReader()
+{
+    Close();
+}
+
+void RawRecordingReader::Close()
+{
+    if ( m_pBase != NULL )
+    {
+        munmap( m_pBase, m_mappedSize );
+        m_pBase = NULL;
+    }
+    m_mappedSize = 0;
+    m_pRecords = NULL;
+    memset( &m_header, 0, sizeof( m_header ) );
+}
+
+Error RawRecordingReader::Open( const std::string& path )
+{
+    Close();
+
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        return FailureError();
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < sk_headerSize )
+    {
+        close( fd );
+        return FailureError();
+    }
+    void* pBase = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( pBase == MAP_FAILED )
+    {
+        return FailureError();
+    }
+    m_pBase = (unsigned char*)pBase;
+    m_mappedSize = st.st_size;
+
+    // frames are read front to back by the exporters
+    madvise( m_pBase, m_mappedSize, MADV_SEQUENTIAL );
+
+    RawRecordingHeader header;
+    memcpy( &header, m_pBase, sizeof( header ) );
+    unsigned long long recordEnd = header.recordOffset + header.numFrames * sizeof( RawFrameRecord );
+    if ( memcmp( header.magic, sk_magic, sizeof( sk_magic ) ) != 0 || header.version != sk_version ||
+         header.recordSize != sizeof( RawFrameRecord ) || header.frameStride < header.frameSize ||
+         header.recordOffset != header.headerSize + header.numFrames * header.frameStride ||
+         recordEnd > m_mappedSize )
+    {
+        Close();
+        return FailureError();
+    }
+    m_header = header;
+    m_pRecords = (const RawFrameRecord*)( m_pBase + m_header.recordOffset );
+    return Error();
+}
+
+void RawRecordingReader::View( unsigned long long i, Image* pImage ) const
+{
+    if ( i >= m_header.numFrames )
+    {
+        *pImage = Image();
+        return;
+    }
+    *pImage = Image( m_header.rows, m_header.cols, m_header.stride, (unsigned char*)FrameData( i ), m_header.frameSize,
+                     (PixelFormat)m_header.pixelFormat, (BayerTileFormat)m_header.bayerFormat );
+}
@@ -0,0 +1,196 @@
+/*****************************************************************
+  RAW RECORDING
+
+  One file per camera and scan instead of one TIFF per frame. The file is
+  a fixed 4 KB header, the raw frames exactly as the camera sent them, each
+  padded to a 4 KB aligned stride, and a table with one RawFrameRecord per
+  frame at the end:
+
+      [header][frame 0][frame 1]...[frame n-1][records]
+
+  Frame i starts at headerSize + i * frameStride, so any frame can be found
+  without scanning the file. The writer collects frames in large aligned
+  buffers and hands each full one to an AsyncWriter, with O_DIRECT where
+  the filesystem allows it, so appending a frame is a memcpy and never
+  waits for the disk unless every buffer is still being written.
+
+  When the length of the scan is known, Reserve() allocates the whole
+  file on disk before the first frame, so the writes during the scan only
+  fill blocks that are already there.
+
+  DemosaicReader turns the frames into RGB when they are needed.
+
+*****************************************************************/
+
+#ifndef RAW_RECORDING_H
+#define RAW_RECORDING_H
+
+#include "FlyCapture2.h"
+#include "FrameArena.h"
+#include "AsyncWriter.h"
+#include <string>
+#include <vector>
+
+struct RawRecordingHeader
+{
+    char magic[8];                  // "FC2RAW\0\0"
+    unsigned int version;
+    unsigned int headerSize;        // offset of frame 0
+    unsigned int camera;
+    unsigned int rows;
+    unsigned int cols;
+    unsigned int stride;
+    unsigned int pixelFormat;       // FlyCapture2::PixelFormat
+    unsigned int bayerFormat;       // FlyCapture2::BayerTileFormat
+    unsigned int frameSize;         // stride * rows
+    unsigned int frameStride;       // frameSize rounded up to the alignment
+    unsigned int recordSize;        // sizeof( RawFrameRecord )
+    unsigned int reserved0;
+    unsigned long long numFrames;
+    unsigned long long recordOffset;
+    unsigned long long createdUs;   // wall clock, microseconds since 1970
+};
+
+struct RawFrameRecord
+{
+    unsigned int index;             // scan step, i.e. slit position
+    unsigned int receivedSize;
+    unsigned long long sequence;
+    unsigned long long hostTimeUs;
+    unsigned long long timeStampSeconds;
+    unsigned int timeStampMicroSeconds;
+    unsigned int cycleSeconds;
+    unsigned int cycleCount;
+    unsigned int cycleOffset;
+    unsigned int embeddedTimeStamp;
+    unsigned int embeddedGain;
+    unsigned int embeddedShutter;
+    unsigned int embeddedBrightness;
+    unsigned int embeddedExposure;
+    unsigned int embeddedWhiteBalance;
+    unsigned int embeddedFrameCounter;
+    unsigned int embeddedStrobePattern;
+    unsigned int embeddedGPIOPinState;
+    unsigned int embeddedROIPosition;
+};
+
+// How RawRecordingWriter gets frames to disk; StorageSelfTest can pick it.
+struct RawWriteConfig
+{
+    AsyncWriterBackend backend;
+    unsigned int batchBytes;        // frames collected per write, about
+    unsigned int numBuffers;        // writes in flight at most
+    bool direct;                    // try O_DIRECT
+
+    RawWriteConfig()
+        : backend( ASYNC_WRITER_AUTO ), batchBytes( 8 * 1024 * 1024 ), numBuffers( 4 ), direct( true ) {}
+};
+
+// Records for a frame held in an arena slot, or in a plain Image (e.g. a
+// DeepCopy), which has no host arrival time.
+RawFrameRecord MakeFrameRecord( const FrameHandle& handle, unsigned int index );
+RawFrameRecord MakeFrameRecord( const FlyCapture2::Image& image, unsigned int index, unsigned long long sequence );
+
+class RawRecordingWriter
+{
+public:
+    RawRecordingWriter();
+    ~RawRecordingWriter();
+
+    // How the next Open() writes.
+    void SetConfig( const RawWriteConfig& config ) { m_config = config; }
+
+    // Creates or truncates path. The frame geometry is taken from the
+    // first frame appended.
+    FlyCapture2::Error Open( const std::string& path, unsigned int camera );
+
+    // Allocates disk space for numFrames frames of frameSize bytes and
+    // their records, right after Open(). Fails if the disk is too small.
+    // Where the filesystem cannot allocate ahead, nothing is reserved and
+    // the recording grows as it is written. Close() trims what was not used.
+    // The frame records are allocated here too, either way.
+    FlyCapture2::Error Reserve( unsigned long long numFrames, unsigned int frameSize );
+
+    // Copies the frame into the write buffer; the buffer is submitted when
+    // it is full. Every frame must have the geometry of the first one.
+    FlyCapture2::Error Append( const FlyCapture2::Image& image, const RawFrameRecord& record );
+
+    // Same for a frame in an arena slot. The slot can be released as soon
+    // as this returns.
+    FlyCapture2::Error Append( const FrameArena& arena, const FrameHandle& handle, unsigned int index );
+
+    // Writes what is left, waits for the frames to be written, then writes
+    // the record table and the final header.
+    FlyCapture2::Error Close();
+
+    const RawRecordingHeader& Header() const { return m_header; }
+    unsigned long long NumFrames() const { return m_records.size(); }
+    unsigned long long BytesWritten() const { return m_bytesWritten; }
+
+    // Time Append() and Close() spent waiting for the disk.
+    unsigned long long WriteUs() const { return m_writeUs; }
+    bool IsDirect() const { return m_direct; }
+    unsigned long long ReservedBytes() const { return m_reservedBytes; }
+
+    // The frame writes of the last recording, valid after Close().
+    const std::string& BackendName() const { return m_backendName; }
+    const AsyncWriterStats& WriterStats() const { return m_writerStats; }
+
+private:
+    RawRecordingWriter( const RawRecordingWriter& );
+    RawRecordingWriter& operator=( const RawRecordingWriter& );
+
+    FlyCapture2::Error Flush();
+    FlyCapture2::Error WriteAt( const unsigned char* pData, size_t size, unsigned long long offset );
+    void Free();
+
+    int m_fd;
+    bool m_direct;
+    RawRecordingHeader m_header;
+    std::vector<RawFrameRecord> m_records;
+
+    RawWriteConfig m_config;
+    AsyncWriter* m_pWriter;
+    std::string m_backendName;
+    AsyncWriterStats m_writerStats;
+
+    unsigned char* m_pBuffer;           // acquired from m_pWriter, being filled
+    unsigned int m_bufferFrames;        // frames a buffer holds
+    unsigned int m_buffered;            // frames in it right now
+    unsigned long long m_flushed;       // frames already on disk
+
+    unsigned long long m_bytesWritten;
+    unsigned long long m_writeUs;
+    unsigned long long m_reservedBytes;
+};
+
+class RawRecordingReader
+{
+public:
+    RawRecordingReader();
+    ~RawRecordingReader();
+
+    // Maps the whole file read only and checks the header and size.
+    FlyCapture2::Error Open( const std::string& path );
+    void Close();
+
+    const RawRecordingHeader& Header() const { return m_header; }
+    unsigned long long NumFrames() const { return m_header.numFrames; }
+
+    // Wraps frame i in an Image without copying. The Image does not own
+    // the memory and must not outlive the reader.
+    void View( unsigned long long i, FlyCapture2::Image* pImage ) const;
+    const unsigned char* FrameData( unsigned long long i ) const { return m_pBase + m_header.headerSize + i * m_header.frameStride; }
+    const RawFrameRecord& Record( unsigned long long i ) const { return m_pRecords[i]; }
+
+private:
+    RawRecordingReader( const RawRecordingReader& );
+    RawRecordingReader& operator=( const RawRecordingReader& );
+
+    unsigned char* m_pBase;
+    size_t m_mappedSize;
+    RawRecordingHeader m_header;
+    const RawFrameRecord* m_pRecords;
+};
+
+#endif // RAW_RECORDING_H
@@ -0,0 +1,239 @@
+/*****************************************************************
+  REPLAY CAMERA
+
+  See ReplayCamera.h.
+
+*****************************************************************/
+
+#include "ReplayCamera.h"
+#include "CameraUtils.h"
+#include <opencv2/opencv.hpp>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // frames decoded ahead of the one being served
+    const unsigned int sk_readAhead = 8;
+
+    // after this long a frame is served black rather than holding up the
+    // camera any longer
+    const int sk_decodeTimeoutMs = 2000;
+
+    std::string FrameFileName( const std::string& directory, unsigned int camera, unsigned int j )
+    {
+        char filename[512];
+        snprintf( filename, sizeof( filename ), "%s/cam--%u-%u.tiff", directory.c_str(), camera, j );
+        return filename;
+    }
+
+    // which BGR channel the sensor sees at ( row & 1, col & 1 )
+    void BayerChannels( BayerTileFormat bayerFormat, int channels[2][2] )
+    {
+        const int B = 0, G = 1, R = 2;
+        int rggb[2][2] = { { R, G }, { G, B } };
+        int grbg[2][2] = { { G, R }, { B, G } };
+        int gbrg[2][2] = { { G, B }, { R, G } };
+        int bggr[2][2] = { { B, G }, { G, R } };
+        int mono[2][2] = { { G, G }, { G, G } };
+        const int (*pLayout)[2] = mono;
+        switch ( bayerFormat )
+        {
+        case RGGB: pLayout = rggb; break;
+        case GRBG: pLayout = grbg; break;
+        case GBRG: pLayout = gbrg; break;
+        case BGGR: pLayout = bggr; break;
+        default: break;
+        }
+        memcpy( channels, pLayout, sizeof( rggb ) );
+    }
+}
+
+Error ReplayCamera::Probe( const std::string& directory, unsigned int camera, SyntheticCameraConfig* pConfig, unsigned int* pNumFrames )
+{
+    unsigned int numFrames = 0;
+    struct stat st;
+    while ( stat( FrameFileName( directory, camera, numFrames ).c_str(), &st ) == 0 )
+    {
+        numFrames++;
+    }
+    if ( numFrames == 0 )
+    {
+        return FailureError();
+    }
+
+    cv::Mat first = cv::imread( FrameFileName( directory, camera, 0 ), cv::IMREAD_COLOR );
+    if ( first.empty() )
+    {
+        return FailureError();
+    }
+    pConfig->rows = first.rows;
+    pConfig->cols = first.cols;
+    pConfig->pixelFormat = PIXEL_FORMAT_RAW8;
+    *pNumFrames = numFrames;
+    return Error();
+}
+
+ReplayCamera::ReplayCamera(
+    const SyntheticCameraConfig& config,
+    unsigned int serialNumber,
+    const std::string& directory,
+    unsigned int camera,
+    unsigned int numFrames,
+    unsigned int numDecoders )
+    : SyntheticCamera( config, serialNumber ),
+      m_directory( directory ),
+      m_camera( camera ),
+      m_numFrames( numFrames > 0 ? numFrames : 1 ),
+      m_nextToDecode( 0 ),
+      m_nextToServe( 0 ),
+      m_stopping( false ),
+      m_served( 0 ),
+      m_waited( 0 ),
+      m_waitedUs( 0 ),
+      m_late( 0 ),
+      m_failed( 0 )
+{
+    for ( unsigned int i = 0; i < ( numDecoders > 0 ? numDecoders : 1 ); i++ )
+    {
+        m_decoders.push_back( std::thread( &ReplayCamera::DecodeLoop, this ) );
+    }
+}
+
+ReplayCamera::~ReplayCamera()
+{
+    // the delivery thread must not call into RenderFrame any more once
+    // this part of the object is gone
+    StopCapture();
+
+    {
+        std::lock_guard<std::mutex> lock( m_decodeMutex );
+        m_stopping = true;
+    }
+    m_decodeCond.notify_all();
+    for ( unsigned int i = 0; i < m_decoders.size(); i++ )
+    {
+        m_decoders[i].join();
+    }
+}
+
+bool ReplayCamera::Decode( unsigned long long frameNumber, std::vector<unsigned char>* pFrame ) const
+{
+    cv::Mat image = cv::imread( FrameFileName( m_directory, m_camera, (unsigned int)( frameNumber % m_numFrames ) ), cv::IMREAD_COLOR );
+    if ( image.empty() || image.rows != (int)m_config.rows || image.cols != (int)m_config.cols )
+    {
+        return false;
+    }
+
+    int channels[2][2];
+    BayerChannels( m_config.bayerFormat, channels );
+    pFrame->resize( (size_t)m_config.rows * m_config.cols );
+    for ( unsigned int row = 0; row < m_config.rows; row++ )
+    {
+        const unsigned char* pSrc = image.ptr( row );
+        unsigned char* pDst = &( *pFrame )[(size_t)row * m_config.cols];
+        const int* pChannel = channels[row & 1];
+        for ( unsigned int col = 0; col < m_config.cols; col++ )
+        {
+            pDst[col] = pSrc[col * 3 + pChannel[col & 1]];
+        }
+    }
+    return true;
+}
+
+void ReplayCamera::DecodeLoop()
+{
+    std::unique_lock<std::mutex> lock( m_decodeMutex );
+    for (;;)
+    {
+        m_decodeCond.wait( lock, [this]{ return m_stopping || m_nextToDecode < m_nextToServe + sk_readAhead; } );
+        if ( m_stopping )
+        {
+            return;
+        }
+        unsigned long long frame = m_nextToDecode++;
+
+        lock.unlock();
+        std::vector<unsigned char> pixels;
+        bool decoded = Decode( frame, &pixels );
+        lock.lock();
+
+        // an empty frame is served black
+        if ( !decoded )
+        {
+            m_failed++;
+            pixels.clear();
+        }
+        if ( frame >= m_nextToServe )
+        {
+            m_decoded[frame].swap( pixels );
+        }
+        m_decodeCond.notify_all();
+    }
+}
+
+void ReplayCamera::RenderFrame( unsigned char* pData, unsigned int stride, unsigned long long frameNumber )
+{
+    std::unique_lock<std::mutex> lock( m_decodeMutex );
+    if ( frameNumber < m_nextToServe )
+    {
+        // capture was restarted from frame 0
+        m_decoded.clear();
+        m_nextToDecode = frameNumber;
+    }
+
+    // frames skipped by drops are not needed any more
+    m_decoded.erase( m_decoded.begin(), m_decoded.lower_bound( frameNumber ) );
+    m_nextToServe = frameNumber;
+    if ( m_nextToDecode < frameNumber )
+    {
+        m_nextToDecode = frameNumber;
+    }
+    m_decodeCond.notify_all();
+
+    std::map<unsigned long long, std::vector<unsigned char> >::iterator it = m_decoded.find( frameNumber );
+    if ( it == m_decoded.end() )
+    {
+        unsigned long long startUs = HostTimeUs();
+        m_waited++;
+        m_decodeCond.wait_for( lock, std::chrono::milliseconds( sk_decodeTimeoutMs ),
+                               [this, frameNumber]{ return m_decoded.count( frameNumber ) > 0; } );
+        m_waitedUs += HostTimeUs() - startUs;
+        it = m_decoded.find( frameNumber );
+    }
+
+    if ( it == m_decoded.end() || it->second.empty() )
+    {
+        if ( it == m_decoded.end() )
+        {
+            m_late++;
+        }
+        for ( unsigned int row = 0; row < m_config.rows; row++ )
+        {
+            memset( pData + (size_t)row * stride, 0, stride );
+        }
+    }
+    else
+    {
+        for ( unsigned int row = 0; row < m_config.rows; row++ )
+        {
+            memcpy( pData + (size_t)row * stride, &it->second[(size_t)row * m_config.cols], m_config.cols );
+        }
+        m_decoded.erase( it );
+    }
+
+    m_served++;
+    m_nextToServe = frameNumber + 1;
+    m_decodeCond.notify_all();
+}
+
+void ReplayCamera::PrintStats() const
+{
+    std::lock_guard<std::mutex> lock( m_decodeMutex );
+    printf( "replay of camera %u: %llu frames served from %u files, waited for decoding %llu times (%.1f ms), %llu late, %llu unreadable\n",
+            m_camera, m_served, m_numFrames, m_waited, m_waitedUs / 1000.0, m_late, m_failed );
+}
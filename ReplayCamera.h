@@ -0,0 +1,81 @@
+/*****************************************************************
+  REPLAY CAMERA
+
+  A SyntheticCamera that serves a previously saved capture instead of its
+  test pattern: directory/cam--<camera>-<j>.tiff, j = 0, 1, ... in order,
+  starting over after the last one. The RGB files are turned back into
+  the camera's Bayer RAW8 layout, so everything downstream sees the same
+  kind of frames a live camera delivers.
+
+  Background threads decode a few frames ahead of the one being served.
+  Timing, faults and triggers are those of SyntheticCamera; with
+  SyntheticCameraConfig::paced off, frames come as fast as they are
+  retrieved and decoded.
+
+*****************************************************************/
+
+#ifndef REPLAY_CAMERA_H
+#define REPLAY_CAMERA_H
+
+#include "SyntheticCamera.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class ReplayCamera : public SyntheticCamera
+{
+public:
+    // Counts the frames saved for camera and takes the frame size from the
+    // first one. Fails if there are none.
+    static FlyCapture2::Error Probe(
+        const std::string& directory,
+        unsigned int camera,
+        SyntheticCameraConfig* pConfig,
+        unsigned int* pNumFrames );
+
+    // config should come from Probe(). Decoding starts right away.
+    ReplayCamera(
+        const SyntheticCameraConfig& config,
+        unsigned int serialNumber,
+        const std::string& directory,
+        unsigned int camera,
+        unsigned int numFrames,
+        unsigned int numDecoders = 2 );
+    virtual ~ReplayCamera();
+
+    unsigned int NumFrames() const { return m_numFrames; }
+
+    // How often a frame was needed before it was decoded, and how long
+    // that held up delivery.
+    void PrintStats() const;
+
+protected:
+    virtual void RenderFrame( unsigned char* pData, unsigned int stride, unsigned long long frameNumber );
+
+private:
+    void DecodeLoop();
+    bool Decode( unsigned long long frameNumber, std::vector<unsigned char>* pFrame ) const;
+
+    std::string m_directory;
+    unsigned int m_camera;
+    unsigned int m_numFrames;
+
+    std::vector<std::thread> m_decoders;
+    mutable std::mutex m_decodeMutex;
+    std::condition_variable m_decodeCond;
+    std::map<unsigned long long, std::vector<unsigned char> > m_decoded;
+    unsigned long long m_nextToDecode;
+    unsigned long long m_nextToServe;
+    bool m_stopping;
+
+    unsigned long long m_served;
+    unsigned long long m_waited;
+    unsigned long long m_waitedUs;
+    unsigned long long m_late;
+    unsigned long long m_failed;
+};
+
+#endif // REPLAY_CAMERA_H
@@ -0,0 +1,95 @@
+/*****************************************************************
+  SINGLE PRODUCER / SINGLE CONSUMER RING
+
+  Lock-free bounded queue between exactly one producer thread and one
+  consumer thread. Capacity is rounded up to a power of two.
+
+*****************************************************************/
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing( size_t capacity = 64 )
+        : m_head( 0 ),
+          m_tail( 0 )
+    {
+        size_t size = 1;
+        while ( size < capacity )
+        {
+            size <<= 1;
+        }
+        m_items.resize( size );
+        m_mask = size - 1;
+    }
+
+    // producer side; returns false when the ring is full. The new tail is
+    // only released, so a producer that checks a sleeping consumer's flag
+    // afterwards needs a seq_cst fence in between.
+    bool TryPush( const T& item )
+    {
+        size_t tail = m_tail.load( std::memory_order_relaxed );
+        if ( tail - m_head.load( std::memory_order_acquire ) > m_mask )
+        {
+            return false;
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.store( tail + 1, std::memory_order_release );
+        return true;
+    }
+
+    // consumer side; returns false when the ring is empty
+    bool TryPop( T* pItem )
+    {
+        size_t head = m_head.load( std::memory_order_relaxed );
+        if ( head == m_tail.load( std::memory_order_acquire ) )
+        {
+            return false;
+        }
+        *pItem = m_items[head & m_mask];
+        m_head.store( head + 1, std::memory_order_release );
+        return true;
+    }
+
+    // consumer side; the oldest item without removing it
+    const T* Front() const
+    {
+        size_t head = m_head.load( std::memory_order_relaxed );
+        if ( head == m_tail.load( std::memory_order_acquire ) )
+        {
+            return NULL;
+        }
+        return &m_items[head & m_mask];
+    }
+
+    size_t Size() const
+    {
+        return m_tail.load( std::memory_order_acquire ) - m_head.load( std::memory_order_acquire );
+    }
+
+    size_t Capacity() const { return m_mask + 1; }
+
+private:
+    SpscRing( const SpscRing& );
+    SpscRing& operator=( const SpscRing& );
+
+    std::vector<T> m_items;
+    size_t m_mask;
+
+    // producer and consumer indices on separate cache lines; padded rather
+    // than alignas() so the ring can be heap allocated under C++11
+    char m_pad0[64];
+    std::atomic<size_t> m_head;
+    char m_pad1[64 - sizeof( std::atomic<size_t> )];
+    std::atomic<size_t> m_tail;
+    char m_pad2[64 - sizeof( std::atomic<size_t> )];
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,307 @@
+/*****************************************************************
+  STORAGE SELF TEST
+
+  See StorageSelfTest.h.
+
+*****************************************************************/
+
+#include "StorageSelfTest.h"
+#include "CameraUtils.h"
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <thread>
+#include <cstdio>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // the disk has to be this much faster than the cameras to count as
+    // keeping up; queues absorb hiccups, not a steady shortfall
+    const double sk_headroom = 1.2;
+
+    // fewer frames than this do not say anything about throughput
+    const unsigned int sk_minFrames = 8;
+
+    const unsigned int sk_batchMB[] = { 2, 8, 32 };
+    const unsigned int sk_inFlight[] = { 1, 4, 8 };
+    const AsyncWriterBackend sk_backends[] = { ASYNC_WRITER_URING, ASYNC_WRITER_THREADS };
+    const char* const sk_encodings[] = { "none", "packbits", "lzw", "deflate", "png:1", "png:6" };
+
+    void FillTestFrame( Image* pImage )
+    {
+        unsigned char* pData = pImage->GetData();
+        unsigned int stride = pImage->GetStride();
+        unsigned int state = 12345;
+        for ( unsigned int row = 0; row < pImage->GetRows(); row++ )
+        {
+            for ( unsigned int col = 0; col < stride; col++ )
+            {
+                state = state * 1103515245u + 12345u;
+                pData[(size_t)row * stride + col] = (unsigned char)( ( row + col ) / 8 + ( state >> 16 ) % 16 );
+            }
+        }
+    }
+
+    double SecondsSince( unsigned long long startUs )
+    {
+        return ( HostTimeUs() - startUs ) / 1e6;
+    }
+
+    // writes numFrames frames into one recording per camera at once, the
+    // way a scan would, and flushes them all the way to the disk
+    bool TimeRaw(
+        const std::string& directory,
+        const Image& frame,
+        unsigned int numCameras,
+        unsigned int numFrames,
+        const RawWriteConfig& config,
+        double* pSeconds,
+        std::string* pBackendName,
+        bool* pDirect )
+    {
+        std::vector<RawRecordingWriter> writers( numCameras );
+        std::vector<std::string> paths( numCameras );
+        std::vector<int> ok( numCameras, 0 );
+        unsigned long long startUs = HostTimeUs();
+        std::vector<std::thread> threads;
+        for ( unsigned int cam = 0; cam < numCameras; cam++ )
+        {
+            char path[512];
+            snprintf( path, sizeof( path ), "%s/selftest-cam%u.fcraw", directory.c_str(), cam );
+            paths[cam] = path;
+            threads.push_back( std::thread( [&, cam]
+            {
+                RawRecordingWriter& writer = writers[cam];
+                writer.SetConfig( config );
+                Error error = writer.Open( paths[cam], cam );
+                for ( unsigned int i = 0; i < numFrames && error == PGRERROR_OK; i++ )
+                {
+                    error = writer.Append( frame, MakeFrameRecord( frame, i, i ) );
+                }
+                Error closeError = writer.Close();
+                int fd = open( paths[cam].c_str(), O_WRONLY );
+                if ( fd >= 0 )
+                {
+                    fdatasync( fd );
+                    close( fd );
+                }
+                ok[cam] = error == PGRERROR_OK && closeError == PGRERROR_OK;
+            } ) );
+        }
+        for ( unsigned int cam = 0; cam < numCameras; cam++ )
+        {
+            threads[cam].join();
+        }
+        *pSeconds = SecondsSince( startUs );
+        *pBackendName = writers[0].BackendName();
+        *pDirect = writers[0].IsDirect();
+
+        bool allOk = true;
+        for ( unsigned int cam = 0; cam < numCameras; cam++ )
+        {
+            unlink( paths[cam].c_str() );
+            allOk = allOk && ok[cam];
+        }
+        return allOk;
+    }
+
+    // saves numFrames frames through a FrameWriter, flushed to the disk
+    bool TimeImages(
+        const std::string& directory,
+        const Image& frame,
+        unsigned int numFrames,
+        const FrameEncoding& encoding,
+        unsigned int numThreads,
+        const DemosaicSettings& demosaic,
+        double* pSeconds,
+        double* pBytesPerFrame )
+    {
+        unsigned long long startUs = HostTimeUs();
+        FrameWriter writer( directory, 2 * numThreads, numThreads );
+        writer.SetEncoding( encoding );
+        writer.SetDemosaic( demosaic );
+        writer.Start();
+        for ( unsigned int i = 0; i < numFrames; i++ )
+        {
+            // the writer only reads the frame, so all jobs can share it
+            writer.Submit( 0, (int)i, frame );
+        }
+        writer.Finish();
+        int fd = open( directory.c_str(), O_RDONLY );
+        if ( fd >= 0 )
+        {
+            syncfs( fd );
+            close( fd );
+        }
+        *pSeconds = SecondsSince( startUs );
+
+        FrameWriterStats stats = writer.Stats();
+        *pBytesPerFrame = stats.written > 0 ? (double)stats.bytes / stats.written : 0.0;
+        for ( unsigned int i = 0; i < numFrames; i++ )
+        {
+            char filename[512];
+            snprintf( filename, sizeof( filename ), "%s/cam--0-%u.%s", directory.c_str(), i, encoding.Extension() );
+            unlink( filename );
+        }
+        return stats.errors == 0 && stats.written == numFrames;
+    }
+}
+
+Error RunStorageSelfTest(
+    const std::string& directory,
+    const StorageDemand& demand,
+    unsigned long long testBytes,
+    unsigned int maxThreads,
+    StorageChoice* pChoice )
+{
+    Image frame( demand.rows, demand.cols, demand.pixelFormat, demand.bayerFormat );
+    if ( frame.GetData() == NULL )
+    {
+        return FailureError();
+    }
+    FillTestFrame( &frame );
+    unsigned int numCameras = demand.numCameras > 0 ? demand.numCameras : 1;
+    double neededFps = demand.frameRate * numCameras;
+    printf( "storage self test in %s: %ux%u frames, %u cameras at %.1f fps\n", directory.c_str(),
+            demand.cols, demand.rows, numCameras, demand.frameRate );
+
+    *pChoice = StorageChoice();
+    std::string pick;
+    if ( demand.raw )
+    {
+        unsigned int frameBytes = frame.GetStride() * frame.GetRows();
+        unsigned int numFrames = (unsigned int)( testBytes / frameBytes );
+        numFrames = numFrames > sk_minFrames ? numFrames : sk_minFrames;
+        pChoice->bytesPerFrame = ( frameBytes + 4095 ) / 4096 * 4096.0;
+
+        for ( unsigned int b = 0; b < sizeof( sk_backends ) / sizeof( sk_backends[0] ); b++ )
+        {
+            for ( unsigned int s = 0; s < sizeof( sk_batchMB ) / sizeof( sk_batchMB[0] ); s++ )
+            {
+                for ( unsigned int n = 0; n < sizeof( sk_inFlight ) / sizeof( sk_inFlight[0] ); n++ )
+                {
+                    // setting up the buffers would be most of what is timed
+                    if ( 2ULL * sk_batchMB[s] * 1024 * 1024 * sk_inFlight[n] > (unsigned long long)numFrames * frameBytes )
+                    {
+                        continue;
+                    }
+                    for ( int direct = 1; direct >= 0; direct-- )
+                    {
+                        RawWriteConfig config;
+                        config.backend = sk_backends[b];
+                        config.batchBytes = sk_batchMB[s] * 1024 * 1024;
+                        config.numBuffers = sk_inFlight[n];
+                        config.direct = direct != 0;
+
+                        double seconds;
+                        std::string name;
+                        bool isDirect;
+                        if ( !TimeRaw( directory, frame, numCameras, numFrames, config, &seconds, &name, &isDirect ) )
+                        {
+                            printf( "  raw %s batch %u MB x%u: failed\n", AsyncWriterBackendName( config.backend ),
+                                    sk_batchMB[s], sk_inFlight[n] );
+                            continue;
+                        }
+                        if ( config.direct && !isDirect )
+                        {
+                            // same as the buffered run that follows
+                            continue;
+                        }
+                        double fps = numFrames * numCameras / seconds;
+                        char line[256];
+                        snprintf( line, sizeof( line ), "raw %s, batch %u MB, %u in flight, %s", name.c_str(),
+                                  sk_batchMB[s], sk_inFlight[n], isDirect ? "O_DIRECT" : "buffered" );
+                        printf( "  %-60s %8.1f MB/s %8.1f fps\n", line, fps * pChoice->bytesPerFrame / 1e6, fps );
+                        if ( fps > pChoice->framesPerSecond )
+                        {
+                            pChoice->framesPerSecond = fps;
+                            pChoice->rawConfig = config;
+                            pick = line;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        std::string imageDirectory = directory + "/selftest";
+        mkdir( imageDirectory.c_str(), 0755 );
+        unsigned long long rgbBytes = 3ULL * demand.rows * demand.cols;
+        unsigned int numFrames = (unsigned int)( testBytes / rgbBytes );
+        numFrames = numFrames > sk_minFrames ? numFrames : sk_minFrames;
+
+        std::vector<unsigned int> threadCounts;
+        for ( unsigned int t = 1; t < maxThreads; t *= 2 )
+        {
+            threadCounts.push_back( t );
+        }
+        threadCounts.push_back( maxThreads > 0 ? maxThreads : 1 );
+
+        for ( unsigned int e = 0; e < sizeof( sk_encodings ) / sizeof( sk_encodings[0] ); e++ )
+        {
+            FrameEncoding encoding;
+            encoding.Parse( sk_encodings[e] );
+            for ( unsigned int t = 0; t < threadCounts.size(); t++ )
+            {
+                double seconds, bytesPerFrame;
+                char line[256];
+                snprintf( line, sizeof( line ), "%s, %u save threads", encoding.Name().c_str(), threadCounts[t] );
+                if ( !TimeImages( imageDirectory, frame, numFrames, encoding, threadCounts[t], demand.demosaic, &seconds, &bytesPerFrame ) )
+                {
+                    printf( "  %-60s failed\n", line );
+                    continue;
+                }
+                double fps = numFrames / seconds;
+                printf( "  %-60s %8.1f KB/frame %8.1f fps\n", line, bytesPerFrame / 1024.0, fps );
+                if ( fps > pChoice->framesPerSecond )
+                {
+                    pChoice->framesPerSecond = fps;
+                    pChoice->bytesPerFrame = bytesPerFrame;
+                    pChoice->encoding = encoding;
+                    pChoice->saveThreads = threadCounts[t];
+                    pick = line;
+                }
+            }
+        }
+        rmdir( imageDirectory.c_str() );
+    }
+
+    if ( pChoice->framesPerSecond <= 0.0 )
+    {
+        printf( "storage self test: nothing could be written to %s\n", directory.c_str() );
+        return FailureError();
+    }
+
+    double neededBytes = pChoice->bytesPerFrame * demand.numFrames * numCameras;
+    struct statvfs fs;
+    double freeBytes = statvfs( directory.c_str(), &fs ) == 0 ? (double)fs.f_bavail * fs.f_frsize : neededBytes;
+    bool fastEnough = !demand.streaming || pChoice->framesPerSecond >= neededFps * sk_headroom;
+    pChoice->keepsUp = fastEnough && neededBytes <= freeBytes;
+
+    printf( "storage: using %s, %.1f fps", pick.c_str(), pChoice->framesPerSecond );
+    if ( demand.streaming )
+    {
+        printf( ", the cameras deliver %.1f fps\n", neededFps );
+    }
+    else
+    {
+        printf( ", saving the scan will take about %.1f s\n", demand.numFrames * numCameras / pChoice->framesPerSecond );
+    }
+    if ( !fastEnough )
+    {
+        printf( "WARNING: the disk cannot keep up with the cameras (%.1f of %.1f fps with %.0f%% headroom); "
+                "frames will back up and be lost. Lower -fps, save after the scan or use -format raw.\n",
+                pChoice->framesPerSecond, neededFps, ( sk_headroom - 1.0 ) * 100.0 );
+    }
+    if ( neededBytes > freeBytes )
+    {
+        printf( "WARNING: the scan needs about %.0f MB but only %.0f MB are free in %s\n",
+                neededBytes / 1e6, freeBytes / 1e6, directory.c_str() );
+    }
+    return Error();
+}
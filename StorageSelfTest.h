@@ -0,0 +1,75 @@
+/*****************************************************************
+  STORAGE SELF TEST
+
+  A short write benchmark against the output directory, run before the
+  scan. It saves test frames of the scan's geometry with every writer
+  configuration worth trying:
+
+  - raw recordings: batch size, writes in flight (the writer threads of
+    the pwrite backend), io_uring or threads, O_DIRECT on and off
+  - image files: encoding and compression level, save threads
+
+  and picks the fastest. When frames are written during the scan the disk
+  has to keep up with the cameras, so if no configuration manages that
+  (or the disk is too small for the whole scan) it says so before the
+  scan starts rather than after frames were lost.
+
+  The test frame is a smooth gradient with some noise; compression on real
+  scenes can be better or worse.
+
+*****************************************************************/
+
+#ifndef STORAGE_SELF_TEST_H
+#define STORAGE_SELF_TEST_H
+
+#include "FlyCapture2.h"
+#include "RawRecording.h"
+#include "FrameWriter.h"
+#include "Demosaic.h"
+#include <string>
+
+// What the scan is going to write.
+struct StorageDemand
+{
+    unsigned int rows;
+    unsigned int cols;
+    FlyCapture2::PixelFormat pixelFormat;
+    FlyCapture2::BayerTileFormat bayerFormat;
+    double frameRate;               // per camera
+    unsigned int numCameras;
+    unsigned int numFrames;         // per camera
+    bool raw;                       // raw recordings rather than image files
+    bool streaming;                 // written during the scan
+    DemosaicSettings demosaic;      // image files are converted first
+
+    StorageDemand()
+        : rows( 0 ), cols( 0 ), pixelFormat( FlyCapture2::PIXEL_FORMAT_RAW8 ), bayerFormat( FlyCapture2::NONE ),
+          frameRate( 0.0 ), numCameras( 1 ), numFrames( 0 ), raw( false ), streaming( false ) {}
+};
+
+// The configuration the test picked and what it measured with it.
+struct StorageChoice
+{
+    RawWriteConfig rawConfig;       // for raw recordings
+    FrameEncoding encoding;         // for image files
+    unsigned int saveThreads;
+    double framesPerSecond;         // all cameras together
+    double bytesPerFrame;           // on disk
+    bool keepsUp;                   // fast enough for the cameras and room for the scan
+
+    StorageChoice() : saveThreads( 1 ), framesPerSecond( 0.0 ), bytesPerFrame( 0.0 ), keepsUp( false ) {}
+};
+
+// Writes about testBytes per camera and configuration into directory,
+// printing one line each, and returns the pick in pChoice. Raw batch sizes
+// whose buffers testBytes would not fill twice are skipped. Image files
+// are tried with up to maxThreads save threads. Fails if nothing could be
+// written.
+FlyCapture2::Error RunStorageSelfTest(
+    const std::string& directory,
+    const StorageDemand& demand,
+    unsigned long long testBytes,
+    unsigned int maxThreads,
+    StorageChoice* pChoice );
+
+#endif // STORAGE_SELF_TEST_H
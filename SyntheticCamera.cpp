@@ -0,0 +1,957 @@
+/*****************************************************************
+  SYNTHETIC CAMERA BACKEND
+
+  See SyntheticCamera.h. Frames are rendered straight into the capture
+  buffers (our own ring, or the ones handed over with SetUserBuffers) and
+  returned as Image objects that point into them, the same way the SDK
+  hands out its DMA buffers.
+
+*****************************************************************/
+
+#include "SyntheticCamera.h"
+#include "CameraUtils.h"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    // splitmix64, used so that jitter and faults are a pure function of the
+    // frame number and can be recomputed without keeping any history
+    unsigned long long Mix( unsigned long long x )
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = ( x ^ ( x >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+        x = ( x ^ ( x >> 27 ) ) * 0x94D049BB133111EBULL;
+        return x ^ ( x >> 31 );
+    }
+
+    double Uniform( unsigned long long x )
+    {
+        return ( Mix( x ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+    }
+
+    void PutBigEndian( unsigned char* p, unsigned int value )
+    {
+        p[0] = (unsigned char)( value >> 24 );
+        p[1] = (unsigned char)( value >> 16 );
+        p[2] = (unsigned char)( value >> 8 );
+        p[3] = (unsigned char)( value );
+    }
+
+    const unsigned int sk_softwareTriggerRegister = 0x62C;
+    const unsigned int sk_softwareTriggerSource = 7;
+
+    // the cameras a broadcast trigger reaches
+    std::mutex g_busMutex;
+    std::vector<SyntheticCamera*> g_bus;
+
+    void LeaveBus( SyntheticCamera* pCamera )
+    {
+        std::lock_guard<std::mutex> lock( g_busMutex );
+        g_bus.erase( std::remove( g_bus.begin(), g_bus.end(), pCamera ), g_bus.end() );
+    }
+    const unsigned int sk_defaultNumBuffers = 10;
+    const long long sk_stallTimeoutUs = 1000000;
+}
+
+SyntheticCamera::SyntheticCamera( const SyntheticCameraConfig& config, unsigned int serialNumber )
+    : m_config( config ),
+      m_serialNumber( serialNumber ),
+      m_connected( false ),
+      m_capturing( false ),
+      m_callbackFn( NULL ),
+      m_pCallbackData( NULL ),
+      m_clockOrigin( Clock::now() ),
+      m_periodUs( 0 ),
+      m_nextFrame( 0 ),
+      m_numStarts( 0 ),
+      m_pUserBuffers( NULL ),
+      m_userBufferSize( 0 ),
+      m_numUserBuffers( 0 ),
+      m_delivered( 0 ),
+      m_busyFn( NULL ),
+      m_pBusyData( NULL ),
+      m_sceneFn( NULL ),
+      m_pSceneData( NULL )
+{
+    if ( m_config.pixelFormat != PIXEL_FORMAT_RAW12 )
+    {
+        m_config.pixelFormat = PIXEL_FORMAT_RAW8;
+    }
+    if ( m_config.frameRate <= 0.0f )
+    {
+        m_config.frameRate = 30.0f;
+    }
+
+    // every camera gets its own free-running clock
+    m_clockOffsetUs = (long long)( Mix( m_config.seed * 131 + serialNumber ) % 100000000ULL );
+
+    m_fc2Config.numBuffers = sk_defaultNumBuffers;
+    m_fc2Config.numImageNotifications = 1;
+    m_fc2Config.minNumImageNotifications = 1;
+    m_fc2Config.grabMode = DROP_FRAMES;
+    m_fc2Config.grabTimeout = TIMEOUT_INFINITE;
+
+    EmbeddedImageInfoProperty* pEmbedded = &m_embeddedInfo.timestamp;
+    for ( unsigned int i = 0; i < sizeof( m_embeddedInfo ) / sizeof( EmbeddedImageInfoProperty ); i++ )
+    {
+        pEmbedded[i].available = true;
+        pEmbedded[i].onOff = false;
+    }
+
+    for ( unsigned int i = 0; i < UNSPECIFIED_PROPERTY_TYPE; i++ )
+    {
+        m_properties[i] = Property( (PropertyType)i );
+        m_properties[i].present = true;
+        m_properties[i].absControl = true;
+        m_properties[i].onOff = true;
+    }
+    m_properties[FRAME_RATE].absValue = m_config.frameRate;
+    m_properties[SHUTTER].absValue = 0.5f * 1000.0f / m_config.frameRate;
+    m_properties[TEMPERATURE].valueA = 3131;
+
+    memset( m_gpioDirection, 0, sizeof( m_gpioDirection ) );
+}
+
+SyntheticCamera::~SyntheticCamera()
+{
+    StopCapture();
+    LeaveBus( this );
+}
+
+unsigned int SyntheticCamera::FrameStride() const
+{
+    if ( m_config.pixelFormat == PIXEL_FORMAT_RAW12 )
+    {
+        return ( m_config.cols * 3 + 1 ) / 2;
+    }
+    return m_config.cols;
+}
+
+unsigned int SyntheticCamera::FrameDataSize() const
+{
+    return FrameStride() * m_config.rows;
+}
+
+Error SyntheticCamera::GetFormat7Configuration(
+    Format7ImageSettings* pImageSettings,
+    unsigned int* pPacketSize,
+    float* pPercentage )
+{
+    if ( pImageSettings != NULL )
+    {
+        pImageSettings->mode = MODE_0;
+        pImageSettings->offsetX = 0;
+        pImageSettings->offsetY = 0;
+        pImageSettings->width = m_config.cols;
+        pImageSettings->height = m_config.rows;
+        pImageSettings->pixelFormat = m_config.pixelFormat;
+    }
+    if ( pPacketSize != NULL )
+    {
+        *pPacketSize = 1024;
+    }
+    if ( pPercentage != NULL )
+    {
+        *pPercentage = 100.0f;
+    }
+    return Error();
+}
+
+void SyntheticCamera::SetBufferBusyCallback( BufferBusyFn busyFn, const void* pData )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_busyFn = busyFn;
+    m_pBusyData = pData;
+}
+
+void SyntheticCamera::SetSceneCallback( SceneFn sceneFn, const void* pData )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_sceneFn = sceneFn;
+    m_pSceneData = pData;
+}
+
+Error SyntheticCamera::Connect( PGRGuid* /*pGuid*/ )
+{
+    {
+        std::lock_guard<std::mutex> lock( g_busMutex );
+        if ( std::find( g_bus.begin(), g_bus.end(), this ) == g_bus.end() )
+        {
+            g_bus.push_back( this );
+        }
+    }
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_connected = true;
+    return Error();
+}
+
+Error SyntheticCamera::Disconnect()
+{
+    StopCapture();
+    LeaveBus( this );
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_connected = false;
+    return Error();
+}
+
+bool SyntheticCamera::IsConnected()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_connected;
+}
+
+Error SyntheticCamera::SetCallback( ImageEventCallback callbackFn, const void* pCallbackData )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_callbackFn = callbackFn;
+    m_pCallbackData = pCallbackData;
+    return Error();
+}
+
+Error SyntheticCamera::StartCapture( ImageEventCallback callbackFn, const void* pCallbackData )
+{
+    return BeginCapture( NULL, callbackFn, pCallbackData );
+}
+
+Error SyntheticCamera::StartSyncCapture(
+    unsigned int numCameras,
+    SyntheticCamera** ppCameras,
+    const ImageEventCallback* pCallbackFns,
+    const void** pCallbackDataArray )
+{
+    Clock::time_point epoch = Clock::now();
+    for ( unsigned int i = 0; i < numCameras; i++ )
+    {
+        Error error = ppCameras[i]->BeginCapture(
+            &epoch,
+            pCallbackFns != NULL ? pCallbackFns[i] : NULL,
+            pCallbackDataArray != NULL ? pCallbackDataArray[i] : NULL );
+        if ( error != PGRERROR_OK )
+        {
+            for ( unsigned int j = 0; j < i; j++ )
+            {
+                ppCameras[j]->StopCapture();
+            }
+            return error;
+        }
+    }
+    return Error();
+}
+
+Error SyntheticCamera::BeginCapture( const Clock::time_point* pEpoch, ImageEventCallback callbackFn, const void* pCallbackData )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( !m_connected || m_capturing )
+    {
+        return FailureError();
+    }
+
+    if ( m_pUserBuffers == NULL )
+    {
+        unsigned int numBuffers = m_fc2Config.numBuffers > 0 ? m_fc2Config.numBuffers : sk_defaultNumBuffers;
+        m_ownBuffers.assign( (size_t)FrameDataSize() * numBuffers, 0 );
+    }
+
+    // keep the jitter well inside one frame period so frames stay in order
+    m_periodUs = (long long)( 1000000.0 / m_properties[FRAME_RATE].absValue );
+    if ( m_config.jitterUs * 2 >= m_periodUs )
+    {
+        m_config.jitterUs = (unsigned int)( m_periodUs / 2 - 1 );
+    }
+    if ( pEpoch != NULL )
+    {
+        m_epoch = *pEpoch;
+    }
+    else
+    {
+        // the frame timer keeps running between captures, so the first
+        // frame lands anywhere within a period
+        unsigned long long phase = Mix( ( (unsigned long long)m_config.seed << 40 ) ^ ( (unsigned long long)m_serialNumber << 32 ) ^ m_numStarts );
+        m_epoch = Clock::now() + std::chrono::microseconds( (long long)( phase % (unsigned long long)m_periodUs ) );
+    }
+    m_numStarts++;
+    m_triggers.clear();
+    m_triggerReady = Clock::now();
+    m_nextFrame = 0;
+    m_delivered = 0;
+    m_capturing = true;
+
+    if ( callbackFn != NULL )
+    {
+        m_callbackFn = callbackFn;
+        m_pCallbackData = pCallbackData;
+    }
+    if ( m_callbackFn != NULL )
+    {
+        m_deliveryThread = std::thread( &SyntheticCamera::DeliveryLoop, this );
+    }
+    return Error();
+}
+
+Error SyntheticCamera::StopCapture()
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( !m_capturing )
+        {
+            return FailureError();
+        }
+        m_capturing = false;
+    }
+    m_cond.notify_all();
+
+    // like the SDK, do not return while a callback is still running
+    if ( m_deliveryThread.joinable() )
+    {
+        m_deliveryThread.join();
+    }
+    return Error();
+}
+
+Error SyntheticCamera::RetrieveBuffer( Image* pImage )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+    if ( m_deliveryThread.joinable() )
+    {
+        // images go to the callback while one is registered
+        return FailureError();
+    }
+    return GrabFrame( pImage, lock );
+}
+
+Error SyntheticCamera::WaitForBufferEvent( Image* pImage, unsigned int /*eventNumber*/ )
+{
+    // one notification per image, so every event is the end of an image
+    return RetrieveBuffer( pImage );
+}
+
+void SyntheticCamera::DeliveryLoop()
+{
+    Image image;
+    std::unique_lock<std::mutex> lock( m_mutex );
+    while ( m_capturing )
+    {
+        Error error = GrabFrame( &image, lock );
+        if ( error != PGRERROR_OK || m_callbackFn == NULL )
+        {
+            continue;
+        }
+
+        ImageEventCallback callbackFn = m_callbackFn;
+        const void* pCallbackData = m_pCallbackData;
+        lock.unlock();
+        callbackFn( &image, pCallbackData );
+        lock.lock();
+    }
+}
+
+SyntheticCamera::FrameFault SyntheticCamera::FaultForFrame( unsigned long long frameNumber ) const
+{
+    double u = Uniform( ( (unsigned long long)m_config.seed << 40 ) ^ ( (unsigned long long)m_serialNumber << 32 ) ^ frameNumber );
+    if ( u < m_config.dropRate )
+    {
+        return FAULT_DROP;
+    }
+    u -= m_config.dropRate;
+    if ( u < m_config.corruptRate )
+    {
+        return FAULT_CORRUPT;
+    }
+    u -= m_config.corruptRate;
+    if ( u < m_config.stallRate )
+    {
+        return FAULT_STALL;
+    }
+    return FAULT_NONE;
+}
+
+SyntheticCamera::Clock::time_point SyntheticCamera::FrameTime( unsigned long long frameNumber ) const
+{
+    long long offsetUs = m_config.jitterUs + (long long)frameNumber * m_periodUs;
+    if ( m_config.jitterUs > 0 )
+    {
+        double u = Uniform( ~( ( (unsigned long long)m_serialNumber << 32 ) ^ frameNumber ) );
+        offsetUs += (long long)( ( 2.0 * u - 1.0 ) * m_config.jitterUs );
+    }
+    return m_epoch + std::chrono::microseconds( offsetUs );
+}
+
+unsigned long long SyntheticCamera::CameraClockUs( Clock::time_point when ) const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>( when - m_clockOrigin ).count() + m_clockOffsetUs;
+}
+
+Error SyntheticCamera::GrabFrame( Image* pImage, std::unique_lock<std::mutex>& lock )
+{
+    for (;;)
+    {
+        if ( !m_capturing )
+        {
+            return FailureError();
+        }
+
+        unsigned long long frame = m_nextFrame;
+        Clock::time_point due;
+
+        if ( IsSoftwareTriggered() )
+        {
+            // one frame per trigger, done once it is exposed and transferred
+            bool triggered = true;
+            if ( m_fc2Config.grabTimeout >= 0 )
+            {
+                Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( m_fc2Config.grabTimeout );
+                triggered = m_cond.wait_until( lock, deadline, [this]{ return !m_capturing || !m_triggers.empty(); } );
+            }
+            else
+            {
+                m_cond.wait( lock, [this]{ return !m_capturing || !m_triggers.empty(); } );
+            }
+            if ( !triggered || !m_capturing )
+            {
+                return FailureError();
+            }
+            due = m_triggers.front() + std::chrono::microseconds( ExposureUs() + TransferTimeUs( FrameDataSize() ) );
+            m_triggers.pop_front();
+        }
+        else if ( !m_config.paced )
+        {
+            // nothing is ever overwritten, the consumer sets the pace
+            due = Clock::now();
+        }
+        else
+        {
+            // frames the consumer was too slow for have already been overwritten
+            long long sinceEpochUs = std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - m_epoch ).count() - m_config.jitterUs;
+            unsigned long long latest = sinceEpochUs > 0 ? (unsigned long long)( sinceEpochUs / m_periodUs ) : 0;
+            unsigned long long skipped = 0;
+            if ( latest > frame )
+            {
+                skipped = latest - frame;
+                if ( m_fc2Config.grabMode == BUFFER_FRAMES )
+                {
+                    unsigned int depth = m_pUserBuffers != NULL ? m_numUserBuffers : m_fc2Config.numBuffers;
+                    skipped = latest - frame + 1 > depth ? latest - frame + 1 - depth : 0;
+                }
+            }
+            if ( skipped > 0 )
+            {
+                m_stats.imageDropped += (unsigned int)skipped;
+                m_nextFrame += skipped;
+                continue;
+            }
+            due = FrameTime( frame );
+        }
+
+        FrameFault fault = FaultForFrame( frame );
+        if ( fault == FAULT_DROP )
+        {
+            m_stats.imageDropped++;
+            m_nextFrame++;
+            continue;
+        }
+
+        if ( fault == FAULT_STALL )
+        {
+            long long timeoutUs = m_fc2Config.grabTimeout >= 0 ? m_fc2Config.grabTimeout * 1000LL : sk_stallTimeoutUs;
+            due += std::chrono::microseconds( timeoutUs );
+        }
+        if ( Clock::now() < due && m_cond.wait_until( lock, due, [this]{ return !m_capturing; } ) )
+        {
+            return FailureError();
+        }
+
+        m_nextFrame = frame + 1;
+        if ( fault == FAULT_STALL )
+        {
+            m_stats.imageXmitFailed++;
+            return FailureError();
+        }
+
+        unsigned char* pData = NULL;
+        unsigned int dataSize = FrameDataSize();
+        if ( m_pUserBuffers != NULL )
+        {
+            for ( unsigned int i = 0; i < m_numUserBuffers && pData == NULL; i++ )
+            {
+                unsigned int buffer = (unsigned int)( ( m_delivered + i ) % m_numUserBuffers );
+                if ( m_busyFn == NULL || !m_busyFn( buffer, m_pBusyData ) )
+                {
+                    pData = m_pUserBuffers + (size_t)buffer * m_userBufferSize;
+                    m_delivered += i;
+                }
+            }
+            if ( pData == NULL )
+            {
+                m_stats.imageDriverDropped++;
+                continue;
+            }
+        }
+        else
+        {
+            unsigned int numBuffers = (unsigned int)( m_ownBuffers.size() / dataSize );
+            pData = &m_ownBuffers[0] + (size_t)( m_delivered % numBuffers ) * dataSize;
+        }
+        m_delivered++;
+
+        if ( m_sceneFn != NULL )
+        {
+            Clock::time_point exposed = due - std::chrono::microseconds( TransferTimeUs( dataSize ) + ExposureUs() / 2 );
+            unsigned long long exposedUs = std::chrono::duration_cast<std::chrono::microseconds>( exposed.time_since_epoch() ).count();
+            memset( pData, m_sceneFn( exposedUs, m_pSceneData ), dataSize );
+        }
+        else
+        {
+            RenderFrame( pData, FrameStride(), frame );
+        }
+        WriteEmbeddedInfo( pData, frame, due );
+
+        *pImage = Image( m_config.rows, m_config.cols, FrameStride(), pData, dataSize, m_config.pixelFormat, m_config.bayerFormat );
+
+        if ( fault == FAULT_CORRUPT )
+        {
+            // missing packets: the tail of the frame never arrived
+            memset( pData + dataSize / 2, 0, dataSize - dataSize / 2 );
+            m_stats.imageCorrupt++;
+            return FailureError();
+        }
+        return Error();
+    }
+}
+
+void SyntheticCamera::RenderFrame( unsigned char* pData, unsigned int stride, unsigned long long frameNumber )
+{
+    // a dim vertical gradient with a bright band that walks down the frame
+    unsigned int band = (unsigned int)( ( frameNumber * 7 ) % m_config.rows );
+    for ( unsigned int row = 0; row < m_config.rows; row++ )
+    {
+        int value = ( row >= band && row < band + 4 ) ? 0xF0 : (int)( 16 + ( row * 64 ) / m_config.rows );
+        memset( pData + (size_t)row * stride, value, stride );
+    }
+}
+
+void SyntheticCamera::WriteEmbeddedInfo( unsigned char* pData, unsigned long long frameNumber, Clock::time_point when )
+{
+    // same layout the camera uses: one big-endian word per enabled item,
+    // in the order the items appear in EmbeddedImageInfo
+    unsigned long long clockUs = CameraClockUs( when );
+    unsigned int seconds = (unsigned int)( ( clockUs / 1000000 ) % 128 );
+    unsigned int cycleCount = (unsigned int)( ( clockUs % 1000000 ) / 125 );
+    unsigned int cycleOffset = (unsigned int)( ( clockUs % 125 ) * 3072 / 125 );
+
+    unsigned int words[10];
+    words[0] = ( seconds << 25 ) | ( cycleCount << 12 ) | cycleOffset;
+    words[1] = m_properties[GAIN].valueA;
+    words[2] = m_properties[SHUTTER].valueA;
+    words[3] = m_properties[BRIGHTNESS].valueA;
+    words[4] = m_properties[AUTO_EXPOSURE].valueA;
+    words[5] = ( m_properties[WHITE_BALANCE].valueA << 12 ) | m_properties[WHITE_BALANCE].valueB;
+    words[6] = (unsigned int)frameNumber;
+    words[7] = m_strobe.onOff ? 1 : 0;
+    words[8] = 0;
+    words[9] = 0;
+
+    const EmbeddedImageInfoProperty* pEmbedded = &m_embeddedInfo.timestamp;
+    unsigned int offset = 0;
+    for ( unsigned int i = 0; i < 10; i++ )
+    {
+        if ( pEmbedded[i].onOff )
+        {
+            PutBigEndian( pData + offset, words[i] );
+            offset += 4;
+        }
+    }
+}
+
+Error SyntheticCamera::SetUserBuffers( unsigned char* const pMemBuffers, int size, int numBuffers )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_capturing || ( pMemBuffers != NULL && ( size < (int)FrameDataSize() || numBuffers <= 0 ) ) )
+    {
+        return FailureError();
+    }
+    m_pUserBuffers = pMemBuffers;
+    m_userBufferSize = pMemBuffers != NULL ? (unsigned int)size : 0;
+    m_numUserBuffers = pMemBuffers != NULL ? (unsigned int)numBuffers : 0;
+    return Error();
+}
+
+Error SyntheticCamera::GetConfiguration( FC2Config* pConfig )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pConfig = m_fc2Config;
+    return Error();
+}
+
+Error SyntheticCamera::SetConfiguration( const FC2Config* pConfig )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    unsigned int minNotifications = m_fc2Config.minNumImageNotifications;
+    if ( pConfig->numBuffers > 0 )
+    {
+        m_fc2Config.numBuffers = pConfig->numBuffers;
+    }
+    if ( pConfig->grabMode != UNSPECIFIED_GRAB_MODE )
+    {
+        m_fc2Config.grabMode = pConfig->grabMode;
+    }
+    if ( pConfig->grabTimeout != TIMEOUT_UNSPECIFIED )
+    {
+        m_fc2Config.grabTimeout = pConfig->grabTimeout;
+    }
+    m_fc2Config.highPerformanceRetrieveBuffer = pConfig->highPerformanceRetrieveBuffer;
+    m_fc2Config.minNumImageNotifications = minNotifications;
+    return Error();
+}
+
+Error SyntheticCamera::GetCameraInfo( CameraInfo* pCameraInfo )
+{
+    *pCameraInfo = CameraInfo();
+    pCameraInfo->serialNumber = m_serialNumber;
+    pCameraInfo->interfaceType = INTERFACE_USB3;
+    pCameraInfo->driverType = DRIVER_USB_NONE;
+    pCameraInfo->isColorCamera = true;
+    pCameraInfo->maximumBusSpeed = BUSSPEED_S5000;
+    pCameraInfo->bayerTileFormat = m_config.bayerFormat;
+    snprintf( pCameraInfo->modelName, sk_maxStringLength, "Synthetic BFLY-U3-13S2C" );
+    snprintf( pCameraInfo->vendorName, sk_maxStringLength, "Synthetic" );
+    snprintf( pCameraInfo->sensorInfo, sk_maxStringLength, "Generated Bayer %s", m_config.pixelFormat == PIXEL_FORMAT_RAW12 ? "RAW12" : "RAW8" );
+    snprintf( pCameraInfo->sensorResolution, sk_maxStringLength, "%ux%u", m_config.cols, m_config.rows );
+    snprintf( pCameraInfo->firmwareVersion, sk_maxStringLength, "synthetic" );
+    snprintf( pCameraInfo->firmwareBuildTime, sk_maxStringLength, "%s", __DATE__ );
+    return Error();
+}
+
+Error SyntheticCamera::GetPropertyInfo( PropertyInfo* pPropInfo )
+{
+    if ( pPropInfo->type >= UNSPECIFIED_PROPERTY_TYPE )
+    {
+        return FailureError();
+    }
+    PropertyType type = pPropInfo->type;
+    *pPropInfo = PropertyInfo( type );
+    pPropInfo->present = true;
+    pPropInfo->manualSupported = true;
+    pPropInfo->onOffSupported = true;
+    pPropInfo->absValSupported = true;
+    pPropInfo->readOutSupported = true;
+    pPropInfo->max = 4095;
+    pPropInfo->absMax = type == FRAME_RATE ? 1000.0f : 4095.0f;
+    return Error();
+}
+
+Error SyntheticCamera::GetProperty( Property* pProp )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( pProp->type >= UNSPECIFIED_PROPERTY_TYPE )
+    {
+        return FailureError();
+    }
+    *pProp = m_properties[pProp->type];
+    return Error();
+}
+
+Error SyntheticCamera::SetProperty( const Property* pProp, bool /*broadcast*/ )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( pProp->type >= UNSPECIFIED_PROPERTY_TYPE || ( pProp->type == FRAME_RATE && pProp->absValue <= 0.0f ) )
+    {
+        return FailureError();
+    }
+    m_properties[pProp->type] = *pProp;
+    m_properties[pProp->type].present = true;
+    return Error();
+}
+
+Error SyntheticCamera::GetGPIOPinDirection( unsigned int pin, unsigned int* pDirection )
+{
+    if ( pin >= 4 )
+    {
+        return FailureError();
+    }
+    *pDirection = m_gpioDirection[pin];
+    return Error();
+}
+
+Error SyntheticCamera::SetGPIOPinDirection( unsigned int pin, unsigned int direction, bool /*broadcast*/ )
+{
+    if ( pin >= 4 )
+    {
+        return FailureError();
+    }
+    m_gpioDirection[pin] = direction;
+    return Error();
+}
+
+Error SyntheticCamera::GetTriggerModeInfo( TriggerModeInfo* pTriggerModeInfo )
+{
+    *pTriggerModeInfo = TriggerModeInfo();
+    pTriggerModeInfo->present = true;
+    pTriggerModeInfo->readOutSupported = true;
+    pTriggerModeInfo->onOffSupported = true;
+    pTriggerModeInfo->polaritySupported = true;
+    pTriggerModeInfo->valueReadable = true;
+    pTriggerModeInfo->sourceMask = 0x80 | 0x0F;
+    pTriggerModeInfo->softwareTriggerSupported = true;
+    pTriggerModeInfo->modeMask = 0x1;
+    return Error();
+}
+
+Error SyntheticCamera::GetTriggerMode( TriggerMode* pTriggerMode )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pTriggerMode = m_triggerMode;
+    return Error();
+}
+
+Error SyntheticCamera::SetTriggerMode( const TriggerMode* pTriggerMode, bool /*broadcast*/ )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_triggerMode = *pTriggerMode;
+    return Error();
+}
+
+Error SyntheticCamera::FireSoftwareTrigger( bool broadcast )
+{
+    Clock::time_point now = Clock::now();
+    if ( !broadcast )
+    {
+        AcceptTrigger( now );
+        return Error();
+    }
+    std::lock_guard<std::mutex> busLock( g_busMutex );
+    for ( unsigned int i = 0; i < g_bus.size(); i++ )
+    {
+        g_bus[i]->AcceptTrigger( now );
+    }
+    return Error();
+}
+
+bool SyntheticCamera::IsSoftwareTriggered() const
+{
+    return m_triggerMode.onOff && m_triggerMode.source == sk_softwareTriggerSource;
+}
+
+long long SyntheticCamera::ExposureUs() const
+{
+    return (long long)( m_properties[SHUTTER].absValue * 1000.0f );
+}
+
+void SyntheticCamera::AcceptTrigger( Clock::time_point when )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    // like the camera, ignore triggers while not armed or still busy
+    if ( !m_capturing || !IsSoftwareTriggered() || when < m_triggerReady )
+    {
+        return;
+    }
+    m_triggers.push_back( when );
+    m_triggerReady = when + std::chrono::microseconds( ExposureUs() + TransferTimeUs( FrameDataSize() ) );
+    m_cond.notify_all();
+}
+
+Error SyntheticCamera::GetTriggerDelayInfo( TriggerDelayInfo* pTriggerDelayInfo )
+{
+    pTriggerDelayInfo->type = TRIGGER_DELAY;
+    return GetPropertyInfo( pTriggerDelayInfo );
+}
+
+Error SyntheticCamera::GetTriggerDelay( TriggerDelay* pTriggerDelay )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pTriggerDelay = m_triggerDelay;
+    return Error();
+}
+
+Error SyntheticCamera::SetTriggerDelay( const TriggerDelay* pTriggerDelay, bool /*broadcast*/ )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_triggerDelay = *pTriggerDelay;
+    return Error();
+}
+
+Error SyntheticCamera::GetStrobeInfo( StrobeInfo* pStrobeInfo )
+{
+    unsigned int source = pStrobeInfo->source;
+    *pStrobeInfo = StrobeInfo();
+    pStrobeInfo->source = source;
+    pStrobeInfo->present = true;
+    pStrobeInfo->readOutSupported = true;
+    pStrobeInfo->onOffSupported = true;
+    pStrobeInfo->polaritySupported = true;
+    pStrobeInfo->maxValue = 100.0f;
+    return Error();
+}
+
+Error SyntheticCamera::GetStrobe( StrobeControl* pStrobeControl )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStrobeControl = m_strobe;
+    return Error();
+}
+
+Error SyntheticCamera::SetStrobe( const StrobeControl* pStrobeControl, bool /*broadcast*/ )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_strobe = *pStrobeControl;
+    return Error();
+}
+
+Error SyntheticCamera::GetLUTInfo( LUTData* pData )
+{
+    // no lookup table on the synthetic sensor
+    *pData = LUTData();
+    return Error();
+}
+
+Error SyntheticCamera::GetLUTBankInfo( unsigned int /*bank*/, bool* pReadSupported, bool* pWriteSupported )
+{
+    *pReadSupported = false;
+    *pWriteSupported = false;
+    return Error();
+}
+
+Error SyntheticCamera::GetActiveLUTBank( unsigned int* pActiveBank )
+{
+    *pActiveBank = 0;
+    return Error();
+}
+
+Error SyntheticCamera::SetActiveLUTBank( unsigned int /*activeBank*/ )
+{
+    return FailureError();
+}
+
+Error SyntheticCamera::EnableLUT( bool on )
+{
+    return on ? FailureError() : Error();
+}
+
+Error SyntheticCamera::GetLUTChannel( unsigned int, unsigned int, unsigned int, unsigned int* )
+{
+    return FailureError();
+}
+
+Error SyntheticCamera::SetLUTChannel( unsigned int, unsigned int, unsigned int, const unsigned int* )
+{
+    return FailureError();
+}
+
+Error SyntheticCamera::GetMemoryChannel( unsigned int* pCurrentChannel )
+{
+    *pCurrentChannel = 0;
+    return Error();
+}
+
+Error SyntheticCamera::SaveToMemoryChannel( unsigned int channel )
+{
+    return channel == 0 ? FailureError() : Error();
+}
+
+Error SyntheticCamera::RestoreFromMemoryChannel( unsigned int /*channel*/ )
+{
+    return Error();
+}
+
+Error SyntheticCamera::GetMemoryChannelInfo( unsigned int* pNumChannels )
+{
+    *pNumChannels = 2;
+    return Error();
+}
+
+Error SyntheticCamera::GetEmbeddedImageInfo( EmbeddedImageInfo* pInfo )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pInfo = m_embeddedInfo;
+    return Error();
+}
+
+Error SyntheticCamera::SetEmbeddedImageInfo( EmbeddedImageInfo* pInfo )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    EmbeddedImageInfoProperty* pDst = &m_embeddedInfo.timestamp;
+    const EmbeddedImageInfoProperty* pSrc = &pInfo->timestamp;
+    for ( unsigned int i = 0; i < sizeof( m_embeddedInfo ) / sizeof( EmbeddedImageInfoProperty ); i++ )
+    {
+        pDst[i].onOff = pDst[i].available && pSrc[i].onOff;
+    }
+    return Error();
+}
+
+Error SyntheticCamera::WriteRegister( unsigned int address, unsigned int value, bool broadcast )
+{
+    if ( address == sk_softwareTriggerRegister )
+    {
+        return FireSoftwareTrigger( broadcast );
+    }
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_registers[address] = value;
+    return Error();
+}
+
+Error SyntheticCamera::ReadRegister( unsigned int address, unsigned int* pValue )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( address == sk_softwareTriggerRegister )
+    {
+        // bit 31 stays set until the camera can take the next trigger
+        *pValue = m_capturing && Clock::now() < m_triggerReady ? 0x80000000 : 0;
+        return Error();
+    }
+    std::map<unsigned int, unsigned int>::const_iterator it = m_registers.find( address );
+    *pValue = it != m_registers.end() ? it->second : 0;
+    return Error();
+}
+
+Error SyntheticCamera::WriteRegisterBlock( unsigned short addressHigh, unsigned int addressLow, const unsigned int* pBuffer, unsigned int length )
+{
+    for ( unsigned int i = 0; i < length; i++ )
+    {
+        WriteRegister( ( (unsigned int)addressHigh << 16 ) + addressLow + i * 4, pBuffer[i] );
+    }
+    return Error();
+}
+
+Error SyntheticCamera::ReadRegisterBlock( unsigned short addressHigh, unsigned int addressLow, unsigned int* pBuffer, unsigned int length )
+{
+    for ( unsigned int i = 0; i < length; i++ )
+    {
+        ReadRegister( ( (unsigned int)addressHigh << 16 ) + addressLow + i * 4, &pBuffer[i] );
+    }
+    return Error();
+}
+
+Error SyntheticCamera::GetCycleTime( TimeStamp* timeStamp )
+{
+    unsigned long long clockUs = CameraClockUs( Clock::now() );
+    *timeStamp = TimeStamp();
+    timeStamp->seconds = (long long)( clockUs / 1000000 );
+    timeStamp->microSeconds = (unsigned int)( clockUs % 1000000 );
+    timeStamp->cycleSeconds = (unsigned int)( timeStamp->seconds % 128 );
+    timeStamp->cycleCount = timeStamp->microSeconds / 125;
+    timeStamp->cycleOffset = ( timeStamp->microSeconds % 125 ) * 3072 / 125;
+    return Error();
+}
+
+Error SyntheticCamera::GetStats( CameraStats* pStats )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    *pStats = m_stats;
+    pStats->cameraPowerUp = m_connected;
+    pStats->temperature = m_properties[TEMPERATURE].valueA;
+    pStats->timeSinceInitialization = (unsigned int)std::chrono::duration_cast<std::chrono::seconds>( Clock::now() - m_clockOrigin ).count();
+    pStats->timeSinceBusReset = pStats->timeSinceInitialization;
+    GetCycleTime( &pStats->timeStamp );
+    return Error();
+}
+
+Error SyntheticCamera::ResetStats()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stats = CameraStats();
+    return Error();
+}
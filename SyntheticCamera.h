@@ -0,0 +1,259 @@
+/*****************************************************************
+  SYNTHETIC CAMERA BACKEND
+
+  A CameraBase implementation that generates Bayer RAW8/RAW12 frames in
+  software so the capture pipeline can be run and benchmarked without a
+  Blackfly attached. Frame timing follows a configurable frame rate with
+  jitter, and frames can be dropped, corrupted or stalled on purpose.
+
+  With trigger mode on and the software source (7) selected, one frame is
+  exposed per software trigger and delivered after the shutter time plus
+  the time the frame takes over the link. A broadcast trigger reaches
+  every connected SyntheticCamera, as if they shared one bus.
+
+*****************************************************************/
+
+#ifndef SYNTHETIC_CAMERA_H
+#define SYNTHETIC_CAMERA_H
+
+#include "FlyCapture2.h"
+#include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Parameters of the generated stream. The defaults mimic a BFLY-U3-13S2C
+// running Format7 mode 0 in RAW8.
+struct SyntheticCameraConfig
+{
+    unsigned int rows;
+    unsigned int cols;
+    FlyCapture2::PixelFormat pixelFormat;      // PIXEL_FORMAT_RAW8 or PIXEL_FORMAT_RAW12
+    FlyCapture2::BayerTileFormat bayerFormat;
+    float frameRate;                           // frames per second
+    unsigned int jitterUs;                     // +/- jitter on frame completion time
+    float dropRate;                            // fraction of frames that never arrive
+    float corruptRate;                         // fraction delivered with a consistency error
+    float stallRate;                           // fraction that stall until the grab timeout
+    bool paced;                                // false: each frame is ready as soon as it is asked for
+    unsigned int seed;
+
+    SyntheticCameraConfig()
+    {
+        rows = 964;
+        cols = 1288;
+        pixelFormat = FlyCapture2::PIXEL_FORMAT_RAW8;
+        bayerFormat = FlyCapture2::RGGB;
+        frameRate = 30.0f;
+        jitterUs = 0;
+        dropRate = 0.0f;
+        corruptRate = 0.0f;
+        stallRate = 0.0f;
+        paced = true;
+        seed = 1;
+    }
+};
+
+class SyntheticCamera : public FlyCapture2::CameraBase
+{
+public:
+    SyntheticCamera( const SyntheticCameraConfig& config, unsigned int serialNumber );
+    virtual ~SyntheticCamera();
+
+    // Mirrors Camera::GetFormat7Configuration() so callers can size buffers
+    // the same way for both backends.
+    FlyCapture2::Error GetFormat7Configuration(
+        FlyCapture2::Format7ImageSettings* pImageSettings,
+        unsigned int* pPacketSize,
+        float* pPercentage );
+
+    // The SDK does not requeue a buffer while the application still holds
+    // an Image referencing it. Whoever owns the user buffers reports that
+    // here; busy buffers are skipped and a frame that finds every buffer
+    // busy is dropped in the "driver".
+    typedef bool (*BufferBusyFn)( unsigned int buffer, const void* pData );
+    void SetBufferBusyCallback( BufferBusyFn busyFn, const void* pData );
+
+    // Makes the camera look at a scene instead of its test pattern: every
+    // frame is filled with the brightness sceneFn returns for the middle of
+    // its exposure (HostTimeUs clock). NULL goes back to the test pattern.
+    typedef unsigned char (*SceneFn)( unsigned long long hostTimeUs, const void* pData );
+    void SetSceneCallback( SceneFn sceneFn, const void* pData );
+
+    // Counterpart of Camera::StartSyncCapture(): all cameras run off one
+    // frame clock, so their exposures are phase aligned from the first
+    // frame. StartCapture() on its own starts at an arbitrary phase, like a
+    // free-running camera does.
+    static FlyCapture2::Error StartSyncCapture(
+        unsigned int numCameras,
+        SyntheticCamera** ppCameras,
+        const FlyCapture2::ImageEventCallback* pCallbackFns = NULL,
+        const void** pCallbackDataArray = NULL );
+
+    virtual FlyCapture2::Error Connect( FlyCapture2::PGRGuid* pGuid = NULL );
+    virtual FlyCapture2::Error Disconnect();
+    virtual bool IsConnected();
+    virtual FlyCapture2::Error SetCallback(
+        FlyCapture2::ImageEventCallback callbackFn,
+        const void* pCallbackData = NULL );
+    virtual FlyCapture2::Error StartCapture(
+        FlyCapture2::ImageEventCallback callbackFn = NULL,
+        const void* pCallbackData = NULL );
+    virtual FlyCapture2::Error RetrieveBuffer( FlyCapture2::Image* pImage );
+    virtual FlyCapture2::Error StopCapture();
+    virtual FlyCapture2::Error WaitForBufferEvent( FlyCapture2::Image* pImage, unsigned int eventNumber );
+    virtual FlyCapture2::Error SetUserBuffers(
+        unsigned char* const pMemBuffers,
+        int size,
+        int numBuffers );
+    virtual FlyCapture2::Error GetConfiguration( FlyCapture2::FC2Config* pConfig );
+    virtual FlyCapture2::Error SetConfiguration( const FlyCapture2::FC2Config* pConfig );
+    virtual FlyCapture2::Error GetCameraInfo( FlyCapture2::CameraInfo* pCameraInfo );
+    virtual FlyCapture2::Error GetPropertyInfo( FlyCapture2::PropertyInfo* pPropInfo );
+    virtual FlyCapture2::Error GetProperty( FlyCapture2::Property* pProp );
+    virtual FlyCapture2::Error SetProperty(
+        const FlyCapture2::Property* pProp,
+        bool broadcast = false );
+    virtual FlyCapture2::Error GetGPIOPinDirection( unsigned int pin, unsigned int* pDirection );
+    virtual FlyCapture2::Error SetGPIOPinDirection( unsigned int pin, unsigned int direction, bool broadcast = false );
+    virtual FlyCapture2::Error GetTriggerModeInfo( FlyCapture2::TriggerModeInfo* pTriggerModeInfo );
+    virtual FlyCapture2::Error GetTriggerMode( FlyCapture2::TriggerMode* pTriggerMode );
+    virtual FlyCapture2::Error SetTriggerMode(
+        const FlyCapture2::TriggerMode* pTriggerMode,
+        bool broadcast = false );
+    virtual FlyCapture2::Error FireSoftwareTrigger( bool broadcast = false );
+    virtual FlyCapture2::Error GetTriggerDelayInfo( FlyCapture2::TriggerDelayInfo* pTriggerDelayInfo );
+    virtual FlyCapture2::Error GetTriggerDelay( FlyCapture2::TriggerDelay* pTriggerDelay );
+    virtual FlyCapture2::Error SetTriggerDelay(
+        const FlyCapture2::TriggerDelay* pTriggerDelay,
+        bool broadcast = false );
+    virtual FlyCapture2::Error GetStrobeInfo( FlyCapture2::StrobeInfo* pStrobeInfo );
+    virtual FlyCapture2::Error GetStrobe( FlyCapture2::StrobeControl* pStrobeControl );
+    virtual FlyCapture2::Error SetStrobe(
+        const FlyCapture2::StrobeControl* pStrobeControl,
+        bool broadcast = false );
+    virtual FlyCapture2::Error GetLUTInfo( FlyCapture2::LUTData* pData );
+    virtual FlyCapture2::Error GetLUTBankInfo(
+        unsigned int bank,
+        bool* pReadSupported,
+        bool* pWriteSupported );
+    virtual FlyCapture2::Error GetActiveLUTBank( unsigned int* pActiveBank );
+    virtual FlyCapture2::Error SetActiveLUTBank( unsigned int activeBank );
+    virtual FlyCapture2::Error EnableLUT( bool on );
+    virtual FlyCapture2::Error GetLUTChannel(
+        unsigned int bank,
+        unsigned int channel,
+        unsigned int sizeEntries,
+        unsigned int* pEntries );
+    virtual FlyCapture2::Error SetLUTChannel(
+        unsigned int bank,
+        unsigned int channel,
+        unsigned int sizeEntries,
+        const unsigned int* pEntries );
+    virtual FlyCapture2::Error GetMemoryChannel( unsigned int* pCurrentChannel );
+    virtual FlyCapture2::Error SaveToMemoryChannel( unsigned int channel );
+    virtual FlyCapture2::Error RestoreFromMemoryChannel( unsigned int channel );
+    virtual FlyCapture2::Error GetMemoryChannelInfo( unsigned int* pNumChannels );
+    virtual FlyCapture2::Error GetEmbeddedImageInfo( FlyCapture2::EmbeddedImageInfo* pInfo );
+    virtual FlyCapture2::Error SetEmbeddedImageInfo( FlyCapture2::EmbeddedImageInfo* pInfo );
+    virtual FlyCapture2::Error WriteRegister(
+        unsigned int address,
+        unsigned int value,
+        bool broadcast = false );
+    virtual FlyCapture2::Error ReadRegister(
+        unsigned int address,
+        unsigned int* pValue );
+    virtual FlyCapture2::Error WriteRegisterBlock(
+        unsigned short addressHigh,
+        unsigned int addressLow,
+        const unsigned int* pBuffer,
+        unsigned int length );
+    virtual FlyCapture2::Error ReadRegisterBlock(
+        unsigned short addressHigh,
+        unsigned int addressLow,
+        unsigned int* pBuffer,
+        unsigned int length );
+    virtual FlyCapture2::Error GetCycleTime( FlyCapture2::TimeStamp* timeStamp );
+    virtual FlyCapture2::Error GetStats( FlyCapture2::CameraStats* pStats );
+    virtual FlyCapture2::Error ResetStats();
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    // Fills one frame buffer. Subclasses can override this to serve other
+    // content through the same timing and fault model.
+    virtual void RenderFrame( unsigned char* pData, unsigned int stride, unsigned long long frameNumber );
+
+    SyntheticCameraConfig m_config;
+
+private:
+    enum FrameFault { FAULT_NONE, FAULT_DROP, FAULT_CORRUPT, FAULT_STALL };
+
+    // pEpoch is the time of frame 0, or NULL for a free-running start
+    FlyCapture2::Error BeginCapture(
+        const Clock::time_point* pEpoch,
+        FlyCapture2::ImageEventCallback callbackFn,
+        const void* pCallbackData );
+    FlyCapture2::Error GrabFrame( FlyCapture2::Image* pImage, std::unique_lock<std::mutex>& lock );
+    bool IsSoftwareTriggered() const;
+    void AcceptTrigger( Clock::time_point when );
+    long long ExposureUs() const;
+    void DeliveryLoop();
+    FrameFault FaultForFrame( unsigned long long frameNumber ) const;
+    Clock::time_point FrameTime( unsigned long long frameNumber ) const;
+    unsigned long long CameraClockUs( Clock::time_point when ) const;
+    void WriteEmbeddedInfo( unsigned char* pData, unsigned long long frameNumber, Clock::time_point when );
+    unsigned int FrameDataSize() const;
+    unsigned int FrameStride() const;
+
+    unsigned int m_serialNumber;
+    bool m_connected;
+    bool m_capturing;
+
+    FlyCapture2::FC2Config m_fc2Config;
+    FlyCapture2::EmbeddedImageInfo m_embeddedInfo;
+    FlyCapture2::TriggerMode m_triggerMode;
+    FlyCapture2::TriggerDelay m_triggerDelay;
+    FlyCapture2::StrobeControl m_strobe;
+    FlyCapture2::Property m_properties[FlyCapture2::UNSPECIFIED_PROPERTY_TYPE];
+    unsigned int m_gpioDirection[4];
+    std::map<unsigned int, unsigned int> m_registers;
+
+    FlyCapture2::ImageEventCallback m_callbackFn;
+    const void* m_pCallbackData;
+    std::thread m_deliveryThread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
+    // frame timing
+    Clock::time_point m_clockOrigin;
+    long long m_clockOffsetUs;
+    Clock::time_point m_epoch;
+    long long m_periodUs;
+    unsigned long long m_nextFrame;
+    unsigned int m_numStarts;
+
+    // software trigger: triggers waiting to be exposed, and until when the
+    // camera is still busy with the last one
+    std::deque<Clock::time_point> m_triggers;
+    Clock::time_point m_triggerReady;
+
+    // frame buffers, either our own or those registered by SetUserBuffers()
+    std::vector<unsigned char> m_ownBuffers;
+    unsigned char* m_pUserBuffers;
+    unsigned int m_userBufferSize;
+    unsigned int m_numUserBuffers;
+    unsigned long long m_delivered;
+    BufferBusyFn m_busyFn;
+    const void* m_pBusyData;
+    SceneFn m_sceneFn;
+    const void* m_pSceneData;
+
+    FlyCapture2::CameraStats m_stats;
+};
+
+#endif // SYNTHETIC_CAMERA_H
@@ -0,0 +1,162 @@
+/*****************************************************************
+  DEMOSAIC KERNELS TEST
+
+  Checks that the SSE2 and AVX2 row kernels produce the same bytes as the
+  scalar kernel, for every source in random row plans (bilinear, edge
+  aware and nearest) over random and extreme pixel values and many row
+  widths, and that they write nothing past the columns they report.
+  AVX2 is skipped on CPUs without it. Needs neither the SDK nor OpenCV.
+
+*****************************************************************/
+
+#include "DemosaicKernels.h"
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    typedef unsigned int (*SimdKernel)(
+        const unsigned char*, const unsigned char*, const unsigned char*,
+        unsigned int, const DemosaicRowPlan&, unsigned char* const[3] );
+
+    const unsigned char sk_guard = 0xA5;
+
+    void RandomPlan( DemosaicRowPlan* pPlan )
+    {
+        pPlan->nearest = rand() % 3 == 0;
+        pPlan->edgeAware = !pPlan->nearest && rand() % 2 == 0;
+        for ( unsigned int channel = 0; channel < 3; channel++ )
+        {
+            for ( unsigned int parity = 0; parity < 2; parity++ )
+            {
+                pPlan->source[channel][parity] = (unsigned char)( pPlan->nearest ?
+                    SRC_UP_EVEN + rand() % ( SRC_COUNT - SRC_UP_EVEN ) :
+                    SRC_CENTER + rand() % ( SRC_DIAG4 + 1 ) );
+            }
+        }
+    }
+
+    void FillRow( std::vector<unsigned char>* pRow, unsigned int pattern )
+    {
+        for ( unsigned int c = 0; c < pRow->size(); c++ )
+        {
+            switch ( pattern )
+            {
+            case 0: (*pRow)[c] = (unsigned char)rand(); break;
+            case 1: (*pRow)[c] = rand() % 2 ? 255 : 0; break;      // the rounding and saturation edges
+            default: (*pRow)[c] = (unsigned char)( 250 + rand() % 6 ); break;
+            }
+        }
+    }
+
+    // Runs the kernel and the scalar one on the same rows; returns the
+    // number of mismatching bytes.
+    unsigned int CompareRow( const char* pName, SimdKernel kernel, unsigned int cols, const DemosaicRowPlan& plan,
+                             const std::vector<unsigned char>& up, const std::vector<unsigned char>& row,
+                             const std::vector<unsigned char>& down )
+    {
+        std::vector<unsigned char> expected( (size_t)cols * 3 );
+        std::vector<unsigned char> actual( (size_t)cols * 3, sk_guard );
+        unsigned char* const pExpected[3] = { &expected[0], &expected[cols], &expected[2 * cols] };
+        unsigned char* const pActual[3] = { &actual[0], &actual[cols], &actual[2 * cols] };
+
+        DemosaicRowScalar( &up[0], &row[0], &down[0], cols, plan, pExpected, 0, cols );
+        unsigned int done = kernel( &up[0], &row[0], &down[0], cols, plan, pActual );
+        if ( done < 2 || done > cols )
+        {
+            printf( "%s: %u columns reported done of %u\n", pName, done, cols );
+            return 1;
+        }
+
+        unsigned int errors = 0;
+        for ( unsigned int channel = 0; channel < 3; channel++ )
+        {
+            for ( unsigned int c = 0; c < cols; c++ )
+            {
+                bool written = c >= 2 && c < done;
+                unsigned char want = written ? pExpected[channel][c] : sk_guard;
+                if ( pActual[channel][c] != want )
+                {
+                    if ( errors == 0 )
+                    {
+                        printf( "%s: %u cols, channel %u, column %u: %u, expected %u (source %u, %s)\n",
+                                pName, cols, channel, c, pActual[channel][c], want,
+                                plan.source[channel][c & 1],
+                                plan.nearest ? "nearest" : plan.edgeAware ? "edge aware" : "bilinear" );
+                    }
+                    errors++;
+                }
+            }
+        }
+        return errors;
+    }
+}
+
+int main()
+{
+    srand( 1 );
+
+    std::vector<const char*> names;
+    std::vector<SimdKernel> kernels;
+#if defined( __x86_64__ ) || defined( __i386__ )
+    names.push_back( "SSE2" );
+    kernels.push_back( &DemosaicRowSse2 );
+    if ( __builtin_cpu_supports( "avx2" ) )
+    {
+        names.push_back( "AVX2" );
+        kernels.push_back( &DemosaicRowAvx2 );
+    }
+    else
+    {
+        printf( "AVX2 not supported by this CPU, skipped\n" );
+    }
+#endif
+    if ( kernels.empty() )
+    {
+        printf( "no SIMD kernels on this architecture\n" );
+        return 0;
+    }
+
+    unsigned int rows = 0;
+    unsigned int failed = 0;
+    for ( unsigned int cols = 4; cols <= 200; cols += 2 )
+    {
+        for ( unsigned int trial = 0; trial < 60; trial++ )
+        {
+            std::vector<unsigned char> up( cols ), row( cols ), down( cols );
+            unsigned int pattern = trial % 3;
+            FillRow( &up, pattern );
+            FillRow( &row, pattern );
+            FillRow( &down, pattern );
+            DemosaicRowPlan plan;
+            RandomPlan( &plan );
+            for ( unsigned int k = 0; k < kernels.size(); k++ )
+            {
+                failed += CompareRow( names[k], kernels[k], cols, plan, up, row, down ) > 0;
+            }
+            rows++;
+        }
+    }
+
+    // a full sensor row, as the cameras deliver
+    for ( unsigned int trial = 0; trial < 200; trial++ )
+    {
+        unsigned int cols = 1288;
+        std::vector<unsigned char> up( cols ), row( cols ), down( cols );
+        FillRow( &up, trial % 3 );
+        FillRow( &row, trial % 3 );
+        FillRow( &down, trial % 3 );
+        DemosaicRowPlan plan;
+        RandomPlan( &plan );
+        for ( unsigned int k = 0; k < kernels.size(); k++ )
+        {
+            failed += CompareRow( names[k], kernels[k], cols, plan, up, row, down ) > 0;
+        }
+        rows++;
+    }
+
+    printf( "demosaic kernels: %u rows, %u kernels, %u mismatching rows\n", rows, (unsigned int)kernels.size(), failed );
+    return failed > 0 ? 1 : 0;
+}
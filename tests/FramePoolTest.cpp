@@ -0,0 +1,210 @@
+/*****************************************************************
+  FRAME POOL TEST
+
+  Two checks of the frame pool, on frames sized by a synthetic camera:
+
+  - The free list under contention: threads acquire, share and release
+    the frames of a small pool as fast as they can. No frame may have two
+    owners at once, every frame must come back, an empty pool must be
+    counted, and the threads must not touch the heap.
+
+  - The scan loop's copy-and-save path: copying a frame into the pool and
+    handing it to a FrameWriter must not allocate once the first frames
+    are through. Linked with HeapCounter.o, which counts the calling
+    thread's allocations.
+
+  Needs the SDK but not OpenCV or a camera.
+
+*****************************************************************/
+
+#include "FramePool.h"
+#include "FrameWriter.h"
+#include "SyntheticCamera.h"
+#include "HeapCounter.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace FlyCapture2;
+
+namespace
+{
+    bool Check( bool ok, const char* pWhat )
+    {
+        if ( !ok )
+        {
+            printf( "FAILED: %s\n", pWhat );
+        }
+        return ok;
+    }
+
+    bool StressFreeList( CameraBase* pCamera )
+    {
+        const unsigned int numFrames = 3;
+        const unsigned int numThreads = 6;
+        const unsigned int cycles = 500000;
+
+        FramePool pool;
+        if ( !Check( pool.Allocate( pCamera, numFrames ) == PGRERROR_OK, "allocating the pool" ) )
+        {
+            return false;
+        }
+
+        std::atomic<unsigned int> owners[numFrames];
+        for ( unsigned int i = 0; i < numFrames; i++ )
+        {
+            owners[i] = 0;
+        }
+        std::atomic<unsigned long long> twiceOwned( 0 );
+        std::atomic<unsigned long long> acquired( 0 );
+        std::atomic<unsigned long long> allocations( 0 );
+
+        std::vector<std::thread> threads;
+        for ( unsigned int t = 0; t < numThreads; t++ )
+        {
+            threads.push_back( std::thread( [&]
+            {
+                HeapUsage before = ThreadHeapUsage();
+                for ( unsigned int i = 0; i < cycles; i++ )
+                {
+                    PooledFrame* pFrame = pool.Acquire();
+                    if ( pFrame == NULL )
+                    {
+                        continue;
+                    }
+                    if ( owners[pFrame->index].exchange( 1 ) != 0 )
+                    {
+                        twiceOwned++;
+                    }
+                    acquired++;
+                    // a second consumer, as when the writer and a recording share a frame
+                    pool.AddRef( pFrame );
+                    owners[pFrame->index] = 0;
+                    pool.Release( pFrame );
+                    pool.Release( pFrame );
+                }
+                allocations += ThreadHeapUsage().allocations - before.allocations;
+            } ) );
+        }
+        for ( unsigned int t = 0; t < threads.size(); t++ )
+        {
+            threads[t].join();
+        }
+
+        bool ok = Check( twiceOwned == 0, "no frame has two owners" );
+        ok = Check( acquired > 0, "frames were acquired" ) && ok;
+        ok = Check( pool.InUse() == 0, "every frame is back in the pool" ) && ok;
+        ok = Check( pool.Exhausted() > 0, "an empty pool is counted" ) && ok;
+        ok = Check( pool.HighWater() == numFrames, "every frame was in use at once" ) && ok;
+        ok = Check( allocations == 0, "the threads do not allocate" ) && ok;
+
+        // exactly numFrames distinct frames are free again
+        PooledFrame* frames[numFrames];
+        for ( unsigned int i = 0; i < numFrames; i++ )
+        {
+            frames[i] = pool.Acquire();
+            ok = Check( frames[i] != NULL, "a free frame after the run" ) && ok;
+        }
+        ok = Check( pool.Acquire() == NULL, "no more frames than the pool holds" ) && ok;
+        for ( unsigned int i = 0; i < numFrames; i++ )
+        {
+            pool.Release( frames[i] );
+        }
+
+        printf( "free list: %u threads, %llu frames acquired, pool empty %u times\n",
+                numThreads, acquired.load(), pool.Exhausted() );
+        return ok;
+    }
+
+    bool SubmitWithoutAllocating( CameraBase* pCamera, const std::string& directory )
+    {
+        const unsigned int capacity = 8;
+        const unsigned int numWorkers = 2;
+        const unsigned int warmupFrames = 4;
+        const unsigned int numFrames = 64;
+
+        // sized like the scan loop's pool with -write stream
+        FramePool pool;
+        if ( !Check( pool.Allocate( pCamera, capacity + numWorkers + 2 ) == PGRERROR_OK, "allocating the pool" ) )
+        {
+            return false;
+        }
+
+        Image raw;
+        if ( !Check( pCamera->RetrieveBuffer( &raw ) == PGRERROR_OK, "grabbing a frame" ) )
+        {
+            return false;
+        }
+
+        FrameWriter writer( directory, capacity, numWorkers, 1 );
+        writer.Start();
+        HeapUsage before;
+        unsigned int lost = 0;
+        for ( unsigned int i = 0; i < warmupFrames + numFrames; i++ )
+        {
+            if ( i == warmupFrames )
+            {
+                before = ThreadHeapUsage();
+            }
+            PooledFrame* pFrame = pool.Copy( raw, 0, (int)i );
+            if ( pFrame == NULL )
+            {
+                lost++;
+                continue;
+            }
+            writer.Submit( 0, (int)i, &pool, pFrame );
+        }
+        HeapUsage after = ThreadHeapUsage();
+        writer.Finish();
+
+        FrameWriterStats stats = writer.Stats();
+        bool ok = Check( after.allocations == before.allocations, "copy and submit do not allocate after warm-up" );
+        ok = Check( lost == 0 && pool.Exhausted() == 0, "the pool never runs empty" ) && ok;
+        ok = Check( stats.written == warmupFrames + numFrames && stats.errors == 0, "every frame is saved" ) && ok;
+        ok = Check( pool.InUse() == 0, "the writer releases every frame" ) && ok;
+
+        printf( "copy and submit: %llu allocations (%llu bytes) in %u frames after the first %u\n",
+                after.allocations - before.allocations, after.bytes - before.bytes, numFrames, warmupFrames );
+
+        for ( unsigned int i = 0; i < warmupFrames + numFrames; i++ )
+        {
+            char filename[512];
+            snprintf( filename, sizeof( filename ), "%s/cam--0-%u.tiff", directory.c_str(), i );
+            unlink( filename );
+        }
+        return ok;
+    }
+}
+
+int main()
+{
+    SyntheticCameraConfig config;
+    config.rows = 96;
+    config.cols = 128;
+    config.paced = false;
+    SyntheticCamera camera( config, 0 );
+    if ( camera.Connect() != PGRERROR_OK || camera.StartCapture() != PGRERROR_OK )
+    {
+        printf( "FAILED: starting the synthetic camera\n" );
+        return 1;
+    }
+
+    char directory[] = "/tmp/FramePoolTest.XXXXXX";
+    if ( mkdtemp( directory ) == NULL )
+    {
+        printf( "FAILED: creating %s\n", directory );
+        return 1;
+    }
+
+    bool ok = StressFreeList( &camera );
+    ok = SubmitWithoutAllocating( &camera, directory ) && ok;
+
+    camera.StopCapture();
+    camera.Disconnect();
+    rmdir( directory );
+    return ok ? 0 : 1;
+}